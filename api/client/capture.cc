@@ -0,0 +1,249 @@
+/* Copyright 2017 Outscale SAS
+ *
+ * This file is part of Butterfly.
+ *
+ * Butterfly is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License version 3 as published
+ * by the Free Software Foundation.
+ *
+ * Butterfly is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with Butterfly.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include <signal.h>
+#include "api/client/client.h"
+
+// Time between two checks of an interruption while waiting for packets
+#define CAPTURE_RECEIVE_TIMEOUT_MS 200
+
+static volatile sig_atomic_t capture_interrupted = 0;
+
+static void CaptureInterrupt(int signum) {
+    capture_interrupted = 1;
+}
+
+CaptureOptions::CaptureOptions() {
+    nic_id = "";
+}
+
+static inline bool CheckOption(int count, int argc, char **argv,
+                               char const *option) {
+    return count + 1 < argc && string(argv[count]) == option;
+}
+
+int CaptureOptions::Parse(int argc, char **argv) {
+    for (int i = 2; i < argc; i++) {
+        if (CheckOption(i, argc, argv, "--filter"))
+            filter = "filter: \"" + string(argv[i + 1]) + "\"";
+        else if (CheckOption(i, argc, argv, "--snaplen"))
+            snaplen = "snaplen: " + string(argv[i + 1]);
+        else if (CheckOption(i, argc, argv, "--sampling"))
+            sampling = "sampling: " + string(argv[i + 1]);
+        else if (CheckOption(i, argc, argv, "--pps"))
+            pps_limit = "pps_limit: " + string(argv[i + 1]);
+        else if (CheckOption(i, argc, argv, "--duration"))
+            duration = "duration: " + string(argv[i + 1]);
+        else if (CheckOption(i, argc, argv, "--path"))
+            path = "path: \"" + string(argv[i + 1]) + "\"";
+    }
+    // NIC id is the first argument, if it is not an option
+    if (argc > 2 && argv[2][0] != '-')
+        nic_id = string(argv[2]);
+    return 0;
+}
+
+static void SubCaptureHelp(void) {
+    cout << "usage: butterfly capture [NIC] [options...]" << endl <<
+        "       butterfly capture stop [NIC] [options...]" << endl <<
+        "       butterfly capture trace on|off [options...]" << endl << endl <<
+        "Stream packets of a vnic, or of the physical NIC if no vnic is "
+        "given, as a pcap" << endl <<
+        "file on stdout. Server must have a capture endpoint." << endl <<
+        "Example: butterfly capture nic-1 --filter \"tcp port 80\" | "
+        "tcpdump -n -r -" << endl << endl <<
+        "\"trace\" starts or stops tracing the physical NIC in a pcap file "
+        "on the server." << endl << endl <<
+        "options:" << endl <<
+        "    --filter FILTER  only stream packets matching a pcap filter" <<
+        endl <<
+        "    --snaplen BYTES  bytes kept from each packet (default: all)" <<
+        endl <<
+        "    --sampling N     only stream one packet out of N (default: 1)" <<
+        endl <<
+        "    --pps PACKETS    packets streamed per second, 0 for no limit "
+        "(default: 1000)" << endl <<
+        "    --duration SEC   seconds before the stream ends, 0 for no "
+        "limit (default: 60," << endl <<
+        "                     no limit for traces)" << endl <<
+        "    --path PATH      path of the trace on the server (default: "
+        "/tmp/butterfly-PID-main.pcap)" << endl;
+    GlobalParameterHelp();
+}
+
+static string CaptureStopRequest(const string &nic_id) {
+    string req =
+        "messages {"
+        "  revision: " PROTO_REV
+        "  message_0 {"
+        "    request {"
+        "      capture_stop {";
+    if (nic_id.length() > 0)
+        req += "    nic_id: \"" + nic_id + "\"";
+    req +=
+        "      }"
+        "    }"
+        "  }"
+        "}";
+    return req;
+}
+
+static int SubCaptureStop(int argc, char **argv,
+                          const GlobalOptions &options) {
+    string nic_id;
+    if (argc > 3 && argv[3][0] != '-')
+        nic_id = string(argv[3]);
+    proto::Messages res;
+    return Request(CaptureStopRequest(nic_id), &res, options, false);
+}
+
+static int SubCaptureTrace(int argc, char **argv,
+                           const GlobalOptions &options) {
+    if (argc <= 3 ||
+        (string(argv[3]) != "on" && string(argv[3]) != "off")) {
+        SubCaptureHelp();
+        return 1;
+    }
+    CaptureOptions o;
+    if (o.Parse(argc, argv)) {
+        SubCaptureHelp();
+        return 1;
+    }
+    string enable = string(argv[3]) == "on" ? "true" : "false";
+    string req =
+        "messages {"
+        "  revision: " PROTO_REV
+        "  message_0 {"
+        "    request {"
+        "      port_trace {"
+        "        enable: " + enable +
+        o.path + o.filter + o.snaplen + o.sampling + o.duration +
+        "      }"
+        "    }"
+        "  }"
+        "}";
+    proto::Messages res;
+    return Request(req, &res, options, false);
+}
+
+// Stream endpoint bound on all addresses is reached through the API host
+static string StreamEndpoint(const string &stream, const string &api) {
+    size_t scheme = stream.find("://");
+    size_t port = stream.rfind(':');
+    if (scheme == string::npos || port <= scheme)
+        return stream;
+    string host = stream.substr(scheme + 3, port - scheme - 3);
+    if (host != "*" && host != "0.0.0.0")
+        return stream;
+
+    size_t api_scheme = api.find("://");
+    size_t api_port = api.rfind(':');
+    if (api_scheme == string::npos || api_port <= api_scheme)
+        return stream;
+    string api_host = api.substr(api_scheme + 3, api_port - api_scheme - 3);
+    return stream.substr(0, scheme + 3) + api_host + stream.substr(port);
+}
+
+// Write pcap header of the stream, records are sent by the server
+static bool WritePcapHeader(void) {
+    struct {
+        uint32_t magic;
+        uint16_t version_major;
+        uint16_t version_minor;
+        int32_t thiszone;
+        uint32_t sigfigs;
+        uint32_t snaplen;
+        uint32_t network;
+    } hdr = {0xa1b2c3d4, 2, 4, 0, 0, 65535, 1};
+
+    cout.write(reinterpret_cast<const char *>(&hdr), sizeof(hdr));
+    cout.flush();
+    return cout.good();
+}
+
+int SubCapture(int argc, char **argv, const GlobalOptions &options) {
+    if (argc >= 3 && string(argv[2]) == "help") {
+        SubCaptureHelp();
+        return 0;
+    }
+    if (argc >= 3 && string(argv[2]) == "stop")
+        return SubCaptureStop(argc, argv, options);
+    if (argc >= 3 && string(argv[2]) == "trace")
+        return SubCaptureTrace(argc, argv, options);
+
+    CaptureOptions o;
+    if (o.Parse(argc, argv)) {
+        SubCaptureHelp();
+        return 1;
+    }
+    string req =
+        "messages {"
+        "  revision: " PROTO_REV
+        "  message_0 {"
+        "    request {"
+        "      capture_start {";
+    if (o.nic_id.length() > 0)
+        req += "    nic_id: \"" + o.nic_id + "\"";
+    req += o.filter + o.snaplen + o.sampling + o.pps_limit + o.duration;
+    req +=
+        "      }"
+        "    }"
+        "  }"
+        "}";
+
+    proto::Messages res;
+    if (Request(req, &res, options, false))
+        return 1;
+    MessageV0_Response res_0 = res.messages(0).message_0().response();
+    if (!res_0.has_capture_start()) {
+        cerr << "no capture stream received" << endl;
+        return 1;
+    }
+    string endpoint = StreamEndpoint(res_0.capture_start().endpoint(),
+                                     options.endpoint);
+    string topic = res_0.capture_start().topic();
+
+    zmqpp::context context;
+    zmqpp::socket socket(context, zmqpp::socket_type::subscribe);
+    socket.set(zmqpp::socket_option::receive_timeout,
+               CAPTURE_RECEIVE_TIMEOUT_MS);
+    socket.connect(endpoint);
+    socket.subscribe(topic);
+
+    // Stop the stream if the reader goes away or on interruption
+    signal(SIGPIPE, SIG_IGN);
+    signal(SIGINT, CaptureInterrupt);
+    signal(SIGTERM, CaptureInterrupt);
+    bool ended = !WritePcapHeader();
+    while (!ended && !capture_interrupted) {
+        zmqpp::message message;
+        try {
+            if (!socket.receive(message) || message.parts() < 2)
+                continue;
+        } catch (exception &e) {
+            // Receive is interrupted by signals
+            continue;
+        }
+        if (message.size(1) == 0)
+            return 0;
+        cout.write(static_cast<const char *>(message.raw_data(1)),
+                   message.size(1));
+        cout.flush();
+        ended = !cout.good();
+    }
+    return Request(CaptureStopRequest(o.nic_id), &res, options, false);
+}
@@ -80,6 +80,8 @@ static void Help(void) {
         "    shutdown  ask butterflyd to stop" << endl <<
         "    request   send a protobuf request to butterfly" << endl <<
         "    dump      extract Butterfly configuration" << endl <<
+        "    capture   stream packets in pcap format" << endl <<
+        "    counters  read counters published by butterflyd" << endl <<
         endl <<
 
         "options:" << endl <<
@@ -120,6 +122,10 @@ int main(int argc, char **argv) {
         return SubRequest(argc, argv, options);
     } else if (cmd == "dump") {
         return SubDump(argc, argv, options);
+    } else if (cmd == "capture") {
+        return SubCapture(argc, argv, options);
+    } else if (cmd == "counters") {
+        return SubCounters(argc, argv, options);
     } else {
         cerr << "invalid subcommand " << cmd << endl;
         Help();
@@ -87,6 +87,18 @@ struct NicAddOptions {
     string packet_trace;
     string packet_trace_path;
     string bypass_filtering;
+    string egress_bps_limit;
+    string egress_pps_limit;
+    string ingress_bps_limit;
+    string ingress_pps_limit;
+    string new_conn_pps_limit;
+    string bum_pps_limit;
+    string priority;
+    string mss_clamp;
+    string count_rule_hits;
+    string packet_trace_filter;
+    string packet_trace_snaplen;
+    string packet_trace_sampling;
 };
 
 struct NicUpdateOptions {
@@ -97,6 +109,30 @@ struct NicUpdateOptions {
     string enable_antispoof;
     string packet_trace;
     string packet_trace_path;
+    string egress_bps_limit;
+    string egress_pps_limit;
+    string ingress_bps_limit;
+    string ingress_pps_limit;
+    string new_conn_pps_limit;
+    string bum_pps_limit;
+    string priority;
+    string mss_clamp;
+    string count_rule_hits;
+    string packet_trace_filter;
+    string packet_trace_snaplen;
+    string packet_trace_sampling;
+};
+
+struct CaptureOptions {
+    CaptureOptions();
+    int Parse(int argc, char **argv);
+    string nic_id;
+    string filter;
+    string snaplen;
+    string sampling;
+    string pps_limit;
+    string duration;
+    string path;
 };
 
 struct RuleAddOptions {
@@ -121,6 +157,8 @@ int sub_status(int argc, char **argv, const GlobalOptions &options);
 int sub_shutdown(int argc, char **argv, const GlobalOptions &options);
 int SubRequest(int argc, char **argv, const GlobalOptions &options);
 int SubDump(int argc, char **argv, const GlobalOptions &options);
+int SubCapture(int argc, char **argv, const GlobalOptions &options);
+int SubCounters(int argc, char **argv, const GlobalOptions &options);
 int sub_status(int argc, char **argv, const GlobalOptions &options);
 int Request(const proto::Messages &request,
             proto::Messages *response,
@@ -0,0 +1,59 @@
+/* Copyright 2017 Outscale SAS
+ *
+ * This file is part of Butterfly.
+ *
+ * Butterfly is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License version 3 as published
+ * by the Free Software Foundation.
+ *
+ * Butterfly is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with Butterfly.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include <vector>
+#include "api/client/client.h"
+#include "api/common/counters.h"
+
+static void SubCountersHelp(void) {
+    cout << "usage: butterfly counters FILE [options...]" << endl << endl <<
+        "Print counters published by butterflyd in FILE (see "
+        "counters-path option of" << endl <<
+        "butterflyd), without sending any request." << endl <<
+        "Example: butterfly counters /dev/shm/butterfly-counters "
+        "--prefix nic." << endl << endl <<
+        "options:" << endl <<
+        "    --prefix PREFIX  only print counters starting with PREFIX" <<
+        endl;
+}
+
+int SubCounters(int argc, char **argv, const GlobalOptions &options) {
+    if (argc < 3 || argv[2][0] == '-' || string(argv[2]) == "help") {
+        SubCountersHelp();
+        return argc >= 3 && string(argv[2]) == "help" ? 0 : 1;
+    }
+    string path = string(argv[2]);
+    string prefix;
+    for (int i = 3; i + 1 < argc; i++) {
+        if (string(argv[i]) == "--prefix")
+            prefix = string(argv[i + 1]);
+    }
+
+    std::vector<Counters::Counter> counters;
+    uint64_t date;
+    string error;
+    if (!Counters::Read(path, &counters, &date, &error)) {
+        cerr << error << endl;
+        return 1;
+    }
+    cout << "date: " << date << endl;
+    for (auto &c : counters) {
+        if (c.first.compare(0, prefix.length(), prefix) == 0)
+            cout << c.first << " " << c.second << endl;
+    }
+    return 0;
+}
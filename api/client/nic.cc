@@ -52,28 +52,155 @@ static int SubNicList(int argc, char **argv, const GlobalOptions &options) {
 }
 
 static void SubNicStatsHelp(void) {
-    cout << "usage: butterfly nic stats NIC [options...]" << endl << endl;
-    cout << "Show some statistics of a vnic (in bytes)" << endl;
+    cout << "usage: butterfly nic stats NIC... [options...]" << endl <<
+        "       butterfly nic stats --all [--vni VNI] [options...]" << endl <<
+        endl;
+    cout << "Show some statistics of one or more vnics" << endl << endl <<
+        "options:" << endl <<
+        "    --all      show statistics of all vnics" << endl <<
+        "    --vni VNI  only show vnics of a VNI" << endl;
     GlobalParameterHelp();
 }
 
+static void PrintLatency(const MessageV0_LatencyStats &l,
+                         const string &direction, const string &indent) {
+    cout << indent << direction << " latency samples: " <<
+        to_string(l.samples()) << endl;
+    cout << indent << direction << " latency p50/p99/p999 (ns): " <<
+        to_string(l.p50()) << "/" << to_string(l.p99()) << "/" <<
+        to_string(l.p999()) << endl;
+}
+
+static void PrintNicStats(const MessageV0_NicStats &s,
+                          const string &indent) {
+    cout << indent << "in: " << to_string(s.in()) << endl;
+    cout << indent << "out: " << to_string(s.out()) << endl;
+    if (s.has_egress_throttled())
+        cout << indent << "egress throttled: " <<
+            to_string(s.egress_throttled()) << endl;
+    if (s.has_bum_dropped())
+        cout << indent << "bum dropped: " <<
+            to_string(s.bum_dropped()) << endl;
+    if (s.has_mss_clamped())
+        cout << indent << "mss clamped: " <<
+            to_string(s.mss_clamped()) << endl;
+    if (s.has_trace_dropped())
+        cout << indent << "trace dropped: " <<
+            to_string(s.trace_dropped()) << endl;
+    if (s.has_egress_packets())
+        cout << indent << "egress packets: " <<
+            to_string(s.egress_packets()) << endl;
+    if (s.has_egress_bytes())
+        cout << indent << "egress bytes: " <<
+            to_string(s.egress_bytes()) << endl;
+    if (s.has_ingress_packets())
+        cout << indent << "ingress packets: " <<
+            to_string(s.ingress_packets()) << endl;
+    if (s.has_ingress_bytes())
+        cout << indent << "ingress bytes: " <<
+            to_string(s.ingress_bytes()) << endl;
+    if (s.has_egress_firewall_dropped())
+        cout << indent << "egress firewall dropped: " <<
+            to_string(s.egress_firewall_dropped()) << endl;
+    if (s.has_ingress_firewall_dropped())
+        cout << indent << "ingress firewall dropped: " <<
+            to_string(s.ingress_firewall_dropped()) << endl;
+    if (s.has_egress_antispoof_dropped())
+        cout << indent << "egress antispoof dropped: " <<
+            to_string(s.egress_antispoof_dropped()) << endl;
+    if (s.has_ingress_antispoof_dropped())
+        cout << indent << "ingress antispoof dropped: " <<
+            to_string(s.ingress_antispoof_dropped()) << endl;
+    if (s.has_ingress_vhost_dropped_bytes())
+        cout << indent << "ingress vhost dropped bytes: " <<
+            to_string(s.ingress_vhost_dropped_bytes()) << endl;
+    if (s.has_ingress_policed())
+        cout << indent << "ingress policed: " <<
+            to_string(s.ingress_policed()) << endl;
+    if (s.has_egress_conn_rejected())
+        cout << indent << "egress connections rejected: " <<
+            to_string(s.egress_conn_rejected()) << endl;
+    if (s.has_ingress_conn_rejected())
+        cout << indent << "ingress connections rejected: " <<
+            to_string(s.ingress_conn_rejected()) << endl;
+    if (s.has_egress_latency())
+        PrintLatency(s.egress_latency(), "egress", indent);
+    if (s.has_ingress_latency())
+        PrintLatency(s.ingress_latency(), "ingress", indent);
+}
+
+static int SubNicStatsBulk(const vector<string> &nics, const string &vni,
+                           const GlobalOptions &options) {
+    string req =
+        "messages {"
+        "  revision: " PROTO_REV
+        "  message_0 {"
+        "    request {"
+        "      nic_stats_bulk {";
+    for (auto &nic : nics)
+        req += "    id: \"" + nic + "\"";
+    if (vni.length() > 0)
+        req += "    vni: " + vni;
+    req +=
+        "      }"
+        "    }"
+        "  }"
+        "}";
+
+    proto::Messages res;
+    if (Request(req, &res, options, false))
+        return 1;
+
+    MessageV0_Response res_0 = res.messages(0).message_0().response();
+    if (!res_0.has_nic_stats_bulk()) {
+        cerr << "no nic stats received" << endl;
+        return 1;
+    }
+    const MessageV0_NicStatsBulkRes &bulk = res_0.nic_stats_bulk();
+    cout << "date: " << to_string(bulk.date()) << endl;
+    for (int i = 0; i < bulk.nics_size(); i++) {
+        cout << bulk.nics(i).id() << ":" << endl;
+        PrintNicStats(bulk.nics(i).stats(), "    ");
+    }
+    return 0;
+}
+
 static int SubNicStats(int argc, char **argv, const GlobalOptions &options) {
     if (argc >= 4 && string(argv[3]) == "help") {
         SubNicStatsHelp();
         return 0;
     }
 
-    if (argc <= 3) {
+    vector<string> nics;
+    string vni;
+    bool all = false;
+    for (int i = 3; i < argc; i++) {
+        string arg = string(argv[i]);
+        if (arg == "--all") {
+            all = true;
+        } else if (arg == "--vni" && i + 1 < argc) {
+            vni = string(argv[++i]);
+        } else if (arg == "-e" || arg == "--endpoint" || arg == "-k" ||
+                   arg == "--key") {
+            // Global option with a value
+            i++;
+        } else if (arg[0] != '-') {
+            nics.push_back(arg);
+        }
+    }
+    if (nics.empty() && !all && vni.length() == 0) {
         SubNicStatsHelp();
         return 1;
     }
-    string nic = string(argv[3]);
+    if (nics.size() != 1 || vni.length() > 0)
+        return SubNicStatsBulk(nics, vni, options);
+
     string req =
         "messages {"
         "  revision: " PROTO_REV
         "  message_0 {"
         "    request {"
-        "      nic_stats: \"" + nic + "\""
+        "      nic_stats: \"" + nics[0] + "\""
         "    }"
         "  }"
         "}";
@@ -89,9 +216,55 @@ static int SubNicStats(int argc, char **argv, const GlobalOptions &options) {
         return 1;
     }
 
-    MessageV0_NicStats stats = res_0.nic_stats();
-    cout << "in: " << to_string(stats.in()) << endl;
-    cout << "out: " << to_string(stats.out()) << endl;
+    PrintNicStats(res_0.nic_stats(), "");
+    return 0;
+}
+
+static void SubNicRecordHelp(void) {
+    cout << "usage: butterfly nic record NIC PATH [options...]" << endl <<
+        endl;
+    cout << "Write the last packets of a vnic in a pcap file on the server"
+         << endl;
+    GlobalParameterHelp();
+}
+
+static int SubNicRecord(int argc, char **argv, const GlobalOptions &options) {
+    if (argc >= 4 && string(argv[3]) == "help") {
+        SubNicRecordHelp();
+        return 0;
+    }
+
+    if (argc <= 4) {
+        SubNicRecordHelp();
+        return 1;
+    }
+    string nic = string(argv[3]);
+    string path = string(argv[4]);
+    string req =
+        "messages {"
+        "  revision: " PROTO_REV
+        "  message_0 {"
+        "    request {"
+        "      nic_record_dump {"
+        "        id: \"" + nic + "\""
+        "        path: \"" + path + "\""
+        "      }"
+        "    }"
+        "  }"
+        "}";
+
+    proto::Messages res;
+
+    if (Request(req, &res, options, false))
+        return 1;
+
+    MessageV0_Response res_0 = res.messages(0).message_0().response();
+    if (!res_0.has_nic_record_dump()) {
+        cerr << "no nic record dump received" << endl;
+        return 1;
+    }
+    cout << "packets: " << to_string(res_0.nic_record_dump().packets()) <<
+        endl;
     return 0;
 }
 
@@ -145,6 +318,40 @@ static int SubNicDetails(int argc, char **argv,
             (details.ip_anti_spoof() ? "true" : "false") << endl;
     if (details.has_sniff_target_nic_id())
         cout << "sniff target: " << details.sniff_target_nic_id() << endl;
+    if (details.has_egress_bps_limit())
+        cout << "egress bps limit: " <<
+            to_string(details.egress_bps_limit()) << endl;
+    if (details.has_egress_pps_limit())
+        cout << "egress pps limit: " <<
+            to_string(details.egress_pps_limit()) << endl;
+    if (details.has_ingress_bps_limit())
+        cout << "ingress bps limit: " <<
+            to_string(details.ingress_bps_limit()) << endl;
+    if (details.has_ingress_pps_limit())
+        cout << "ingress pps limit: " <<
+            to_string(details.ingress_pps_limit()) << endl;
+    if (details.has_new_conn_pps_limit())
+        cout << "new connections per second limit: " <<
+            to_string(details.new_conn_pps_limit()) << endl;
+    if (details.has_bum_pps_limit())
+        cout << "bum pps limit: " <<
+            to_string(details.bum_pps_limit()) << endl;
+    if (details.has_priority())
+        cout << "priority: " << to_string(details.priority()) << endl;
+    if (details.has_mss_clamp())
+        cout << "mss clamp: " <<
+            (details.mss_clamp() ? "true" : "false") << endl;
+    if (details.has_count_rule_hits())
+        cout << "count rule hits: " <<
+            (details.count_rule_hits() ? "true" : "false") << endl;
+    if (details.has_packet_trace_filter())
+        cout << "trace filter: " << details.packet_trace_filter() << endl;
+    if (details.has_packet_trace_snaplen())
+        cout << "trace snaplen: " <<
+            to_string(details.packet_trace_snaplen()) << endl;
+    if (details.has_packet_trace_sampling())
+        cout << "trace sampling: " <<
+            to_string(details.packet_trace_sampling()) << endl;
     return 0;
 }
 
@@ -429,6 +636,34 @@ int NicAddOptions::Parse(int argc, char **argv) {
             packet_trace = "packet_trace: " + string(argv[i + 1]);
         else if (string(argv[i]) == "--trace-path")
             packet_trace_path = "packet_trace_path: " + string(argv[i + 1]);
+        else if (CheckOption(i, argc, argv, "--egress-bps"))
+            egress_bps_limit = "egress_bps_limit: " + string(argv[i + 1]);
+        else if (CheckOption(i, argc, argv, "--egress-pps"))
+            egress_pps_limit = "egress_pps_limit: " + string(argv[i + 1]);
+        else if (CheckOption(i, argc, argv, "--ingress-bps"))
+            ingress_bps_limit = "ingress_bps_limit: " + string(argv[i + 1]);
+        else if (CheckOption(i, argc, argv, "--ingress-pps"))
+            ingress_pps_limit = "ingress_pps_limit: " + string(argv[i + 1]);
+        else if (CheckOption(i, argc, argv, "--new-conn-pps"))
+            new_conn_pps_limit = "new_conn_pps_limit: " +
+                string(argv[i + 1]);
+        else if (CheckOption(i, argc, argv, "--bum-pps"))
+            bum_pps_limit = "bum_pps_limit: " + string(argv[i + 1]);
+        else if (CheckOption(i, argc, argv, "--priority"))
+            priority = "priority: " + string(argv[i + 1]);
+        else if (CheckOption(i, argc, argv, "--mss-clamp"))
+            mss_clamp = "mss_clamp: " + string(argv[i + 1]);
+        else if (CheckOption(i, argc, argv, "--rule-hits"))
+            count_rule_hits = "count_rule_hits: " + string(argv[i + 1]);
+        else if (CheckOption(i, argc, argv, "--trace-filter"))
+            packet_trace_filter = "packet_trace_filter: \"" +
+                string(argv[i + 1]) + "\"";
+        else if (CheckOption(i, argc, argv, "--trace-snaplen"))
+            packet_trace_snaplen = "packet_trace_snaplen: " +
+                string(argv[i + 1]);
+        else if (CheckOption(i, argc, argv, "--trace-sampling"))
+            packet_trace_sampling = "packet_trace_sampling: " +
+                string(argv[i + 1]);
     }
 
     if (!packet_trace_path.empty() &&
@@ -453,6 +688,34 @@ int NicUpdateOptions::Parse(int argc, char **argv) {
         else if (string(argv[i]) == "--trace-path")
             packet_trace_path = "packet_trace_path: \"" +
                                 string(argv[i + 1]) + "\"";
+        else if (CheckOption(i, argc, argv, "--egress-bps"))
+            egress_bps_limit = "egress_bps_limit: " + string(argv[i + 1]);
+        else if (CheckOption(i, argc, argv, "--egress-pps"))
+            egress_pps_limit = "egress_pps_limit: " + string(argv[i + 1]);
+        else if (CheckOption(i, argc, argv, "--ingress-bps"))
+            ingress_bps_limit = "ingress_bps_limit: " + string(argv[i + 1]);
+        else if (CheckOption(i, argc, argv, "--ingress-pps"))
+            ingress_pps_limit = "ingress_pps_limit: " + string(argv[i + 1]);
+        else if (CheckOption(i, argc, argv, "--new-conn-pps"))
+            new_conn_pps_limit = "new_conn_pps_limit: " +
+                string(argv[i + 1]);
+        else if (CheckOption(i, argc, argv, "--bum-pps"))
+            bum_pps_limit = "bum_pps_limit: " + string(argv[i + 1]);
+        else if (CheckOption(i, argc, argv, "--priority"))
+            priority = "priority: " + string(argv[i + 1]);
+        else if (CheckOption(i, argc, argv, "--mss-clamp"))
+            mss_clamp = "mss_clamp: " + string(argv[i + 1]);
+        else if (CheckOption(i, argc, argv, "--rule-hits"))
+            count_rule_hits = "count_rule_hits: " + string(argv[i + 1]);
+        else if (CheckOption(i, argc, argv, "--trace-filter"))
+            packet_trace_filter = "packet_trace_filter: \"" +
+                string(argv[i + 1]) + "\"";
+        else if (CheckOption(i, argc, argv, "--trace-snaplen"))
+            packet_trace_snaplen = "packet_trace_snaplen: " +
+                string(argv[i + 1]);
+        else if (CheckOption(i, argc, argv, "--trace-sampling"))
+            packet_trace_sampling = "packet_trace_sampling: " +
+                string(argv[i + 1]);
     }
     if (id.empty())
         return 1;
@@ -481,7 +744,34 @@ static void SubNicAddHelp(void) {
         "    --trace-path PATH    where to store pcap file if packet-trace" <<
         "    was set true (default: PATH = /tmp/butterfly-PID-nic-NICID.pcap)"
             << endl <<
-        "    --bypass-filtering  remove all filters and protection" << endl;
+        "    --bypass-filtering  remove all filters and protection" << endl <<
+        "    --egress-bps BPS    limit traffic sent by the vnic in bits per"
+        " second (default: 0, no limit)" << endl <<
+        "    --egress-pps PPS    limit traffic sent by the vnic in packets per"
+        " second (default: 0, no limit)" << endl <<
+        "    --ingress-bps BPS   drop traffic coming to the vnic above BPS bits"
+        " per second (default: 0, no limit)" << endl <<
+        "    --ingress-pps PPS   drop traffic coming to the vnic above PPS"
+        " packets per second (default: 0, no limit)" << endl <<
+        "    --new-conn-pps PPS  drop tcp connections opened and accepted by"
+        " the vnic above PPS per second (default: 0, no limit)" << endl <<
+        "    --bum-pps PPS       drop broadcast and multicast packets sent by"
+        " the vnic above PPS packets per second (default: 0, no limit)"
+            << endl <<
+        "    --priority PRIO     poll the vnic before vnics with a lower"
+        " priority, from 0 to 7 (default: 0)" << endl <<
+        "    --mss-clamp BOOL    lower TCP MSS so encapsulated packets fit"
+        " in the physical MTU, not with --bypass-filtering (default: false)"
+            << endl <<
+        "    --rule-hits BOOL    count packets matching each rule of the"
+        " vnic's security groups, see sg rule list (default: false)"
+            << endl <<
+        "    --trace-filter FILTER  only trace packets matching this pcap"
+        " filter (default: all packets)" << endl <<
+        "    --trace-snaplen BYTES  bytes traced from each packet"
+        " (default: 0, full packets)" << endl <<
+        "    --trace-sampling N  only trace one packet out of N"
+        " (default: 1, all packets)" << endl;
     GlobalParameterHelp();
 }
 
@@ -497,7 +787,30 @@ static void SubNicUpdateHelp(void) {
         "    (default: use server behaviour)" << endl <<
         "    --trace-path PATH    where to store pcap file if packet-trace" <<
         "    was set true (default: PATH = /tmp/butterfly-PID-nic-NICID.pcap)"
-            << endl;
+            << endl <<
+        "    --egress-bps BPS    limit traffic sent by the vnic in bits per"
+        " second (0 for no limit)" << endl <<
+        "    --egress-pps PPS    limit traffic sent by the vnic in packets per"
+        " second (0 for no limit)" << endl <<
+        "    --ingress-bps BPS   drop traffic coming to the vnic above BPS bits"
+        " per second (0 for no limit)" << endl <<
+        "    --ingress-pps PPS   drop traffic coming to the vnic above PPS"
+        " packets per second (0 for no limit)" << endl <<
+        "    --new-conn-pps PPS  drop tcp connections opened and accepted by"
+        " the vnic above PPS per second (0 for no limit)" << endl <<
+        "    --bum-pps PPS       drop broadcast and multicast packets sent by"
+        " the vnic above PPS packets per second (0 for no limit)" << endl <<
+        "    --priority PRIO     poll the vnic before vnics with a lower"
+        " priority, from 0 to 7" << endl <<
+        "    --mss-clamp BOOL    lower TCP MSS so encapsulated packets fit"
+        " in the physical MTU, not with bypass filtering" << endl <<
+        "    --rule-hits BOOL    count packets matching each rule of the"
+        " vnic's security groups" << endl <<
+        "    --trace-filter FILTER  only trace packets matching this pcap"
+        " filter (empty for all packets)" << endl <<
+        "    --trace-snaplen BYTES  bytes traced from each packet"
+        " (0 for full packets)" << endl <<
+        "    --trace-sampling N  only trace one packet out of N" << endl;
     GlobalParameterHelp();
 }
 
@@ -532,6 +845,18 @@ static int SubNicAdd(int argc, char **argv, const GlobalOptions &options) {
         "        " + o.packet_trace +
         "        " + o.packet_trace_path +
         "        bypass_filtering: " + o.bypass_filtering +
+        "        " + o.egress_bps_limit +
+        "        " + o.egress_pps_limit +
+        "        " + o.ingress_bps_limit +
+        "        " + o.ingress_pps_limit +
+        "        " + o.new_conn_pps_limit +
+        "        " + o.bum_pps_limit +
+        "        " + o.priority +
+        "        " + o.mss_clamp +
+        "        " + o.count_rule_hits +
+        "        " + o.packet_trace_filter +
+        "        " + o.packet_trace_snaplen +
+        "        " + o.packet_trace_sampling +
         "      }"
         "    }"
         "  }"
@@ -581,6 +906,18 @@ static int SubNicUpdate(int argc, char **argv, const GlobalOptions &options) {
     req +=
         "        " + o.packet_trace +
         "        " + o.packet_trace_path +
+        "        " + o.egress_bps_limit +
+        "        " + o.egress_pps_limit +
+        "        " + o.ingress_bps_limit +
+        "        " + o.ingress_pps_limit +
+        "        " + o.new_conn_pps_limit +
+        "        " + o.bum_pps_limit +
+        "        " + o.priority +
+        "        " + o.mss_clamp +
+        "        " + o.count_rule_hits +
+        "        " + o.packet_trace_filter +
+        "        " + o.packet_trace_snaplen +
+        "        " + o.packet_trace_sampling +
         "      }"
         "    }"
         "  }"
@@ -647,6 +984,7 @@ static void SubNicHelp(void) {
         "butterfly nic subcommands:" << endl <<
         "    list     list all nics id" << endl <<
         "    stats    show nic statistics" << endl <<
+        "    record   dump last packets of a nic in a pcap file" << endl <<
         "    details  prints nics's details" << endl <<
         "    sg       manage security groups attached to a nic " << endl <<
         "    add      create a new nic" << endl <<
@@ -664,6 +1002,8 @@ int SubNic(int argc, char **argv, const GlobalOptions &options) {
         return SubNicList(argc, argv, options);
     } else if (cmd == "stats") {
         return SubNicStats(argc, argv, options);
+    } else if (cmd == "record") {
+        return SubNicRecord(argc, argv, options);
     } else if (cmd == "details") {
         return SubNicDetails(argc, argv, options);
     } else if (cmd == "sg") {
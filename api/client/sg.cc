@@ -150,8 +150,11 @@ static int SubSgDel(int argc, char **argv, const GlobalOptions &options) {
 }
 
 static string RuleHash(const MessageV0_Rule &r) {
+    // Hash must not change with rule hits
+    MessageV0_Rule rule(r);
+    rule.clear_hits();
     string human_message;
-    google::protobuf::TextFormat::PrintToString(r, &human_message);
+    google::protobuf::TextFormat::PrintToString(rule, &human_message);
     hash<string> fn;
     size_t hash = fn(human_message);
     ostringstream out;
@@ -172,7 +175,8 @@ static void RulePrint(const MessageV0_Rule &r) {
             r.cidr().address() + "/" + to_string(r.cidr().mask_size()) :
             "Ø") << " - " <<
         "members of sg: " <<
-            (r.has_security_group() ? r.security_group() : "Ø") << endl;
+            (r.has_security_group() ? r.security_group() : "Ø") <<
+        (r.has_hits() ? " - hits: " + to_string(r.hits()) : "") << endl;
 }
 
 static void SubSgRuleListHelp(void) {
@@ -255,8 +259,7 @@ int RuleAddOptions::Parse(int argc, char **argv) {
             if (direction == "in") {
                 direction = "INBOUND";
             } else if (direction == "out") {
-                cerr << "outbound not supported at the moment" << endl;
-                return 1;
+                direction = "OUTBOUND";
             } else {
                 cerr << "--dir argument not recognized" << endl;
                 return 1;
@@ -362,8 +365,10 @@ static void SubSgRuleAddHelp(void) {
         "    --sg-members SG    security group members to allow" << endl <<
         endl <<
         "DIRECTION:" << endl << endl <<
-        "Can only be 'in' (for inbound) at the moment, 'out' (for outbound) "
-        "not supported yet" << endl << endl <<
+        "Can be 'in' (for inbound) or 'out' (for outbound)." << endl <<
+        "Outbound rules use CIDR or SG to describe destinations. A NIC "
+        "without outbound rules can send any packet from its IPs." << endl <<
+        endl <<
         "PROTO:" << endl << endl <<
         "Must be 'tcp', 'udp', 'icmp', a number between 0 and 255 "
         "or 'all' to allow all protocols" << endl << endl <<
@@ -433,8 +438,10 @@ static void SubSgRuleDelHelp(void) {
         "    --sg-members SG    security group members to allow" << endl <<
         endl <<
         "DIRECTION:" << endl << endl <<
-        "Can only be 'in' (for inbound) at the moment, 'out' (for outbound) "
-        "not supported yet" << endl << endl <<
+        "Can be 'in' (for inbound) or 'out' (for outbound)." << endl <<
+        "Outbound rules use CIDR or SG to describe destinations. A NIC "
+        "without outbound rules can send any packet from its IPs." << endl <<
+        endl <<
         "PROTO:" << endl << endl <<
         "Must be 'tcp', 'udp', 'icmp', a number between 0 and 255 "
         "or 'all' to allow all protocols" << endl << endl <<
@@ -474,8 +481,9 @@ static int SubSgHashedRuleDel(int argc, char **argv,
     for (int i = 0; i < size; i++) {
         if (hash == RuleHash(res_0.sg_rule_list(i))) {
             string rule_string;
-            google::protobuf::TextFormat::PrintToString(res_0.sg_rule_list(i),
-                                                        &rule_string);
+            MessageV0_Rule rule(res_0.sg_rule_list(i));
+            rule.clear_hits();
+            google::protobuf::TextFormat::PrintToString(rule, &rule_string);
             delete_req +=
                 "messages {"
                 "  revision: " PROTO_REV
@@ -18,16 +18,82 @@
 #include "api/client/client.h"
 
 static void SubSgStatusHelp(void) {
-    cout << "usage: butterfly status [options...]" << endl << endl;
-    cout << "Show butterfly status informations" << endl;
+    cout << "usage: butterfly status [options...]" << endl <<
+        "       butterfly status drops [options...]" << endl << endl;
+    cout << "Show butterfly status informations" << endl <<
+        "\"drops\" shows packets dropped by each brick and why" << endl;
     GlobalParameterHelp();
 }
 
+static string DropReasonName(MessageV0_DropCount_Reason reason) {
+    switch (reason) {
+        case MessageV0_DropCount_Reason_VTEP:
+            return "unknown vni";
+        case MessageV0_DropCount_Reason_FIREWALL:
+            return "firewall";
+        case MessageV0_DropCount_Reason_ANTISPOOF:
+            return "antispoof";
+        case MessageV0_DropCount_Reason_STORM:
+            return "storm control";
+        case MessageV0_DropCount_Reason_VHOST_FULL:
+            return "vhost ring full";
+        case MessageV0_DropCount_Reason_POLICER:
+            return "ingress policer";
+        case MessageV0_DropCount_Reason_CONN_LIMIT:
+            return "connection limit";
+    }
+    return "unknown";
+}
+
+static void PrintDropCount(const MessageV0_DropCount &d) {
+    if (d.has_brick())
+        cout << d.brick() << " ";
+    cout << DropReasonName(d.reason()) << ": ";
+    if (d.has_bytes())
+        cout << to_string(d.bytes()) << " bytes" << endl;
+    else
+        cout << to_string(d.packets()) << " packets" << endl;
+}
+
+static int SubStatusDrops(int argc, char **argv,
+                          const GlobalOptions &options) {
+    string req =
+        "messages {"
+        "  revision: " PROTO_REV
+        "  message_0 {"
+        "    request {"
+        "      drop_stats: true"
+        "    }"
+        "  }"
+        "}";
+
+    proto::Messages res;
+    if (Request(req, &res, options, false))
+        return 1;
+
+    MessageV0_Response res_0 = res.messages(0).message_0().response();
+    if (!res_0.has_drop_stats()) {
+        cerr << "no drop stats received" << endl;
+        return 1;
+    }
+    const MessageV0_DropStatsRes &s = res_0.drop_stats();
+    for (int i = 0; i < s.bricks_size(); i++)
+        PrintDropCount(s.bricks(i));
+    cout << "total:" << endl;
+    for (int i = 0; i < s.totals_size(); i++) {
+        cout << "    ";
+        PrintDropCount(s.totals(i));
+    }
+    return 0;
+}
+
 int sub_status(int argc, char **argv, const GlobalOptions &options) {
     if (argc >= 3 && string(argv[2]) == "help") {
         SubSgStatusHelp();
         return 0;
     }
+    if (argc >= 3 && string(argv[2]) == "drops")
+        return SubStatusDrops(argc, argv, options);
 
     string req =
         "messages {"
@@ -55,6 +121,23 @@ int sub_status(int argc, char **argv, const GlobalOptions &options) {
         cout << "current date: " << to_string(s.current_date()) << endl;
     if (s.has_request_counter())
         cout << "request counter: " << to_string(s.request_counter()) << endl;
+    for (int i = 0; i < s.tx_classes_size(); i++) {
+        const MessageV0_TxClassStats &c = s.tx_classes(i);
+        cout << "tx class " << to_string(c.dscp_class()) << ": " <<
+            to_string(c.packets()) << " packets, " <<
+            to_string(c.bytes()) << " bytes" << endl;
+    }
+    if (s.vxlan_port_spread_size() > 0) {
+        cout << "vxlan source port spread:";
+        for (int i = 0; i < s.vxlan_port_spread_size(); i++)
+            cout << " " << to_string(s.vxlan_port_spread(i));
+        cout << endl;
+    }
+    if (s.has_port_trace_path())
+        cout << "physical nic trace: " << s.port_trace_path() << endl;
+    if (s.has_port_trace_packets())
+        cout << "physical nic traced packets: " <<
+            to_string(s.port_trace_packets()) << endl;
     if (s.has_graph_dot())
         cout << "dot graph: " << endl << s.graph_dot() << endl;
     return 0;
@@ -0,0 +1,173 @@
+/* Copyright 2017 Outscale SAS
+ *
+ * This file is part of Butterfly.
+ *
+ * Butterfly is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License version 3 as published
+ * by the Free Software Foundation.
+ *
+ * Butterfly is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with Butterfly.  If not, see <http://www.gnu.org/licenses/>.
+ */
+#include <fcntl.h>
+#include <sched.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#include <algorithm>
+#include <cstring>
+#include <new>
+#include <string>
+#include <vector>
+#include "api/common/counters.h"
+
+namespace Counters {
+
+#define COUNTERS_MAGIC "BFCOUNT"
+// Number of copies tried by a reader while the region is updated
+#define COUNTERS_READ_RETRIES 1000
+
+static_assert(sizeof(struct Header) == 64, "header must use a cache line");
+static_assert(sizeof(struct Record) == 64, "record must use a cache line");
+
+static size_t RegionSize(uint32_t capacity) {
+    return sizeof(struct Header) + capacity * sizeof(struct Record);
+}
+
+Writer::Writer() {
+    header_ = nullptr;
+    records_ = nullptr;
+}
+
+bool Writer::Open(const std::string &path) {
+    size_t size = RegionSize(COUNTERS_MAX);
+    int fd = open(path.c_str(), O_RDWR | O_CREAT | O_TRUNC, 0644);
+    if (fd < 0)
+        return false;
+    if (ftruncate(fd, size) < 0) {
+        close(fd);
+        unlink(path.c_str());
+        return false;
+    }
+    void *region = mmap(NULL, size, PROT_READ | PROT_WRITE, MAP_SHARED, fd,
+                        0);
+    close(fd);
+    if (region == MAP_FAILED) {
+        unlink(path.c_str());
+        return false;
+    }
+
+    // File is zeroed, magic is written last so readers never see a
+    // partial header
+    header_ = new (region) struct Header;
+    header_->version = COUNTERS_VERSION;
+    header_->capacity = COUNTERS_MAX;
+    header_->seq.store(0, std::memory_order_relaxed);
+    records_ = reinterpret_cast<struct Record *>(header_ + 1);
+    std::atomic_thread_fence(std::memory_order_release);
+    memcpy(header_->magic, COUNTERS_MAGIC, sizeof(header_->magic));
+    path_ = path;
+    return true;
+}
+
+void Writer::Unlink() {
+    if (header_ != nullptr)
+        unlink(path_.c_str());
+}
+
+size_t Writer::Update(const std::vector<Counter> &counters, uint64_t date) {
+    if (header_ == nullptr)
+        return 0;
+
+    uint64_t seq = header_->seq.load(std::memory_order_relaxed);
+    header_->seq.store(seq + 1, std::memory_order_relaxed);
+    std::atomic_thread_fence(std::memory_order_release);
+
+    uint32_t count = 0;
+    for (auto &c : counters) {
+        if (count == header_->capacity)
+            break;
+        if (c.first.length() >= COUNTERS_NAME_SIZE)
+            continue;
+        struct Record *r = &records_[count++];
+        memset(r->name, 0, sizeof(r->name));
+        memcpy(r->name, c.first.c_str(), c.first.length());
+        r->value = c.second;
+    }
+    header_->count = count;
+    header_->date = date;
+
+    header_->seq.store(seq + 2, std::memory_order_release);
+    return count;
+}
+
+bool Read(const std::string &path, std::vector<Counter> *counters,
+          uint64_t *date, std::string *error) {
+    int fd = open(path.c_str(), O_RDONLY);
+    if (fd < 0) {
+        *error = "cannot open " + path;
+        return false;
+    }
+    struct stat st;
+    if (fstat(fd, &st) < 0 ||
+        static_cast<size_t>(st.st_size) < sizeof(struct Header)) {
+        close(fd);
+        *error = "invalid counter region " + path;
+        return false;
+    }
+    size_t size = st.st_size;
+    void *region = mmap(NULL, size, PROT_READ, MAP_SHARED, fd, 0);
+    close(fd);
+    if (region == MAP_FAILED) {
+        *error = "cannot map " + path;
+        return false;
+    }
+
+    const struct Header *header = static_cast<const struct Header *>(region);
+    const struct Record *records =
+        reinterpret_cast<const struct Record *>(header + 1);
+    bool ok = false;
+    if (memcmp(header->magic, COUNTERS_MAGIC, sizeof(header->magic)) != 0) {
+        *error = "invalid counter region " + path;
+    } else if (header->version != COUNTERS_VERSION) {
+        *error = "unsupported counter region version " +
+            std::to_string(header->version);
+    } else if (size < RegionSize(header->capacity)) {
+        *error = "truncated counter region " + path;
+    } else {
+        std::vector<struct Record> copy(header->capacity);
+        for (int i = 0; i < COUNTERS_READ_RETRIES; i++) {
+            uint64_t seq = header->seq.load(std::memory_order_acquire);
+            if (seq & 1) {
+                sched_yield();
+                continue;
+            }
+            uint32_t count = std::min(header->count, header->capacity);
+            uint64_t d = header->date;
+            memcpy(copy.data(), records, count * sizeof(struct Record));
+            std::atomic_thread_fence(std::memory_order_acquire);
+            if (header->seq.load(std::memory_order_relaxed) != seq)
+                continue;
+
+            counters->clear();
+            for (uint32_t c = 0; c < count; c++) {
+                copy[c].name[COUNTERS_NAME_SIZE - 1] = '\0';
+                counters->push_back(Counter(copy[c].name, copy[c].value));
+            }
+            *date = d;
+            ok = true;
+            break;
+        }
+        if (!ok)
+            *error = "counter region is always being updated";
+    }
+    munmap(region, size);
+    return ok;
+}
+
+}  // namespace Counters
@@ -0,0 +1,106 @@
+/* Copyright 2017 Outscale SAS
+ *
+ * This file is part of Butterfly.
+ *
+ * Butterfly is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License version 3 as published
+ * by the Free Software Foundation.
+ *
+ * Butterfly is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with Butterfly.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef API_COMMON_COUNTERS_H_
+#define API_COMMON_COUNTERS_H_
+
+#include <stdint.h>
+#include <atomic>
+#include <string>
+#include <utility>
+#include <vector>
+
+// Version of the counter region layout, incremented at each change
+#define COUNTERS_VERSION 1
+// Maximal number of counters in a region
+#define COUNTERS_MAX 65536
+// Maximal length of a counter name, including the final null byte
+#define COUNTERS_NAME_SIZE 56
+
+/* Counters published by butterflyd in a memory mapped file (usually under
+ * /dev/shm), so they can be read without any request to butterflyd. */
+namespace Counters {
+// A counter name and its value
+typedef std::pair<std::string, uint64_t> Counter;
+
+/* Layout of the region: a header followed by COUNTERS_MAX records,
+ * each one using a cache line.
+ * Butterflyd is the only writer and protects updates with a sequence
+ * lock: seq is odd while records are written, a snapshot is consistent
+ * if seq is the same even number before and after copying records.
+ */
+struct Header {
+    // "BFCOUNT" followed by a null byte
+    char magic[8];
+    // COUNTERS_VERSION of the writer
+    uint32_t version;
+    // Number of records following the header
+    uint32_t capacity;
+    std::atomic<uint64_t> seq;
+    // Monotonic date of the last update in microseconds
+    uint64_t date;
+    // Number of records in use
+    uint32_t count;
+    uint8_t reserved[28];
+};
+
+struct Record {
+    // Null terminated name
+    char name[COUNTERS_NAME_SIZE];
+    uint64_t value;
+};
+
+/* Writer of a counter region, only used by one thread. */
+class Writer {
+ public:
+    Writer();
+    /* Create the region, replacing any existing file.
+     * The mapping is kept until the process exits, so the region can be
+     * updated until the end.
+     * @param   path path of the file to create
+     * @return  false if the file cannot be created or mapped
+     */
+    bool Open(const std::string &path);
+    // Remove the region's file, readers keep their mapping
+    void Unlink();
+    bool Opened() const { return header_ != nullptr; }
+    /* Replace all counters of the region.
+     * Counters which names are too long or which do not fit in the
+     * region are skipped.
+     * @param   counters counters to write
+     * @param   date monotonic date of the counters in microseconds
+     * @return  number of counters written
+     */
+    size_t Update(const std::vector<Counter> &counters, uint64_t date);
+
+ private:
+    std::string path_;
+    struct Header *header_;
+    struct Record *records_;
+};
+
+/* Read a consistent snapshot of a counter region.
+ * @param   path path of the region
+ * @param   counters filled with counters of the region
+ * @param   date set to the monotonic date of the last update
+ * @param   error set to the reason of a failure
+ * @return  false if the region cannot be read
+ */
+bool Read(const std::string &path, std::vector<Counter> *counters,
+          uint64_t *date, std::string *error);
+}  // namespace Counters
+#endif  // API_COMMON_COUNTERS_H_
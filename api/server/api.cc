@@ -22,8 +22,10 @@
 #include <utility>
 #include <algorithm>
 #include <map>
+#include <set>
 #include "api/server/api.h"
 #include "api/server/app.h"
+#include "api/server/capture.h"
 #include "api/server/model.h"
 #include "api/protocol/message.pb.h"
 #include "api/version.h"
@@ -147,6 +149,16 @@ void Api::Dispatch(const proto::Message &req, proto::Message *rep) {
 }
 
 bool Api::ActionNicAdd(app::Nic *nic, app::Error *error) {
+    std::string filter_error;
+    if (!app::Capture::CheckFilter(nic->packet_trace_filter,
+                                   &filter_error)) {
+        std::string m = "invalid packet trace filter: " + filter_error;
+        app::log.Error(m);
+        if (error != nullptr)
+            error->description = m;
+        return false;
+    }
+
     auto it = app::model.nics.find(nic->id);
     // Do we already have this NIC ?
     if (it != app::model.nics.end()) {
@@ -186,6 +198,18 @@ bool Api::ActionNicUpdate(const Api::NicUpdate &update,
     // Get the nic
     app::Nic &n = itn->second;
 
+    // Check packet trace filter before changing anything
+    std::string filter_error;
+    if (update.has_packet_trace_filter &&
+        !app::Capture::CheckFilter(update.packet_trace_filter,
+                                   &filter_error)) {
+        std::string m = "invalid packet trace filter: " + filter_error;
+        app::log.Error(m);
+        if (error != nullptr)
+            error->description = m;
+        return false;
+    }
+
     bool need_fw_update = false;
     bool need_anti_spoof_update = false;
 
@@ -214,6 +238,26 @@ bool Api::ActionNicUpdate(const Api::NicUpdate &update,
         app::graph.NicConfigAntiSpoof(n, n.ip_anti_spoof);
     }
 
+    // Update packet trace filtering if needed, before the trace is enabled
+    bool need_trace_filter_update = false;
+    if (update.has_packet_trace_filter &&
+        update.packet_trace_filter != n.packet_trace_filter) {
+        n.packet_trace_filter = update.packet_trace_filter;
+        need_trace_filter_update = true;
+    }
+    if (update.has_packet_trace_snaplen &&
+        update.packet_trace_snaplen != n.packet_trace_snaplen) {
+        n.packet_trace_snaplen = update.packet_trace_snaplen;
+        need_trace_filter_update = true;
+    }
+    if (update.has_packet_trace_sampling &&
+        update.packet_trace_sampling != n.packet_trace_sampling) {
+        n.packet_trace_sampling = update.packet_trace_sampling;
+        need_trace_filter_update = true;
+    }
+    if (need_trace_filter_update)
+        app::graph.NicConfigPacketTraceFilter(n);
+
     // Update packet trace if needed
     if (update.has_packet_trace) {
         app::graph.NicConfigPacketTrace(n, update.packet_trace);
@@ -226,6 +270,69 @@ bool Api::ActionNicUpdate(const Api::NicUpdate &update,
         n.packet_trace_path = update.packet_trace_path;
     }
 
+    // Update egress limits if needed
+    bool need_egress_limit_update = false;
+    if (update.has_egress_bps_limit &&
+        update.egress_bps_limit != n.egress_bps_limit) {
+        n.egress_bps_limit = update.egress_bps_limit;
+        need_egress_limit_update = true;
+    }
+    if (update.has_egress_pps_limit &&
+        update.egress_pps_limit != n.egress_pps_limit) {
+        n.egress_pps_limit = update.egress_pps_limit;
+        need_egress_limit_update = true;
+    }
+    if (need_egress_limit_update)
+        app::graph.NicConfigEgressLimit(n);
+
+    // Update ingress limits if needed
+    bool need_ingress_limit_update = false;
+    if (update.has_ingress_bps_limit &&
+        update.ingress_bps_limit != n.ingress_bps_limit) {
+        n.ingress_bps_limit = update.ingress_bps_limit;
+        need_ingress_limit_update = true;
+    }
+    if (update.has_ingress_pps_limit &&
+        update.ingress_pps_limit != n.ingress_pps_limit) {
+        n.ingress_pps_limit = update.ingress_pps_limit;
+        need_ingress_limit_update = true;
+    }
+    if (need_ingress_limit_update)
+        app::graph.NicConfigIngressLimit(n);
+
+    // Update new connections limit if needed
+    if (update.has_new_conn_pps_limit &&
+        update.new_conn_pps_limit != n.new_conn_pps_limit) {
+        n.new_conn_pps_limit = update.new_conn_pps_limit;
+        app::graph.NicConfigConnLimit(n);
+    }
+
+    // Update storm control if needed
+    if (update.has_bum_pps_limit &&
+        update.bum_pps_limit != n.bum_pps_limit) {
+        n.bum_pps_limit = update.bum_pps_limit;
+        app::graph.NicConfigStormLimit(n);
+    }
+
+    // Update polling priority if needed
+    if (update.has_priority && update.priority != n.priority) {
+        n.priority = update.priority;
+        app::graph.NicConfigPriority(n);
+    }
+
+    // Update MSS clamping if needed
+    if (update.has_mss_clamp && update.mss_clamp != n.mss_clamp) {
+        n.mss_clamp = update.mss_clamp;
+        app::graph.NicConfigMssClamp(n);
+    }
+
+    // Update rule hits counting if needed
+    if (update.has_count_rule_hits &&
+        update.count_rule_hits != n.count_rule_hits) {
+        n.count_rule_hits = update.count_rule_hits;
+        app::graph.NicConfigRuleHits(n);
+    }
+
     if (need_fw_update)
         app::graph.FwUpdate(n);
 
@@ -269,9 +376,9 @@ bool Api::ActionNicExport(std::string id, std::string *data,
     return true;
 }
 
-bool Api::ActionNicStats(std::string id, uint64_t *in, uint64_t *out,
+bool Api::ActionNicStats(std::string id, app::NicStats *stats,
     app::Error *error) {
-    if (in == nullptr || out == nullptr)
+    if (stats == nullptr)
         return false;
 
     auto nic = app::model.nics.find(id);
@@ -283,7 +390,189 @@ bool Api::ActionNicStats(std::string id, uint64_t *in, uint64_t *out,
         return false;
     }
 
-    app::graph.NicGetStats(nic->second, in, out);
+    app::graph.NicGetStats(nic->second, stats);
+    return true;
+}
+
+bool Api::ActionNicStatsBulk(const NicStatsQuery &query,
+    std::map<std::string, app::NicStats> *stats, int64_t *date,
+    app::Error *error) {
+    if (stats == nullptr || date == nullptr)
+        return false;
+
+    if (query.has_vni && query.vni > 16777215) {
+        std::string m = "VNI is too big: " + std::to_string(query.vni);
+        app::log.Error(m);
+        if (error != nullptr)
+            error->description = m;
+        return false;
+    }
+
+    std::set<std::string> ids;
+    for (auto &id : query.ids) {
+        if (app::model.nics.find(id) == app::model.nics.end()) {
+            std::string m = "NIC does not exist with id " + id;
+            app::log.Error(m);
+            if (error != nullptr)
+                error->description = m;
+            return false;
+        }
+        ids.insert(id);
+    }
+
+    *date = app::graph.NicGetStatsBulk(ids, query.has_vni, query.vni, stats);
+    return true;
+}
+
+bool Api::ActionNicRecordDump(std::string id, std::string path,
+    uint64_t *packets, app::Error *error) {
+    if (packets == nullptr)
+        return false;
+
+    auto nic = app::model.nics.find(id);
+    if (nic == app::model.nics.end()) {
+        std::string m = "NIC does not exist with id " + id;
+        app::log.Error(m);
+        if (error != nullptr)
+            error->description = m;
+        return false;
+    }
+
+    if (!app::graph.NicRecordDump(nic->second, path, packets)) {
+        std::string m = "cannot write flight recorder of " + id + " in " +
+            path;
+        app::log.Error(m);
+        if (error != nullptr)
+            error->description = m;
+        return false;
+    }
+    return true;
+}
+
+bool Api::ActionCaptureStart(const app::CaptureStream &stream,
+    std::string *endpoint, std::string *topic, app::Error *error) {
+    if (endpoint == nullptr || topic == nullptr)
+        return false;
+
+    if (!stream.nic_id.empty() &&
+        app::model.nics.find(stream.nic_id) == app::model.nics.end()) {
+        std::string m = "NIC does not exist with id " + stream.nic_id;
+        app::log.Error(m);
+        if (error != nullptr)
+            error->description = m;
+        return false;
+    }
+
+    std::string filter_error;
+    if (!app::Capture::CheckFilter(stream.filter, &filter_error)) {
+        std::string m = "invalid capture filter: " + filter_error;
+        app::log.Error(m);
+        if (error != nullptr)
+            error->description = m;
+        return false;
+    }
+
+    if (!app::graph.StreamEnabled()) {
+        std::string m = "capture streams are disabled";
+        app::log.Error(m);
+        if (error != nullptr)
+            error->description = m;
+        return false;
+    }
+
+    if (!app::graph.StreamStart(stream, topic)) {
+        std::string m = "cannot start capture stream";
+        app::log.Error(m);
+        if (error != nullptr)
+            error->description = m;
+        return false;
+    }
+    *endpoint = app::config.capture_endpoint;
+    return true;
+}
+
+bool Api::ActionCaptureStop(std::string nic_id, app::Error *error) {
+    if (!app::graph.StreamStop(nic_id)) {
+        std::string m = "no capture stream running on " +
+            (nic_id.empty() ? std::string("physical NIC") : nic_id);
+        app::log.Error(m);
+        if (error != nullptr)
+            error->description = m;
+        return false;
+    }
+    return true;
+}
+
+bool Api::ActionPortTrace(const app::PortTrace &trace, app::Error *error) {
+    std::string filter_error;
+    if (trace.enable &&
+        !app::Capture::CheckFilter(trace.filter, &filter_error)) {
+        std::string m = "invalid packet trace filter: " + filter_error;
+        app::log.Error(m);
+        if (error != nullptr)
+            error->description = m;
+        return false;
+    }
+
+    if (!app::graph.PortConfigTrace(trace)) {
+        std::string m = "cannot configure packet trace of physical NIC";
+        app::log.Error(m);
+        if (error != nullptr)
+            error->description = m;
+        return false;
+    }
+    return true;
+}
+
+bool Api::ActionVniUpdate(const VniUpdate &update, app::Error *error) {
+    if (update.vni > 16777215) {
+        std::string m = "VNI is too big: " + std::to_string(update.vni);
+        app::log.Error(m);
+        if (error != nullptr)
+            error->description = m;
+        return false;
+    }
+
+    app::Vni &v = app::model.vnis[update.vni];
+    v.vni = update.vni;
+    if (update.has_egress_bps_limit)
+        v.egress_bps_limit = update.egress_bps_limit;
+    if (update.has_egress_pps_limit)
+        v.egress_pps_limit = update.egress_pps_limit;
+    if (update.has_egress_bps_limit || update.has_egress_pps_limit)
+        app::graph.VniConfigEgressLimit(v);
+    if (update.has_ingress_bps_limit)
+        v.ingress_bps_limit = update.ingress_bps_limit;
+    if (update.has_ingress_pps_limit)
+        v.ingress_pps_limit = update.ingress_pps_limit;
+    if (update.has_ingress_bps_limit || update.has_ingress_pps_limit)
+        app::graph.VniConfigIngressLimit(v);
+    if (update.has_bum_pps_limit) {
+        v.bum_pps_limit = update.bum_pps_limit;
+        app::graph.VniConfigStormLimit(v);
+    }
+    return true;
+}
+
+bool Api::ActionVniStats(uint32_t vni, app::Vni *vni_model,
+    app::VniStats *stats, app::Error *error) {
+    if (vni_model == nullptr || stats == nullptr)
+        return false;
+
+    if (vni > 16777215) {
+        std::string m = "VNI is too big: " + std::to_string(vni);
+        app::log.Error(m);
+        if (error != nullptr)
+            error->description = m;
+        return false;
+    }
+
+    *vni_model = app::Vni();
+    vni_model->vni = vni;
+    auto v = app::model.vnis.find(vni);
+    if (v != app::model.vnis.end())
+        *vni_model = v->second;
+    app::graph.VniGetStats(*vni_model, stats);
     return true;
 }
 
@@ -387,13 +676,19 @@ bool Api::ActionSgAdd(const app::Sg &sg, app::Error *error) {
         app::Sg &original_sg = itn->second;
         if (sg == original_sg)
             return true;
-        // If not, let's update model
+        bool members_changed = sg.members != original_sg.members;
+        // Update model first: firewalls are rebuilt from it. A firewall
+        // keeps its loaded rules and only adds new ones if no rule has been
+        // removed (see FwUpdate).
         original_sg = sg;
-    } else {
-        std::pair<std::string, app::Sg> p(sg.id, sg);
-        app::model.security_groups.insert(p);
+        SgUpdate(sg);
+        if (members_changed)
+            SgUpdateRuleMembers(sg);
+        return true;
     }
 
+    std::pair<std::string, app::Sg> p(sg.id, sg);
+    app::model.security_groups.insert(p);
     SgUpdate(sg);
     SgUpdateRuleMembers(sg);
     return true;
@@ -552,10 +847,140 @@ bool Api::ActionSgMemberDel(std::string sg_id, const app::Ip &ip,
     return true;
 }
 
+bool Api::ActionSgRuleHits(std::string sg_id,
+    std::map<std::size_t, uint64_t> *hits) {
+    return app::graph.SgRuleHits(sg_id, hits);
+}
+
 std::string Api::ActionGraphDot() {
     return app::graph.Dot();
 }
 
+void Api::ActionTxClassStats(std::vector<app::TxClassStats> *stats) {
+    app::graph.TxClassGetStats(stats);
+}
+
+void Api::ActionTxPortSpread(std::vector<uint64_t> *spread) {
+    app::graph.TxPortSpreadGetStats(spread);
+}
+
+void Api::ActionPortTraceStatus(std::string *path, uint64_t *packets) {
+    app::graph.PortTraceStatus(path, packets);
+}
+
+void Api::ActionDropStats(std::vector<app::BrickDrops> *bricks,
+                          std::vector<app::BrickDrops> *totals) {
+    app::graph.DropStats(bricks, totals);
+}
+
+void Api::ActionCounters(std::vector<Counters::Counter> *counters) {
+    auto &c = *counters;
+    c.clear();
+    c.push_back(Counters::Counter("app.start_date", app::stats.start_date));
+    c.push_back(Counters::Counter("app.request_counter",
+                                  app::stats.request_counter));
+
+    std::vector<app::TxClassStats> classes;
+    app::graph.TxClassGetStats(&classes);
+    for (auto &s : classes) {
+        std::string p = "port.tx_class." + std::to_string(s.dscp_class);
+        c.push_back(Counters::Counter(p + ".packets", s.packets));
+        c.push_back(Counters::Counter(p + ".bytes", s.bytes));
+    }
+    std::vector<uint64_t> spread;
+    app::graph.TxPortSpreadGetStats(&spread);
+    for (size_t i = 0; i < spread.size(); i++)
+        c.push_back(Counters::Counter("port.vxlan_port_spread." +
+                                      std::to_string(i), spread[i]));
+
+    std::map<std::string, app::NicStats> nics;
+    app::graph.NicGetStatsBulk(std::set<std::string>(), false, 0, &nics);
+    for (auto &n : nics) {
+        std::string p = "nic." + n.first + ".";
+        const app::NicStats &s = n.second;
+        c.push_back(Counters::Counter(p + "in", s.in));
+        c.push_back(Counters::Counter(p + "out", s.out));
+        c.push_back(Counters::Counter(p + "egress_throttled",
+                                      s.egress_throttled));
+        c.push_back(Counters::Counter(p + "bum_dropped", s.bum_dropped));
+        c.push_back(Counters::Counter(p + "mss_clamped", s.mss_clamped));
+        c.push_back(Counters::Counter(p + "trace_dropped", s.trace_dropped));
+        c.push_back(Counters::Counter(p + "egress_packets",
+                                      s.egress_packets));
+        c.push_back(Counters::Counter(p + "egress_bytes", s.egress_bytes));
+        c.push_back(Counters::Counter(p + "ingress_packets",
+                                      s.ingress_packets));
+        c.push_back(Counters::Counter(p + "ingress_bytes", s.ingress_bytes));
+        c.push_back(Counters::Counter(p + "egress_firewall_dropped",
+                                      s.egress_firewall_dropped));
+        c.push_back(Counters::Counter(p + "ingress_firewall_dropped",
+                                      s.ingress_firewall_dropped));
+        c.push_back(Counters::Counter(p + "egress_antispoof_dropped",
+                                      s.egress_antispoof_dropped));
+        c.push_back(Counters::Counter(p + "ingress_antispoof_dropped",
+                                      s.ingress_antispoof_dropped));
+        c.push_back(Counters::Counter(p + "ingress_vhost_dropped_bytes",
+                                      s.ingress_vhost_dropped_bytes));
+        c.push_back(Counters::Counter(p + "ingress_policed",
+                                      s.ingress_policed));
+        c.push_back(Counters::Counter(p + "egress_conn_rejected",
+                                      s.egress_conn_rejected));
+        c.push_back(Counters::Counter(p + "ingress_conn_rejected",
+                                      s.ingress_conn_rejected));
+        if (!s.has_latency)
+            continue;
+        const app::LatencyStats *latencies[] = {&s.egress_latency,
+                                                &s.ingress_latency};
+        const char *directions[] = {"egress_latency.", "ingress_latency."};
+        for (int d = 0; d < 2; d++) {
+            const app::LatencyStats &l = *latencies[d];
+            std::string lp = p + directions[d];
+            c.push_back(Counters::Counter(lp + "samples", l.samples));
+            c.push_back(Counters::Counter(lp + "p50", l.p50));
+            c.push_back(Counters::Counter(lp + "p99", l.p99));
+            c.push_back(Counters::Counter(lp + "p999", l.p999));
+        }
+    }
+
+    // VNIs having NICs or a configuration
+    std::set<uint32_t> vnis;
+    for (auto &n : app::model.nics)
+        vnis.insert(n.second.vni);
+    for (auto &v : app::model.vnis)
+        vnis.insert(v.first);
+    for (auto vni : vnis) {
+        app::Vni v;
+        v.vni = vni;
+        auto it = app::model.vnis.find(vni);
+        if (it != app::model.vnis.end())
+            v = it->second;
+        app::VniStats s;
+        app::graph.VniGetStats(v, &s);
+        std::string p = "vni." + std::to_string(vni) + ".";
+        c.push_back(Counters::Counter(p + "nic_count", s.nic_count));
+        c.push_back(Counters::Counter(p + "egress_throttled",
+                                      s.egress_throttled));
+        c.push_back(Counters::Counter(p + "bum_dropped", s.bum_dropped));
+        c.push_back(Counters::Counter(p + "ingress_policed",
+                                      s.ingress_policed));
+    }
+
+    static const char *reasons[app::DROP_REASON_NB] = {
+        "vtep", "firewall", "antispoof", "storm", "vhost_full", "policer",
+        "conn_limit"};
+    std::vector<app::BrickDrops> bricks, totals;
+    app::graph.DropStats(&bricks, &totals);
+    for (auto &d : totals)
+        d.brick = "total";
+    bricks.insert(bricks.end(), totals.begin(), totals.end());
+    for (auto &d : bricks) {
+        // Only bytes are known for full vhost rings
+        uint64_t v = d.reason == app::DROP_VHOST_FULL ? d.bytes : d.packets;
+        c.push_back(Counters::Counter("drop." + d.brick + "." +
+                                      reasons[d.reason], v));
+    }
+}
+
 void Api::ActionAppQuit() {
     app::request_exit = true;
 }
@@ -21,6 +21,7 @@
 #include <unistd.h>
 #include <google/protobuf/text_format.h>
 #include <google/protobuf/stubs/common.h>
+#include <map>
 #include <string>
 #include <vector>
 #include "api/protocol/message.pb.h"
@@ -42,18 +43,69 @@ class Api {
      * @param  response response containing internal error
      */
     static void BuildInternalError(std::string *response);
+    /* Grab all counters to publish in the counter region, called by the
+     * API server between requests
+     * Names are dot separated paths, e.g. "nic.<id>.ingress_packets"
+     * @param  counters counters to fill
+     */
+    static void ActionCounters(std::vector<Counters::Counter> *counters);
     // This structure centralize description of NicUpdate informations
     struct NicUpdate {
         std::string id;
         bool has_packet_trace;
         bool packet_trace;
         std::string packet_trace_path;
+        bool has_packet_trace_filter;
+        std::string packet_trace_filter;
+        bool has_packet_trace_snaplen;
+        uint32_t packet_trace_snaplen;
+        bool has_packet_trace_sampling;
+        uint32_t packet_trace_sampling;
         bool has_ip_anti_spoof;
         bool ip_anti_spoof;
         std::vector<app::Ip> ip;
         bool ip_overwrite;
         std::vector<std::string> security_groups;
         bool security_groups_overwrite;
+        bool has_egress_bps_limit;
+        uint64_t egress_bps_limit;
+        bool has_egress_pps_limit;
+        uint64_t egress_pps_limit;
+        bool has_ingress_bps_limit;
+        uint64_t ingress_bps_limit;
+        bool has_ingress_pps_limit;
+        uint64_t ingress_pps_limit;
+        bool has_new_conn_pps_limit;
+        uint64_t new_conn_pps_limit;
+        bool has_bum_pps_limit;
+        uint64_t bum_pps_limit;
+        bool has_priority;
+        uint32_t priority;
+        bool has_mss_clamp;
+        bool mss_clamp;
+        bool has_count_rule_hits;
+        bool count_rule_hits;
+    };
+    // This structure centralize description of NicStatsBulk informations
+    struct NicStatsQuery {
+        // NICs to read, all NICs if empty
+        std::vector<std::string> ids;
+        bool has_vni;
+        uint32_t vni;
+    };
+    // This structure centralize description of VniUpdate informations
+    struct VniUpdate {
+        uint32_t vni;
+        bool has_egress_bps_limit;
+        uint64_t egress_bps_limit;
+        bool has_egress_pps_limit;
+        uint64_t egress_pps_limit;
+        bool has_ingress_bps_limit;
+        uint64_t ingress_bps_limit;
+        bool has_ingress_pps_limit;
+        uint64_t ingress_pps_limit;
+        bool has_bum_pps_limit;
+        uint64_t bum_pps_limit;
     };
 
  protected:
@@ -101,14 +153,83 @@ class Api {
     /* Grab NIC statistics
      * This method centralize NIC statistic collection for all API versions
      * @param  id NIC id to get statistics from
-     * @param  in data comming in the NIC
-     * @param  out data comming out of the NIC
+     * @param  stats statistics of the NIC to fill
      * @param  error provide an app::Error object to fill in case of error
      *               can be NULL to ommit it.
      * @return  true if data has been well filled
      */
-    static bool ActionNicStats(std::string id, uint64_t *in, uint64_t *out,
+    static bool ActionNicStats(std::string id, app::NicStats *stats,
+        app::Error *error);
+    /* Grab statistics of several NICs at once
+     * This method centralize NIC statistic collection for all API versions
+     * @param  query NICs to get statistics from
+     * @param  stats NIC id -> statistics to fill
+     * @param  date set to the monotonic date of the read in microseconds
+     * @param  error provide an app::Error object to fill in case of error
+     *               can be NULL to ommit it.
+     * @return  true if data has been well filled
+     */
+    static bool ActionNicStatsBulk(const NicStatsQuery &query,
+        std::map<std::string, app::NicStats> *stats, int64_t *date,
+        app::Error *error);
+    /* Dump flight recorder of a NIC
+     * This method centralize flight recorder dumps for all API versions
+     * @param  id NIC id to dump
+     * @param  path path of the pcap file to write
+     * @param  packets number of packets written
+     * @param  error provide an app::Error object to fill in case of error
+     *               can be NULL to ommit it.
+     * @return  true if the pcap file has been written
+     */
+    static bool ActionNicRecordDump(std::string id, std::string path,
+        uint64_t *packets, app::Error *error);
+    /* Start streaming packets of a NIC or of the physical NIC
+     * This method centralize capture streams for all API versions
+     * @param  stream NIC, filter and limits of the stream
+     * @param  endpoint set to the endpoint publishing the stream
+     * @param  topic set to the topic of the stream
+     * @param  error provide an app::Error object to fill in case of error
+     *               can be NULL to ommit it.
+     * @return  true if the stream has been started
+     */
+    static bool ActionCaptureStart(const app::CaptureStream &stream,
+        std::string *endpoint, std::string *topic, app::Error *error);
+    /* Stop streaming packets of a NIC or of the physical NIC
+     * This method centralize capture streams for all API versions
+     * @param  nic_id NIC id, empty for the physical NIC
+     * @param  error provide an app::Error object to fill in case of error
+     *               can be NULL to ommit it.
+     * @return  true if the stream has been stopped
+     */
+    static bool ActionCaptureStop(std::string nic_id, app::Error *error);
+    /* Configure packet trace of the physical NIC
+     * This method centralize physical NIC trace for all API versions
+     * @param  trace packet trace to apply
+     * @param  error provide an app::Error object to fill in case of error
+     *               can be NULL to ommit it.
+     * @return  true if the packet trace has been applied
+     */
+    static bool ActionPortTrace(const app::PortTrace &trace,
         app::Error *error);
+    /* Update VNI configuration shared by all NICs of this VNI
+     * This method centralize VNI update for all API versions
+     * @param  update VNI parameters to update
+     * @param  error provide an app::Error object to fill in case of error
+     *               can be NULL to ommit it.
+     * @return  true if VNI has been updated, false otherwise
+     */
+    static bool ActionVniUpdate(const VniUpdate &update, app::Error *error);
+    /* Grab VNI configuration and statistics
+     * This method centralize VNI statistic collection for all API versions
+     * @param  vni VNI to get statistics from
+     * @param  vni_model VNI configuration to fill
+     * @param  stats statistics of the VNI to fill
+     * @param  error provide an app::Error object to fill in case of error
+     *               can be NULL to ommit it.
+     * @return  true if data has been well filled
+     */
+    static bool ActionVniStats(uint32_t vni, app::Vni *vni_model,
+        app::VniStats *stats, app::Error *error);
     /* Creation a Security Group and add it to the model
      * This method centralize SG creation or replace for all API versions
      * @param  sg security group to create or replace
@@ -169,11 +290,41 @@ class Api {
      */
     static bool ActionSgMemberDel(std::string sg_id, const app::Ip &ip,
         app::Error *error);
+    /* Grab packets which matched each rule of a Security Group
+     * This method centralize rule hits collection for all API versions
+     * @param  sg_id security group id to get rule hits from
+     * @param  hits hash of the rule -> packets, filled
+     * @return  false if no NIC using the security group counts rule hits
+     */
+    static bool ActionSgRuleHits(std::string sg_id,
+        std::map<std::size_t, uint64_t> *hits);
     /* Build a dot graph representing all connected bricks
      * This method centralize dot representation building
      * @return  string representing the graphic in DOT language
      */
     static std::string ActionGraphDot();
+    /* Grab statistics of traffic sent on the physical NIC per DSCP class
+     * This method centralize class statistic collection for all API versions
+     * @param  stats statistics to fill, one per class
+     */
+    static void ActionTxClassStats(std::vector<app::TxClassStats> *stats);
+    /* Grab number of packets sent per slice of VXLAN source port range
+     * This method centralize spread statistic collection for all API versions
+     * @param  spread counters to fill, empty if source port is not hashed
+     */
+    static void ActionTxPortSpread(std::vector<uint64_t> *spread);
+    /* Grab packet trace of the physical NIC
+     * @param  path set to the pcap file path, empty if not traced
+     * @param  packets set to the number of traced packets
+     */
+    static void ActionPortTraceStatus(std::string *path, uint64_t *packets);
+    /* Grab packets dropped by the graph
+     * This method centralize drop statistic collection for all API versions
+     * @param  bricks drops of each brick to fill
+     * @param  totals drops of all bricks to fill, one per reason
+     */
+    static void ActionDropStats(std::vector<app::BrickDrops> *bricks,
+                                std::vector<app::BrickDrops> *totals);
     /* Shutdown the program
      * This method centralize program shutdown for all API versions
      */
@@ -220,6 +371,22 @@ class Api0: public Api {
                            MessageV0_Response *res);
     static void NicStats(const MessageV0_Request &req,
                           MessageV0_Response *res);
+    static void NicStatsBulk(const MessageV0_Request &req,
+                             MessageV0_Response *res);
+    static void NicRecordDump(const MessageV0_Request &req,
+                              MessageV0_Response *res);
+    static void CaptureStart(const MessageV0_Request &req,
+                             MessageV0_Response *res);
+    static void CaptureStop(const MessageV0_Request &req,
+                            MessageV0_Response *res);
+    static void PortTrace(const MessageV0_Request &req,
+                          MessageV0_Response *res);
+    static void VniUpdate(const MessageV0_Request &req,
+                          MessageV0_Response *res);
+    static void VniStats(const MessageV0_Request &req,
+                         MessageV0_Response *res);
+    static void DropStats(const MessageV0_Request &req,
+                          MessageV0_Response *res);
     static void SgAdd(const MessageV0_Request &req, MessageV0_Response *res);
     static void SgDel(const MessageV0_Request &req, MessageV0_Response *res);
     static void SgList(const MessageV0_Request &req, MessageV0_Response *res);
@@ -283,6 +450,12 @@ class Api0: public Api {
                         MessageV0_Cidr *cidr_message);
     static bool Convert(const MessageV0_Cidr &cidr_message,
                         app::Cidr *cidr_model);
+    static bool Convert(const app::NicStats &stats_model,
+                        MessageV0_NicStats *stats_message);
+    static bool Convert(const app::LatencyStats &latency_model,
+                        MessageV0_LatencyStats *latency_message);
+    static bool Convert(const app::BrickDrops &drops_model,
+                        MessageV0_DropCount *drops_message);
     static bool Convert(const app::Error &error_model,
                         MessageV0_Error *error_message);
 };
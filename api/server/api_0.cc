@@ -79,6 +79,22 @@ void Api0::Process(const MessageV0 &req, MessageV0 *res) {
         AppConfig(rq, rs);
     else if (rq.has_sg_details())
         SgDetails(rq, rs);
+    else if (rq.has_vni_update())
+        VniUpdate(rq, rs);
+    else if (rq.has_vni_stats())
+        VniStats(rq, rs);
+    else if (rq.has_nic_record_dump())
+        NicRecordDump(rq, rs);
+    else if (rq.has_capture_start())
+        CaptureStart(rq, rs);
+    else if (rq.has_capture_stop())
+        CaptureStop(rq, rs);
+    else if (rq.has_port_trace())
+        PortTrace(rq, rs);
+    else if (rq.has_drop_stats())
+        DropStats(rq, rs);
+    else if (rq.has_nic_stats_bulk())
+        NicStatsBulk(rq, rs);
     else
         BuildNokRes(rs, "MessageV0 appears to not have any request");
 }
@@ -221,18 +237,199 @@ void Api0::NicStats(const MessageV0_Request &req,
         return;
     app::log.Info("NIC stats");
     std::string nic_id = req.nic_stats();
-    uint64_t in, out = 0;
+    app::NicStats stats;
     app::Error err;
-    if (!ActionNicStats(nic_id, &in, &out, &err)) {
+    if (!ActionNicStats(nic_id, &stats, &err)) {
         BuildNokRes(res, err);
         return;
     }
 
     res->set_allocated_nic_stats(new MessageV0_NicStats);
-    auto nic_stats = res->mutable_nic_stats();
+    Convert(stats, res->mutable_nic_stats());
+    BuildOkRes(res);
+}
+
+void Api0::NicStatsBulk(const MessageV0_Request &req,
+    MessageV0_Response *res) {
+    if (res == nullptr)
+        return;
+    app::log.Info("NIC stats bulk");
+    auto &r = req.nic_stats_bulk();
+    NicStatsQuery query;
+    for (int i = 0; i < r.id_size(); i++)
+        query.ids.push_back(r.id(i));
+    query.has_vni = r.has_vni();
+    query.vni = r.vni();
+    std::map<std::string, app::NicStats> stats;
+    int64_t date;
+    app::Error err;
+    if (!ActionNicStatsBulk(query, &stats, &date, &err)) {
+        BuildNokRes(res, err);
+        return;
+    }
+
+    res->set_allocated_nic_stats_bulk(new MessageV0_NicStatsBulkRes);
+    auto bulk = res->mutable_nic_stats_bulk();
+    bulk->set_date(date);
+    for (auto &s : stats) {
+        auto entry = bulk->add_nics();
+        entry->set_id(s.first);
+        Convert(s.second, entry->mutable_stats());
+    }
+    BuildOkRes(res);
+}
 
-    nic_stats->set_in(in);
-    nic_stats->set_out(out);
+void Api0::NicRecordDump(const MessageV0_Request &req,
+    MessageV0_Response *res) {
+    if (res == nullptr)
+        return;
+    app::log.Info("NIC record dump");
+    auto dump = req.nic_record_dump();
+    uint64_t packets;
+    app::Error err;
+    if (!ActionNicRecordDump(dump.id(), dump.path(), &packets, &err)) {
+        BuildNokRes(res, err);
+        return;
+    }
+
+    res->set_allocated_nic_record_dump(new MessageV0_NicRecordDumpRes);
+    res->mutable_nic_record_dump()->set_packets(packets);
+    BuildOkRes(res);
+}
+
+void Api0::CaptureStart(const MessageV0_Request &req,
+    MessageV0_Response *res) {
+    if (res == nullptr)
+        return;
+    app::log.Info("capture start");
+    auto c = req.capture_start();
+    app::CaptureStream stream;
+    stream.nic_id = c.nic_id();
+    stream.filter = c.filter();
+    stream.snaplen = c.snaplen();
+    stream.sampling = c.sampling();
+    stream.pps_limit = c.pps_limit();
+    stream.duration = c.duration();
+
+    std::string endpoint;
+    std::string topic;
+    app::Error err;
+    if (!ActionCaptureStart(stream, &endpoint, &topic, &err)) {
+        BuildNokRes(res, err);
+        return;
+    }
+
+    res->set_allocated_capture_start(new MessageV0_CaptureStartRes);
+    res->mutable_capture_start()->set_endpoint(endpoint);
+    res->mutable_capture_start()->set_topic(topic);
+    BuildOkRes(res);
+}
+
+void Api0::CaptureStop(const MessageV0_Request &req,
+    MessageV0_Response *res) {
+    if (res == nullptr)
+        return;
+    app::log.Info("capture stop");
+    app::Error err;
+    if (!ActionCaptureStop(req.capture_stop().nic_id(), &err)) {
+        BuildNokRes(res, err);
+        return;
+    }
+    BuildOkRes(res);
+}
+
+void Api0::PortTrace(const MessageV0_Request &req,
+    MessageV0_Response *res) {
+    if (res == nullptr)
+        return;
+    app::log.Info("physical NIC packet trace");
+    auto t = req.port_trace();
+    app::PortTrace trace;
+    trace.enable = t.enable();
+    trace.path = t.path();
+    trace.filter = t.filter();
+    trace.snaplen = t.snaplen();
+    trace.sampling = t.sampling();
+    trace.duration = t.duration();
+
+    app::Error err;
+    if (!ActionPortTrace(trace, &err)) {
+        BuildNokRes(res, err);
+        return;
+    }
+    BuildOkRes(res);
+}
+
+void Api0::VniUpdate(const MessageV0_Request &req,
+    MessageV0_Response *res) {
+    if (res == nullptr)
+        return;
+    app::log.Info("VNI update");
+    auto u = req.vni_update();
+    struct Api::VniUpdate update;
+    update.vni = u.vni();
+    update.has_egress_bps_limit = u.has_egress_bps_limit();
+    update.egress_bps_limit = u.egress_bps_limit();
+    update.has_egress_pps_limit = u.has_egress_pps_limit();
+    update.egress_pps_limit = u.egress_pps_limit();
+    update.has_ingress_bps_limit = u.has_ingress_bps_limit();
+    update.ingress_bps_limit = u.ingress_bps_limit();
+    update.has_ingress_pps_limit = u.has_ingress_pps_limit();
+    update.ingress_pps_limit = u.ingress_pps_limit();
+    update.has_bum_pps_limit = u.has_bum_pps_limit();
+    update.bum_pps_limit = u.bum_pps_limit();
+
+    app::Error err;
+    if (!ActionVniUpdate(update, &err)) {
+        BuildNokRes(res, err);
+        return;
+    }
+    BuildOkRes(res);
+}
+
+void Api0::VniStats(const MessageV0_Request &req,
+    MessageV0_Response *res) {
+    if (res == nullptr)
+        return;
+    app::log.Info("VNI stats");
+    app::Vni vni;
+    app::VniStats stats;
+    app::Error err;
+    if (!ActionVniStats(req.vni_stats(), &vni, &stats, &err)) {
+        BuildNokRes(res, err);
+        return;
+    }
+
+    res->set_allocated_vni_stats(new MessageV0_VniStats);
+    auto vni_stats = res->mutable_vni_stats();
+
+    vni_stats->set_egress_bps_limit(vni.egress_bps_limit);
+    vni_stats->set_egress_pps_limit(vni.egress_pps_limit);
+    vni_stats->set_nic_count(stats.nic_count);
+    vni_stats->set_egress_throttled(stats.egress_throttled);
+    vni_stats->set_bum_pps_limit(vni.bum_pps_limit);
+    vni_stats->set_bum_dropped(stats.bum_dropped);
+    vni_stats->set_ingress_bps_limit(vni.ingress_bps_limit);
+    vni_stats->set_ingress_pps_limit(vni.ingress_pps_limit);
+    vni_stats->set_ingress_policed(stats.ingress_policed);
+    BuildOkRes(res);
+}
+
+void Api0::DropStats(const MessageV0_Request &req,
+                     MessageV0_Response *res) {
+    if (res == nullptr)
+        return;
+    app::log.Info("Drop stats");
+    std::vector<app::BrickDrops> bricks;
+    std::vector<app::BrickDrops> totals;
+    ActionDropStats(&bricks, &totals);
+
+    res->set_allocated_drop_stats(new MessageV0_DropStatsRes);
+    auto drop_stats = res->mutable_drop_stats();
+    for (auto &d : bricks)
+        Convert(d, drop_stats->add_bricks());
+    for (auto &d : totals)
+        Convert(d, drop_stats->add_totals());
     BuildOkRes(res);
 }
 
@@ -355,6 +552,8 @@ void Api0::SgRuleList(const MessageV0_Request &req,
     }
 
     app::Sg &sg = m.security_groups[sg_id];
+    std::map<std::size_t, uint64_t> hits;
+    bool counted = ActionSgRuleHits(sg_id, &hits);
 
     for (auto it=sg.rules.begin(); it != sg.rules.end(); it++) {
         auto r = res->add_sg_rule_list();
@@ -362,6 +561,8 @@ void Api0::SgRuleList(const MessageV0_Request &req,
             BuildNokRes(res, "Internal error");
             return;
         }
+        if (counted)
+            r->set_hits(hits[it->first]);
     }
 
     BuildOkRes(res);
@@ -457,6 +658,25 @@ void Api0::AppStatus(const MessageV0_Request &req,
     a->set_current_date(time(NULL));
     a->set_request_counter(app::stats.request_counter);
     a->set_graph_dot(ActionGraphDot());
+    std::vector<app::TxClassStats> tx_classes;
+    ActionTxClassStats(&tx_classes);
+    for (auto it = tx_classes.begin(); it != tx_classes.end(); it++) {
+        auto c = a->add_tx_classes();
+        c->set_dscp_class(it->dscp_class);
+        c->set_packets(it->packets);
+        c->set_bytes(it->bytes);
+    }
+    std::vector<uint64_t> spread;
+    ActionTxPortSpread(&spread);
+    for (auto it = spread.begin(); it != spread.end(); it++)
+        a->add_vxlan_port_spread(*it);
+    std::string trace_path;
+    uint64_t trace_packets;
+    ActionPortTraceStatus(&trace_path, &trace_packets);
+    if (trace_path.length() > 0)
+        a->set_port_trace_path(trace_path);
+    if (trace_packets > 0)
+        a->set_port_trace_packets(trace_packets);
 
     BuildOkRes(res);
 }
@@ -577,6 +797,10 @@ bool Api0::ValidateNic(const MessageV0_Nic &nic) {
     if (vni > 16777215)
         return false;
 
+    // Check priority
+    if (nic.priority() > NIC_PRIORITY_MAX)
+        return false;
+
     // Check IP list
     for (int a = 0; a < nic.ip_size(); a++) {
         auto ip = nic.ip(a);
@@ -587,6 +811,10 @@ bool Api0::ValidateNic(const MessageV0_Nic &nic) {
 }
 
 bool Api0::ValidateNicUpdate(const MessageV0_NicUpdateReq &nic_update) {
+    // Check priority
+    if (nic_update.priority() > NIC_PRIORITY_MAX)
+        return false;
+
     // Check IP list
     if (nic_update.ip_size() == 1 && nic_update.ip(0).length() == 0) {
         return true;
@@ -732,6 +960,14 @@ bool Api0::Convert(const app::Nic &nic_model, MessageV0_Nic *nic_message) {
     nic_message->set_packet_trace(nic_model.packet_trace);
     // packet trace path
     nic_message->set_packet_trace_path(nic_model.packet_trace_path);
+    // packet trace filtering
+    if (nic_model.packet_trace_filter.length() > 0)
+        nic_message->set_packet_trace_filter(nic_model.packet_trace_filter);
+    if (nic_model.packet_trace_snaplen > 0)
+        nic_message->set_packet_trace_snaplen(nic_model.packet_trace_snaplen);
+    if (nic_model.packet_trace_sampling > 1)
+        nic_message->set_packet_trace_sampling(
+            nic_model.packet_trace_sampling);
     // Sniff target
     if (nic_model.sniff_target_nic_id.length() > 0)
         nic_message->set_sniff_target_nic_id(nic_model.sniff_target_nic_id);
@@ -742,6 +978,31 @@ bool Api0::Convert(const app::Nic &nic_model, MessageV0_Nic *nic_message) {
     // Path
     if (nic_model.path.length() > 0)
         nic_message->set_path(nic_model.path);
+    // Egress limits
+    if (nic_model.egress_bps_limit > 0)
+        nic_message->set_egress_bps_limit(nic_model.egress_bps_limit);
+    if (nic_model.egress_pps_limit > 0)
+        nic_message->set_egress_pps_limit(nic_model.egress_pps_limit);
+    // Ingress limits
+    if (nic_model.ingress_bps_limit > 0)
+        nic_message->set_ingress_bps_limit(nic_model.ingress_bps_limit);
+    if (nic_model.ingress_pps_limit > 0)
+        nic_message->set_ingress_pps_limit(nic_model.ingress_pps_limit);
+    // New connections limit
+    if (nic_model.new_conn_pps_limit > 0)
+        nic_message->set_new_conn_pps_limit(nic_model.new_conn_pps_limit);
+    // Storm control
+    if (nic_model.bum_pps_limit > 0)
+        nic_message->set_bum_pps_limit(nic_model.bum_pps_limit);
+    // Priority
+    if (nic_model.priority > 0)
+        nic_message->set_priority(nic_model.priority);
+    // MSS clamping
+    if (nic_model.mss_clamp)
+        nic_message->set_mss_clamp(true);
+    // Rule hits
+    if (nic_model.count_rule_hits)
+        nic_message->set_count_rule_hits(true);
     return true;
 }
 
@@ -791,6 +1052,10 @@ bool Api0::Convert(const MessageV0_Nic &nic_message, app::Nic *nic_model) {
     else
         nic_model->packet_trace_path = "/tmp/butterfly-" +
             std::to_string(getpid()) + "-" + nic_model->id + ".pcap";
+    // Packet trace filtering
+    nic_model->packet_trace_filter = nic_message.packet_trace_filter();
+    nic_model->packet_trace_snaplen = nic_message.packet_trace_snaplen();
+    nic_model->packet_trace_sampling = nic_message.packet_trace_sampling();
     // Sniff target
     if (nic_message.has_sniff_target_nic_id())
         nic_model->sniff_target_nic_id = nic_message.sniff_target_nic_id();
@@ -798,6 +1063,22 @@ bool Api0::Convert(const MessageV0_Nic &nic_message, app::Nic *nic_model) {
     nic_model->bypass_filtering = false;
     if (nic_message.has_bypass_filtering())
         nic_model->bypass_filtering = nic_message.bypass_filtering();
+    // Egress limits
+    nic_model->egress_bps_limit = nic_message.egress_bps_limit();
+    nic_model->egress_pps_limit = nic_message.egress_pps_limit();
+    // Ingress limits
+    nic_model->ingress_bps_limit = nic_message.ingress_bps_limit();
+    nic_model->ingress_pps_limit = nic_message.ingress_pps_limit();
+    // New connections limit
+    nic_model->new_conn_pps_limit = nic_message.new_conn_pps_limit();
+    // Storm control
+    nic_model->bum_pps_limit = nic_message.bum_pps_limit();
+    // Priority
+    nic_model->priority = nic_message.priority();
+    // MSS clamping
+    nic_model->mss_clamp = nic_message.mss_clamp();
+    // Rule hits
+    nic_model->count_rule_hits = nic_message.count_rule_hits();
     // Nic type
     if (nic_message.has_type())
         nic_model->type = static_cast<enum app::NicType>(nic_message.type());
@@ -827,6 +1108,56 @@ bool Api0::Convert(const MessageV0_NicUpdateReq &nic_update_message,
     } else {
         nic_update_model->has_packet_trace = false;
     }
+    // packet trace filtering
+    nic_update_model->has_packet_trace_filter =
+        nic_update_message.has_packet_trace_filter();
+    nic_update_model->packet_trace_filter =
+        nic_update_message.packet_trace_filter();
+    nic_update_model->has_packet_trace_snaplen =
+        nic_update_message.has_packet_trace_snaplen();
+    nic_update_model->packet_trace_snaplen =
+        nic_update_message.packet_trace_snaplen();
+    nic_update_model->has_packet_trace_sampling =
+        nic_update_message.has_packet_trace_sampling();
+    nic_update_model->packet_trace_sampling =
+        nic_update_message.packet_trace_sampling();
+    // Egress limits
+    nic_update_model->has_egress_bps_limit =
+        nic_update_message.has_egress_bps_limit();
+    nic_update_model->egress_bps_limit =
+        nic_update_message.egress_bps_limit();
+    nic_update_model->has_egress_pps_limit =
+        nic_update_message.has_egress_pps_limit();
+    nic_update_model->egress_pps_limit =
+        nic_update_message.egress_pps_limit();
+    // Ingress limits
+    nic_update_model->has_ingress_bps_limit =
+        nic_update_message.has_ingress_bps_limit();
+    nic_update_model->ingress_bps_limit =
+        nic_update_message.ingress_bps_limit();
+    nic_update_model->has_ingress_pps_limit =
+        nic_update_message.has_ingress_pps_limit();
+    nic_update_model->ingress_pps_limit =
+        nic_update_message.ingress_pps_limit();
+    // New connections limit
+    nic_update_model->has_new_conn_pps_limit =
+        nic_update_message.has_new_conn_pps_limit();
+    nic_update_model->new_conn_pps_limit =
+        nic_update_message.new_conn_pps_limit();
+    // Storm control
+    nic_update_model->has_bum_pps_limit =
+        nic_update_message.has_bum_pps_limit();
+    nic_update_model->bum_pps_limit = nic_update_message.bum_pps_limit();
+    // Priority
+    nic_update_model->has_priority = nic_update_message.has_priority();
+    nic_update_model->priority = nic_update_message.priority();
+    // MSS clamping
+    nic_update_model->has_mss_clamp = nic_update_message.has_mss_clamp();
+    nic_update_model->mss_clamp = nic_update_message.mss_clamp();
+    // Rule hits
+    nic_update_model->has_count_rule_hits =
+        nic_update_message.has_count_rule_hits();
+    nic_update_model->count_rule_hits = nic_update_message.count_rule_hits();
     // Packet trace path
     if (nic_update_model->packet_trace &&
         !nic_update_message.packet_trace_path().empty())
@@ -1037,6 +1368,70 @@ bool Api0::Convert(const MessageV0_Cidr &cidr_message, app::Cidr *cidr_model) {
     return true;
 }
 
+bool Api0::Convert(const app::NicStats &stats_model,
+                   MessageV0_NicStats *stats_message) {
+    if (stats_message == nullptr)
+        return false;
+    stats_message->set_in(stats_model.in);
+    stats_message->set_out(stats_model.out);
+    stats_message->set_egress_throttled(stats_model.egress_throttled);
+    stats_message->set_bum_dropped(stats_model.bum_dropped);
+    stats_message->set_mss_clamped(stats_model.mss_clamped);
+    stats_message->set_trace_dropped(stats_model.trace_dropped);
+    stats_message->set_egress_packets(stats_model.egress_packets);
+    stats_message->set_egress_bytes(stats_model.egress_bytes);
+    stats_message->set_ingress_packets(stats_model.ingress_packets);
+    stats_message->set_ingress_bytes(stats_model.ingress_bytes);
+    stats_message->set_egress_firewall_dropped(
+        stats_model.egress_firewall_dropped);
+    stats_message->set_ingress_firewall_dropped(
+        stats_model.ingress_firewall_dropped);
+    stats_message->set_egress_antispoof_dropped(
+        stats_model.egress_antispoof_dropped);
+    stats_message->set_ingress_antispoof_dropped(
+        stats_model.ingress_antispoof_dropped);
+    stats_message->set_ingress_vhost_dropped_bytes(
+        stats_model.ingress_vhost_dropped_bytes);
+    stats_message->set_ingress_policed(stats_model.ingress_policed);
+    stats_message->set_egress_conn_rejected(stats_model.egress_conn_rejected);
+    stats_message->set_ingress_conn_rejected(
+        stats_model.ingress_conn_rejected);
+    if (stats_model.has_latency) {
+        Convert(stats_model.egress_latency,
+                stats_message->mutable_egress_latency());
+        Convert(stats_model.ingress_latency,
+                stats_message->mutable_ingress_latency());
+    }
+    return true;
+}
+
+bool Api0::Convert(const app::LatencyStats &latency_model,
+                   MessageV0_LatencyStats *latency_message) {
+    if (latency_message == nullptr)
+        return false;
+    latency_message->set_samples(latency_model.samples);
+    latency_message->set_p50(latency_model.p50);
+    latency_message->set_p99(latency_model.p99);
+    latency_message->set_p999(latency_model.p999);
+    return true;
+}
+
+bool Api0::Convert(const app::BrickDrops &drops_model,
+                   MessageV0_DropCount *drops_message) {
+    if (drops_message == nullptr)
+        return false;
+    if (drops_model.brick.length() > 0)
+        drops_message->set_brick(drops_model.brick);
+    drops_message->set_reason(
+        static_cast<MessageV0_DropCount_Reason>(drops_model.reason));
+    // Only bytes are known when the vhost ring is full
+    if (drops_model.reason == app::DROP_VHOST_FULL)
+        drops_message->set_bytes(drops_model.bytes);
+    else
+        drops_message->set_packets(drops_model.packets);
+    return true;
+}
+
 bool Api0::Convert(const app::Error &error_model,
     MessageV0_Error *error_message) {
     if (error_message == nullptr)
@@ -50,6 +50,13 @@ Config::Config() {
     nic_mtu = "";
     dpdk_port = 0;
     no_offload = 0;
+    vxlan_port_hash = "none";
+    vxlan_port_range = "";
+    record_size = RECORDER_SIZE;
+    record_snaplen = RECORDER_SNAPLEN;
+    latency_sampling = 0;
+    capture_endpoint = "";
+    counters_path = "";
 }
 
 void (*logger)(int, const char *, va_list);
@@ -76,6 +83,16 @@ bool Config::parse_cmd(int argc, char **argv) {
     std::unique_ptr<gchar, decltype(gfree)> nic_mtu_cmd(nullptr, gfree);
     std::unique_ptr<gchar, decltype(gfree)> dpdk_port_cmd(nullptr, gfree);
     std::unique_ptr<gchar, decltype(gfree)> key_path_cmd(nullptr, gfree);
+    std::unique_ptr<gchar, decltype(gfree)> port_hash_cmd(nullptr, gfree);
+    std::unique_ptr<gchar, decltype(gfree)> port_range_cmd(nullptr, gfree);
+    std::unique_ptr<gchar, decltype(gfree)> record_size_cmd(nullptr, gfree);
+    std::unique_ptr<gchar, decltype(gfree)> record_snaplen_cmd(nullptr,
+                                                               gfree);
+    std::unique_ptr<gchar, decltype(gfree)> latency_sampling_cmd(nullptr,
+                                                                 gfree);
+    std::unique_ptr<gchar, decltype(gfree)> capture_endpoint_cmd(nullptr,
+                                                                 gfree);
+    std::unique_ptr<gchar, decltype(gfree)> counters_path_cmd(nullptr, gfree);
 
     static GOptionEntry entries[] = {
         {"config", 'c', 0, G_OPTION_ARG_FILENAME, &config_path_cmd,
@@ -113,6 +130,27 @@ bool Config::parse_cmd(int argc, char **argv) {
          "choose which dpdk port to use (default=0)", "PORT"},
         {"key", 'k', 0, G_OPTION_ARG_STRING, &key_path_cmd,
          "path to encryption key (raw randomized 32B)", "PATH"},
+        {"vxlan-port-hash", 0, 0, G_OPTION_ARG_STRING, &port_hash_cmd,
+         "choose VXLAN source port from inner packets. MODE can be 'none' "
+         "(default), 'l3' (addresses) or 'l4' (addresses and ports)", "MODE"},
+        {"vxlan-port-range", 0, 0, G_OPTION_ARG_STRING, &port_range_cmd,
+         "range of hashed VXLAN source ports (default=49152-65535)",
+         "MIN-MAX"},
+        {"record-size", 0, 0, G_OPTION_ARG_STRING, &record_size_cmd,
+         "number of last packets kept in memory for each nic, 0 to disable "
+         "(default=" G_STRINGIFY(RECORDER_SIZE) ")", "PACKETS"},
+        {"record-snaplen", 0, 0, G_OPTION_ARG_STRING, &record_snaplen_cmd,
+         "number of bytes kept from each recorded packet (default="
+         G_STRINGIFY(RECORDER_SNAPLEN) ")", "BYTES"},
+        {"latency-sampling", 0, 0, G_OPTION_ARG_STRING, &latency_sampling_cmd,
+         "measure latency of NICs on one poll out of N, 0 to disable "
+         "(default=0)", "N"},
+        {"capture-endpoint", 0, 0, G_OPTION_ARG_STRING, &capture_endpoint_cmd,
+         "ZMQ endpoint publishing packets captured with 'butterfly capture' "
+         "(disabled by default)", "ENDPOINT"},
+        {"counters-path", 0, 0, G_OPTION_ARG_FILENAME, &counters_path_cmd,
+         "publish all counters in a memory mapped file, readable with "
+         "'butterfly counters' (disabled by default)", "FILE"},
         { nullptr }
     };
     std::shared_ptr<GOptionContext> context(g_option_context_new(""),
@@ -172,6 +210,20 @@ bool Config::parse_cmd(int argc, char **argv) {
         nic_mtu = std::atoi(&*dpdk_port_cmd);
     if (key_path_cmd != nullptr)
         encryption_key_path = std::string(&*key_path_cmd);
+    if (port_hash_cmd != nullptr)
+        vxlan_port_hash = std::string(&*port_hash_cmd);
+    if (port_range_cmd != nullptr)
+        vxlan_port_range = std::string(&*port_range_cmd);
+    if (record_size_cmd != nullptr)
+        record_size = std::atoi(&*record_size_cmd);
+    if (record_snaplen_cmd != nullptr)
+        record_snaplen = std::atoi(&*record_snaplen_cmd);
+    if (latency_sampling_cmd != nullptr)
+        latency_sampling = std::atoi(&*latency_sampling_cmd);
+    if (capture_endpoint_cmd != nullptr)
+        capture_endpoint = std::string(&*capture_endpoint_cmd);
+    if (counters_path_cmd != nullptr)
+        counters_path = std::string(&*counters_path_cmd);
 
     // Load from configuration file if provided
     if (config_path.length() > 0 && !LoadConfigFile(config_path)) {
@@ -375,6 +427,62 @@ bool LoadConfigFile(std::string config_path) {
         log.Debug(m);
     }
 
+    v = ini.GetValue("general", "vxlan-port-hash", "_");
+    if (std::string(v) != "_") {
+        config.vxlan_port_hash = v;
+        std::string m = "LoadConfig: get vxlan-port-hash from config: " +
+            config.vxlan_port_hash;
+        log.Debug(m);
+    }
+
+    v = ini.GetValue("general", "vxlan-port-range", "_");
+    if (std::string(v) != "_") {
+        config.vxlan_port_range = v;
+        std::string m = "LoadConfig: get vxlan-port-range from config: " +
+            config.vxlan_port_range;
+        log.Debug(m);
+    }
+
+    v = ini.GetValue("general", "record-size", "_");
+    if (std::string(v) != "_") {
+        config.record_size = std::stoi(v);
+        std::string m = "LoadConfig: get record-size from config: " +
+            std::to_string(config.record_size);
+        log.Debug(m);
+    }
+
+    v = ini.GetValue("general", "record-snaplen", "_");
+    if (std::string(v) != "_") {
+        config.record_snaplen = std::stoi(v);
+        std::string m = "LoadConfig: get record-snaplen from config: " +
+            std::to_string(config.record_snaplen);
+        log.Debug(m);
+    }
+
+    v = ini.GetValue("general", "latency-sampling", "_");
+    if (std::string(v) != "_") {
+        config.latency_sampling = std::stoi(v);
+        std::string m = "LoadConfig: get latency-sampling from config: " +
+            std::to_string(config.latency_sampling);
+        log.Debug(m);
+    }
+
+    v = ini.GetValue("general", "capture-endpoint", "_");
+    if (std::string(v) != "_") {
+        config.capture_endpoint = v;
+        std::string m = "LoadConfig: get capture-endpoint from config: " +
+            config.capture_endpoint;
+        log.Debug(m);
+    }
+
+    v = ini.GetValue("general", "counters-path", "_");
+    if (std::string(v) != "_") {
+        config.counters_path = v;
+        std::string m = "LoadConfig: get counters-path from config: " +
+            config.counters_path;
+        log.Debug(m);
+    }
+
     v = ini.GetValue("security", "encryption_key_path", "_");
     if (std::string(v) != "_") {
         config.encryption_key_path = v;
@@ -421,6 +529,7 @@ Stats stats;
 Model model;
 Log log;
 Graph graph;
+Counters::Writer counters;
 struct pg_error *pg_error;
 
 }  // namespace app
@@ -532,6 +641,11 @@ main(int argc, char *argv[]) {
             app::request_exit = true;
         }
         InitCgroup(POLL_THREAD_MULTIPLIER);
+        // Counters are published by the API server
+        if (app::config.counters_path.length() > 0 &&
+            !app::counters.Open(app::config.counters_path))
+            app::log.Error("cannot create counter region " +
+                           app::config.counters_path);
         // Prepare & run API server
         ApiServer server(app::config.api_endpoint, &app::request_exit);
         server.RunThreaded();
@@ -544,6 +658,7 @@ main(int argc, char *argv[]) {
 
     // Ask graph to stop
     app::graph.Stop();
+    app::counters.Unlink();
 
     app::log.Info("butterfly exit");
     return 0;
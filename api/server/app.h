@@ -24,6 +24,7 @@ extern "C" {
 }
 
 #include <string>
+#include "api/common/counters.h"
 #include "api/server/model.h"
 #include "api/server/graph.h"
 
@@ -54,6 +55,8 @@ extern "C" {
     } while (0)
 
 #define POLL_THREAD_MULTIPLIER 4
+// Time between two updates of the counter region
+#define COUNTERS_PERIOD_MS 1000
 #define DPDK_DEFAULT_ARGS "-c1 -n1 --socket-mem 64 --no-shconf --huge-unlink"
 
 namespace app {
@@ -74,6 +77,13 @@ struct Config {
     std::string nic_mtu;
     int dpdk_port;
     bool no_offload;
+    std::string vxlan_port_hash;
+    std::string vxlan_port_range;
+    int record_size;
+    int record_snaplen;
+    int latency_sampling;
+    std::string capture_endpoint;
+    std::string counters_path;
     std::string encryption_key_path;
     std::string encryption_key;
 };
@@ -124,6 +134,7 @@ extern Stats stats;
 extern Model model;
 extern Log log;
 extern Graph graph;
+extern Counters::Writer counters;
 extern pg_error *pg_error;
 }  // namespace app
 
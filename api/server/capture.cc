@@ -0,0 +1,584 @@
+/* Copyright 2017 Outscale SAS
+ *
+ * This file is part of Butterfly.
+ *
+ * Butterfly is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License version 3 as published
+ * by the Free Software Foundation.
+ *
+ * Butterfly is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with Butterfly.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+extern "C" {
+#include <glib.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <errno.h>
+#include <inttypes.h>
+#include <rte_mbuf.h>
+}
+#include <algorithm>
+#include <cstring>
+#include <chrono>
+#include "api/server/capture.h"
+#include "api/server/app.h"
+
+namespace {
+
+#define PCAP_MAGIC 0xa1b2c3d4
+#define PCAP_LINKTYPE_ETHERNET 1
+
+struct PcapHeader {
+    uint32_t magic;
+    uint16_t version_major;
+    uint16_t version_minor;
+    int32_t thiszone;
+    uint32_t sigfigs;
+    uint32_t snaplen;
+    uint32_t network;
+};
+
+struct PcapRecord {
+    uint32_t ts_sec;
+    uint32_t ts_usec;
+    uint32_t caplen;
+    uint32_t len;
+};
+
+bool WriteAll(int fd, const uint8_t *data, size_t len) {
+    while (len > 0) {
+        ssize_t ret = write(fd, data, len);
+        if (ret < 0) {
+            if (errno == EINTR)
+                continue;
+            return false;
+        }
+        data += ret;
+        len -= ret;
+    }
+    return true;
+}
+
+// Create a pcap file and write its header, return -1 on error
+int PcapOpen(const std::string &path, uint32_t snaplen) {
+    struct PcapHeader hdr;
+
+    int fd = open(path.c_str(), O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC,
+                  0644);
+    if (fd < 0) {
+        LOG_ERROR_("cannot open capture file %s: %s", path.c_str(),
+                   strerror(errno));
+        return -1;
+    }
+    hdr.magic = PCAP_MAGIC;
+    hdr.version_major = 2;
+    hdr.version_minor = 4;
+    hdr.thiszone = 0;
+    hdr.sigfigs = 0;
+    hdr.snaplen = snaplen;
+    hdr.network = PCAP_LINKTYPE_ETHERNET;
+    if (!WriteAll(fd, reinterpret_cast<uint8_t *>(&hdr), sizeof(hdr))) {
+        LOG_ERROR_("cannot write capture file %s: %s", path.c_str(),
+                   strerror(errno));
+        close(fd);
+        return -1;
+    }
+    return fd;
+}
+
+// Copy a pcap record header and the first snaplen bytes of a packet
+bool PcapCopy(struct rte_mbuf *pkt, uint8_t *slot, uint32_t snaplen,
+              gint64 now) {
+    struct PcapRecord *rec = reinterpret_cast<struct PcapRecord *>(slot);
+    uint8_t *data = slot + sizeof(*rec);
+    uint32_t len = rte_pktmbuf_pkt_len(pkt);
+    uint32_t caplen = std::min(len, snaplen);
+    // Data is only copied if the packet is segmented
+    const void *p = rte_pktmbuf_read(pkt, 0, caplen, data);
+
+    if (p == NULL)
+        return false;
+    if (p != data)
+        memcpy(data, p, caplen);
+    rec->ts_sec = now / G_USEC_PER_SEC;
+    rec->ts_usec = now % G_USEC_PER_SEC;
+    rec->caplen = caplen;
+    rec->len = len;
+    return true;
+}
+
+// Size of a record in a capture ring, see Capture::ring_
+uint64_t RecordSize(uint32_t caplen) {
+    return (sizeof(uint32_t) + sizeof(struct PcapRecord) + caplen + 7) &
+        ~UINT64_C(7);
+}
+
+// Compile a pcap filter to BPF then to native code, the poller runs it
+// on every captured packet
+bpfjit_func_t FilterCompile(const std::string &filter, std::string *error) {
+    pcap_t *pcap = pcap_open_dead(DLT_EN10MB, CAPTURE_SNAPLEN_MAX);
+    struct bpf_program prog;
+    bpfjit_func_t func;
+
+    if (pcap == NULL) {
+        *error = "cannot compile filter";
+        return NULL;
+    }
+    if (pcap_compile(pcap, &prog, filter.c_str(), 1,
+                     PCAP_NETMASK_UNKNOWN) < 0) {
+        *error = pcap_geterr(pcap);
+        pcap_close(pcap);
+        return NULL;
+    }
+    func = bpfjit_generate_code(NULL, prog.bf_insns, prog.bf_len);
+    if (func == NULL)
+        *error = "cannot generate filter code";
+    pcap_freecode(&prog);
+    pcap_close(pcap);
+    return func;
+}
+
+void FilterFree(bpfjit_func_t func) {
+    if (func == NULL)
+        return;
+    bpfjit_free_code(func);
+}
+
+}  // namespace
+
+namespace app {
+
+std::shared_ptr<Capture> Capture::Open(const std::string &path,
+                                       uint32_t ring_size) {
+    uint32_t size = CAPTURE_WRITE_BUFFER;
+
+    int fd = PcapOpen(path, CAPTURE_SNAPLEN_MAX);
+    if (fd < 0)
+        return nullptr;
+    while (size < ring_size)
+        size <<= 1;
+    return std::shared_ptr<Capture>(new Capture(fd, path, size));
+}
+
+std::shared_ptr<Capture> Capture::Stream(const std::string &topic,
+                                         uint32_t ring_size) {
+    uint32_t size = CAPTURE_WRITE_BUFFER;
+
+    while (size < ring_size)
+        size <<= 1;
+    std::shared_ptr<Capture> c(new Capture(-1, "", size));
+    c->topic_ = topic;
+    return c;
+}
+
+Capture::Capture(int fd, const std::string &path, uint32_t ring_size) :
+    fd_(fd),
+    path_(path),
+    snaplen_(CAPTURE_SNAPLEN_MAX),
+    sampling_(1),
+    rate_limit_(0),
+    deadline_(0),
+    closed_(false),
+    filter_(NULL),
+    old_filter_(NULL),
+    matched_(0),
+    rate_second_(0),
+    rate_count_(0),
+    ring_mask_(ring_size - 1),
+    ring_(ring_size),
+    head_(0),
+    tail_(0),
+    buffer_(CAPTURE_WRITE_BUFFER),
+    captured_(0),
+    dropped_(0),
+    limited_(0) {
+}
+
+Capture::~Capture() {
+    Flush();
+    if (fd_ >= 0)
+        close(fd_);
+    FilterFree(filter_);
+    FilterFree(old_filter_);
+}
+
+bool Capture::CheckFilter(const std::string &filter, std::string *error) {
+    if (filter.empty())
+        return true;
+    bpfjit_func_t func = FilterCompile(filter, error);
+    FilterFree(func);
+    return func != NULL;
+}
+
+bpfjit_func_t Capture::CompileFilter(const std::string &filter,
+                                     std::string *error) {
+    return FilterCompile(filter, error);
+}
+
+void Capture::FreeFilter(bpfjit_func_t func) {
+    FilterFree(func);
+}
+
+bool Capture::SetFilter(const std::string &filter, std::string *error) {
+    bpfjit_func_t func = NULL;
+
+    if (!filter.empty()) {
+        func = FilterCompile(filter, error);
+        if (func == NULL)
+            return false;
+    }
+    ReleaseFilter();
+    old_filter_ = filter_.exchange(func, std::memory_order_acq_rel);
+    return true;
+}
+
+void Capture::ReleaseFilter() {
+    FilterFree(old_filter_);
+    old_filter_ = NULL;
+}
+
+void Capture::SetSnaplen(uint32_t snaplen) {
+    if (snaplen == 0 || snaplen > CAPTURE_SNAPLEN_MAX)
+        snaplen = CAPTURE_SNAPLEN_MAX;
+    snaplen_ = snaplen;
+}
+
+void Capture::SetSampling(uint32_t sampling) {
+    sampling_ = std::max(sampling, 1U);
+}
+
+void Capture::SetRateLimit(uint32_t pps) {
+    rate_limit_ = pps;
+}
+
+void Capture::SetDuration(uint32_t duration) {
+    if (duration == 0)
+        deadline_ = 0;
+    else
+        deadline_ = g_get_real_time() + duration * G_USEC_PER_SEC;
+}
+
+void Capture::Close() {
+    closed_ = true;
+}
+
+bool Capture::Finished(gint64 now) const {
+    gint64 deadline = deadline_.load(std::memory_order_relaxed);
+    return closed_.load(std::memory_order_relaxed) ||
+        (deadline != 0 && now >= deadline);
+}
+
+void Capture::Push(struct rte_mbuf *pkt, gint64 now) {
+    uint32_t caplen = std::min(rte_pktmbuf_pkt_len(pkt),
+                               snaplen_.load(std::memory_order_relaxed));
+    uint64_t size = RecordSize(caplen);
+    uint64_t ring_size = ring_.size();
+    uint64_t head = head_.load(std::memory_order_relaxed);
+    uint64_t tail = tail_.load(std::memory_order_acquire);
+    uint64_t pos = head & ring_mask_;
+    // Records are never split at the end of the ring
+    uint64_t pad = ring_size - pos < size ? ring_size - pos : 0;
+
+    if (ring_size - (head - tail) < pad + size) {
+        dropped_.fetch_add(1, std::memory_order_relaxed);
+        return;
+    }
+    if (pad > 0) {
+        *reinterpret_cast<uint32_t *>(&ring_[pos]) = 0;
+        head += pad;
+        pos = 0;
+    }
+    uint8_t *rec = &ring_[pos];
+    if (!PcapCopy(pkt, rec + sizeof(uint32_t), caplen, now)) {
+        head_.store(head, std::memory_order_release);
+        dropped_.fetch_add(1, std::memory_order_relaxed);
+        return;
+    }
+    *reinterpret_cast<uint32_t *>(rec) = size;
+    head_.store(head + size, std::memory_order_release);
+    captured_.fetch_add(1, std::memory_order_relaxed);
+}
+
+void Capture::Burst(struct pg_brick *brick, enum pg_side from,
+                    uint16_t pkts_count, struct rte_mbuf **pkts,
+                    uint64_t *pkts_mask, void *private_data) {
+    Capture *capture = static_cast<Capture *>(private_data);
+    bpfjit_func_t filter = capture->filter_.load(std::memory_order_acquire);
+    uint32_t sampling = capture->sampling_.load(std::memory_order_relaxed);
+    uint32_t rate_limit = capture->rate_limit_.load(std::memory_order_relaxed);
+    // All packets of a burst share the same timestamp
+    gint64 now = g_get_real_time();
+
+    if (capture->Finished(now))
+        return;
+    if (rate_limit > 0 && now / G_USEC_PER_SEC != capture->rate_second_) {
+        capture->rate_second_ = now / G_USEC_PER_SEC;
+        capture->rate_count_ = 0;
+    }
+
+    for (uint64_t mask = *pkts_mask; mask; mask &= mask - 1) {
+        struct rte_mbuf *pkt = pkts[__builtin_ctzll(mask)];
+        // Filter only looks at the first segment of the packet
+        if (filter != NULL) {
+            bpf_args_t args;
+            memset(&args, 0, sizeof(args));
+            args.pkt = rte_pktmbuf_mtod(pkt, const uint8_t *);
+            args.wirelen = rte_pktmbuf_pkt_len(pkt);
+            args.buflen = rte_pktmbuf_data_len(pkt);
+            if (!filter(NULL, &args))
+                continue;
+        }
+        if (sampling > 1 && capture->matched_++ % sampling != 0)
+            continue;
+        if (rate_limit > 0 && capture->rate_count_++ >= rate_limit) {
+            capture->limited_.fetch_add(1, std::memory_order_relaxed);
+            continue;
+        }
+        capture->Push(pkt, now);
+    }
+}
+
+void Capture::Write(const uint8_t *data, size_t len,
+                    zmqpp::socket *publisher) {
+    if (fd_ >= 0) {
+        if (!WriteAll(fd_, data, len))
+            LOG_ERROR_("cannot write capture file %s: %s", path_.c_str(),
+                       strerror(errno));
+        return;
+    }
+    if (publisher == NULL)
+        return;
+    zmqpp::message message;
+    message << topic_;
+    message.add_raw(data, len);
+    // A publisher never blocks, messages are lost for slow subscribers
+    publisher->send(message, true);
+}
+
+size_t Capture::Flush(zmqpp::socket *publisher) {
+    uint64_t tail = tail_.load(std::memory_order_relaxed);
+    uint64_t head = head_.load(std::memory_order_acquire);
+    size_t count = 0;
+    size_t len = 0;
+
+    while (tail != head) {
+        uint64_t pos = tail & ring_mask_;
+        uint32_t size = *reinterpret_cast<const uint32_t *>(&ring_[pos]);
+        if (size == 0) {
+            tail += ring_.size() - pos;
+            continue;
+        }
+        const uint8_t *data = &ring_[pos + sizeof(uint32_t)];
+        const struct PcapRecord *rec =
+            reinterpret_cast<const struct PcapRecord *>(data);
+        size_t rec_len = sizeof(*rec) + rec->caplen;
+        if (len + rec_len > buffer_.size()) {
+            // Give space back to the poller before waiting for the disk
+            tail_.store(tail, std::memory_order_release);
+            Write(buffer_.data(), len, publisher);
+            len = 0;
+        }
+        memcpy(&buffer_[len], data, rec_len);
+        len += rec_len;
+        tail += size;
+        count++;
+    }
+    tail_.store(tail, std::memory_order_release);
+    if (len > 0)
+        Write(buffer_.data(), len, publisher);
+    return count;
+}
+
+CaptureWriter::CaptureWriter() : running_(false) {
+}
+
+CaptureWriter::~CaptureWriter() {
+    Stop();
+}
+
+void CaptureWriter::Start(const std::string &endpoint) {
+    if (running_)
+        return;
+    if (!endpoint.empty()) {
+        publisher_.reset(new zmqpp::socket(context_,
+                                           zmqpp::socket_type::publish));
+        try {
+            publisher_->set(zmqpp::socket_option::linger,
+                            CAPTURE_STREAM_LINGER_MS);
+            publisher_->bind(endpoint);
+            endpoint_ = endpoint;
+        } catch (std::exception &e) {
+            LOG_ERROR_("cannot bind capture stream socket %s: %s",
+                       endpoint.c_str(), e.what());
+            publisher_.reset();
+        }
+    }
+    running_ = true;
+    thread_ = std::thread(&CaptureWriter::Run, this);
+}
+
+void CaptureWriter::Stop() {
+    if (!running_)
+        return;
+    running_ = false;
+    thread_.join();
+    std::lock_guard<std::mutex> lock(mutex_);
+    for (auto &weak : captures_) {
+        std::shared_ptr<Capture> capture = weak.lock();
+        if (capture)
+            capture->Flush();
+    }
+    for (auto &stream : streams_)
+        Finish(stream);
+    streams_.clear();
+    publisher_.reset();
+}
+
+void CaptureWriter::Add(std::shared_ptr<Capture> capture) {
+    std::lock_guard<std::mutex> lock(mutex_);
+    if (capture->Topic().empty())
+        captures_.push_back(capture);
+    else
+        streams_.push_back(capture);
+}
+
+void CaptureWriter::Finish(std::shared_ptr<Capture> stream) {
+    stream->Flush(publisher_.get());
+    if (publisher_) {
+        zmqpp::message message;
+        message << stream->Topic() << std::string();
+        publisher_->send(message, true);
+    }
+    LOG_INFO_("capture stream %s ended: %" PRIu64 " packets, %" PRIu64
+              " dropped, %" PRIu64 " over rate limit", stream->Topic().c_str(),
+              stream->Captured(), stream->Dropped(), stream->Limited());
+}
+
+void CaptureWriter::Run() {
+    std::vector<std::shared_ptr<Capture>> captures;
+    std::vector<std::shared_ptr<Capture>> finished;
+
+    while (running_) {
+        gint64 now = g_get_real_time();
+        {
+            std::lock_guard<std::mutex> lock(mutex_);
+            for (auto it = captures_.begin(); it != captures_.end();) {
+                std::shared_ptr<Capture> capture = it->lock();
+                if (!capture) {
+                    it = captures_.erase(it);
+                    continue;
+                }
+                captures.push_back(capture);
+                it++;
+            }
+            for (auto it = streams_.begin(); it != streams_.end();) {
+                if ((*it)->Finished(now)) {
+                    finished.push_back(*it);
+                    it = streams_.erase(it);
+                    continue;
+                }
+                captures.push_back(*it);
+                it++;
+            }
+        }
+        size_t written = 0;
+        for (auto &capture : captures)
+            written += capture->Flush(publisher_.get());
+        for (auto &stream : finished)
+            Finish(stream);
+        // Released captures are closed here
+        captures.clear();
+        finished.clear();
+        if (written == 0) {
+            std::this_thread::sleep_for(
+                std::chrono::milliseconds(CAPTURE_WRITER_IDLE_MS));
+        }
+    }
+}
+
+Recorder::Recorder(uint32_t size, uint32_t snaplen) :
+    size_(0),
+    snaplen_(snaplen),
+    slot_size_(sizeof(struct PcapRecord) + snaplen),
+    head_(0) {
+    if (size == 0)
+        return;
+    size_ = 1;
+    while (size_ < size)
+        size_ <<= 1;
+    ring_.resize(static_cast<size_t>(size_) * slot_size_);
+    seqs_.reset(new std::atomic<uint64_t>[size_]);
+    for (uint32_t i = 0; i < size_; i++)
+        seqs_[i] = 0;
+}
+
+void Recorder::Burst(struct pg_brick *brick, enum pg_side from,
+                     uint16_t pkts_count, struct rte_mbuf **pkts,
+                     uint64_t *pkts_mask, void *private_data) {
+    Recorder *r = static_cast<Recorder *>(private_data);
+    if (r->size_ == 0)
+        return;
+    // g_get_real_time uses vDSO and does not enter the kernel
+    gint64 now = g_get_real_time();
+    uint64_t head = r->head_.load(std::memory_order_relaxed);
+
+    for (uint64_t mask = *pkts_mask; mask; mask &= mask - 1) {
+        uint32_t i = head & (r->size_ - 1);
+        std::atomic<uint64_t> &seq = r->seqs_[i];
+        seq.store(0, std::memory_order_relaxed);
+        std::atomic_thread_fence(std::memory_order_release);
+        uint8_t *slot = &r->ring_[static_cast<size_t>(i) * r->slot_size_];
+        if (!PcapCopy(pkts[__builtin_ctzll(mask)], slot, r->snaplen_, now))
+            continue;
+        seq.store(++head, std::memory_order_release);
+    }
+    r->head_.store(head, std::memory_order_release);
+}
+
+bool Recorder::Dump(const std::string &path, uint64_t *packets) {
+    std::vector<uint8_t> buffer(CAPTURE_WRITE_BUFFER);
+    size_t len = 0;
+    bool ret = true;
+
+    *packets = 0;
+    int fd = PcapOpen(path, snaplen_);
+    if (fd < 0)
+        return false;
+    uint64_t head = head_.load(std::memory_order_acquire);
+    uint64_t first = head > size_ ? head - size_ : 0;
+    for (uint64_t n = first; n < head && ret; n++) {
+        uint32_t i = n & (size_ - 1);
+        if (seqs_[i].load(std::memory_order_acquire) != n + 1)
+            continue;
+        const uint8_t *slot = &ring_[static_cast<size_t>(i) * slot_size_];
+        struct PcapRecord rec;
+        memcpy(&rec, slot, sizeof(rec));
+        size_t rec_len = sizeof(rec) + std::min(rec.caplen, snaplen_);
+        if (len + rec_len > buffer.size()) {
+            ret = WriteAll(fd, buffer.data(), len);
+            len = 0;
+        }
+        memcpy(&buffer[len], slot, rec_len);
+        // Skip the packet if the poller wrote the slot during the copy
+        std::atomic_thread_fence(std::memory_order_acquire);
+        if (seqs_[i].load(std::memory_order_relaxed) != n + 1)
+            continue;
+        len += rec_len;
+        (*packets)++;
+    }
+    if (ret && len > 0)
+        ret = WriteAll(fd, buffer.data(), len);
+    if (!ret)
+        LOG_ERROR_("cannot write capture file %s: %s", path.c_str(),
+                   strerror(errno));
+    close(fd);
+    return ret;
+}
+
+}  // namespace app
@@ -0,0 +1,279 @@
+/* Copyright 2017 Outscale SAS
+ *
+ * This file is part of Butterfly.
+ *
+ * Butterfly is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License version 3 as published
+ * by the Free Software Foundation.
+ *
+ * Butterfly is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with Butterfly.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef API_SERVER_CAPTURE_H_
+#define API_SERVER_CAPTURE_H_
+
+extern "C" {
+#include <glib.h>
+#include <pcap/pcap.h>
+#include <bpfjit.h>
+#include <packetgraph/packetgraph.h>
+}
+#include <zmqpp/zmqpp.hpp>
+#include <atomic>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+
+// Default size in bytes of the ring buffering packets of a capture
+#define CAPTURE_RING_SIZE (8 * 1024 * 1024)
+// Maximal number of bytes kept from each captured packet
+#define CAPTURE_SNAPLEN_MAX 65535
+// Size of the buffer used to batch writes of a capture file, and maximal
+// size of a stream message
+#define CAPTURE_WRITE_BUFFER (256 * 1024)
+// Time the writer thread sleeps when all captures are empty
+#define CAPTURE_WRITER_IDLE_MS 10
+// Time given to send the last stream messages when the writer stops
+#define CAPTURE_STREAM_LINGER_MS 1000
+// Default number of packets kept by the flight recorder of each NIC
+#define RECORDER_SIZE 1024
+// Default number of bytes kept from each recorded packet
+#define RECORDER_SNAPLEN 128
+
+namespace app {
+
+/* A packet capture written in pcap format.
+ * Packets are copied by the poller thread (see Burst) in a single producer,
+ * single consumer ring and written to the capture file, or published on
+ * the capture stream socket, by the capture writer thread (see
+ * CaptureWriter), so the poller never waits for the disk nor the network.
+ * When the ring is full, packets are not captured and counted as dropped.
+ * A filter, a snaplen, a sampling rate and a rate limit can be set at any
+ * time to limit the packets copied by the poller.
+ */
+class Capture {
+ public:
+    /* Create a capture and write the pcap header to its file.
+     * @param   path path of the pcap file to create
+     * @param   ring_size size of the ring in bytes, rounded up to a power
+     *          of two
+     * @return  the new capture, NULL if the file cannot be created
+     */
+    static std::shared_ptr<Capture> Open(const std::string &path,
+                                         uint32_t ring_size =
+                                         CAPTURE_RING_SIZE);
+    /* Create a capture published on the capture stream socket.
+     * Each message has two frames: the topic of the stream and pcap records
+     * (without pcap header), an empty second frame ends the stream.
+     * @param   topic topic of the stream
+     * @param   ring_size size of the ring in bytes, rounded up to a power
+     *          of two
+     * @return  the new capture
+     */
+    static std::shared_ptr<Capture> Stream(const std::string &topic,
+                                           uint32_t ring_size =
+                                           CAPTURE_RING_SIZE);
+    ~Capture();
+    /* Check a capture filter.
+     * @param   filter pcap filter expression
+     * @param   error set to the compilation error, if any
+     * @return  true if the filter can be used, false otherwise
+     */
+    static bool CheckFilter(const std::string &filter, std::string *error);
+    /* Compile a pcap filter to native code, for other bricks matching
+     * packets against a filter.
+     * @param   filter pcap filter expression
+     * @param   error set to the compilation error, if any
+     * @return  compiled filter to free with FreeFilter, NULL on error
+     */
+    static bpfjit_func_t CompileFilter(const std::string &filter,
+                                       std::string *error);
+    // Free a filter compiled by CompileFilter, NULL is ignored
+    static void FreeFilter(bpfjit_func_t func);
+    /* Only capture packets matching a filter.
+     * The previous filter stays allocated until ReleaseFilter is called,
+     * once the poller cannot use it anymore.
+     * @param   filter pcap filter expression, empty to capture all packets
+     * @param   error set to the compilation error, if any
+     * @return  false if the filter cannot be compiled, true otherwise
+     */
+    bool SetFilter(const std::string &filter, std::string *error);
+    // Free the filter replaced by the last SetFilter
+    void ReleaseFilter();
+    /* Set the number of bytes kept from each packet.
+     * @param   snaplen 0 or more than CAPTURE_SNAPLEN_MAX for full packets
+     */
+    void SetSnaplen(uint32_t snaplen);
+    /* Only capture one packet out of N packets matching the filter.
+     * @param   sampling N, 0 or 1 to capture all packets
+     */
+    void SetSampling(uint32_t sampling);
+    /* Limit the number of packets captured per second.
+     * @param   pps packets per second, 0 for no limit
+     */
+    void SetRateLimit(uint32_t pps);
+    /* Stop capturing after some time.
+     * @param   duration seconds from now, 0 for no limit
+     */
+    void SetDuration(uint32_t duration);
+    // Stop capturing, the stream ends at the next flush
+    void Close();
+    /* Check if a capture does not capture packets anymore.
+     * @param   now current date in microseconds (see g_get_real_time)
+     * @return  true if the capture has been closed or its duration expired
+     */
+    bool Finished(gint64 now) const;
+    /* Callback of user-dipole bricks capturing packets going through them
+     * in both directions, private_data must be a Capture.
+     * Packets are filtered and sampled before being copied, they are never
+     * modified nor dropped.
+     */
+    static void Burst(struct pg_brick *brick, enum pg_side from,
+                      uint16_t pkts_count, struct rte_mbuf **pkts,
+                      uint64_t *pkts_mask, void *private_data);
+    /* Write packets waiting in the ring to the capture file, or publish
+     * them if the capture is a stream.
+     * Must only be called by one thread at a time.
+     * @param   publisher socket publishing streams, packets of a stream are
+     *          discarded if NULL
+     * @return  number of packets written
+     */
+    size_t Flush(zmqpp::socket *publisher = NULL);
+    const std::string &Path() const { return path_; }
+    // Topic of a stream, empty if the capture is written in a file
+    const std::string &Topic() const { return topic_; }
+    // Number of packets written in the ring
+    uint64_t Captured() const { return captured_; }
+    // Number of packets not captured because the ring was full
+    uint64_t Dropped() const { return dropped_; }
+    // Number of packets not captured because of the rate limit
+    uint64_t Limited() const { return limited_; }
+
+ private:
+    Capture(int fd, const std::string &path, uint32_t ring_size);
+    void Push(struct rte_mbuf *pkt, gint64 now);
+    void Write(const uint8_t *data, size_t len, zmqpp::socket *publisher);
+    int fd_;
+    std::string path_;
+    std::string topic_;
+    std::atomic<uint32_t> snaplen_;
+    std::atomic<uint32_t> sampling_;
+    std::atomic<uint32_t> rate_limit_;
+    // Date in microseconds after which nothing is captured, 0 for never
+    std::atomic<gint64> deadline_;
+    std::atomic<bool> closed_;
+    // Filter compiled by bpfjit, NULL to capture all packets
+    std::atomic<bpfjit_func_t> filter_;
+    bpfjit_func_t old_filter_;
+    // Packets matching the filter, used by the poller for sampling
+    uint64_t matched_;
+    // Second and packets captured during it, used by the poller for the
+    // rate limit
+    gint64 rate_second_;
+    uint32_t rate_count_;
+    // Records are 8 bytes aligned: record size, pcap record header and
+    // data, a null size means the rest of the ring is unused
+    uint32_t ring_mask_;
+    std::vector<uint8_t> ring_;
+    // Offsets in the ring, written by the poller only
+    std::atomic<uint64_t> head_;
+    // Written by the flushing thread only
+    std::atomic<uint64_t> tail_;
+    std::vector<uint8_t> buffer_;
+    std::atomic<uint64_t> captured_;
+    std::atomic<uint64_t> dropped_;
+    std::atomic<uint64_t> limited_;
+};
+
+/* Thread flushing all opened captures to their files and publishing
+ * streams on the capture stream socket.
+ * The writer only keeps weak references on file captures: a capture is
+ * closed (after a last flush) as soon as its owner releases it.
+ * Streams are kept until they are finished (see Capture::Finished) so
+ * their end can always be published.
+ */
+class CaptureWriter {
+ public:
+    CaptureWriter();
+    ~CaptureWriter();
+    /* Start the writer thread.
+     * @param   endpoint ZMQ endpoint publishing streams, empty to disable
+     *          streams
+     */
+    void Start(const std::string &endpoint);
+    void Stop();
+    // Check if streams can be published
+    bool Streaming() const { return publisher_ != nullptr; }
+    const std::string &Endpoint() const { return endpoint_; }
+    /* Start flushing a capture.
+     * @param   capture capture to flush until it is released, or until it
+     *          is finished for a stream
+     */
+    void Add(std::shared_ptr<Capture> capture);
+
+ private:
+    void Run();
+    void Finish(std::shared_ptr<Capture> stream);
+    std::atomic<bool> running_;
+    std::thread thread_;
+    std::mutex mutex_;
+    std::vector<std::weak_ptr<Capture>> captures_;
+    std::vector<std::shared_ptr<Capture>> streams_;
+    std::string endpoint_;
+    zmqpp::context context_;
+    // Only used by the writer thread once started
+    std::unique_ptr<zmqpp::socket> publisher_;
+};
+
+/* Flight recorder keeping the last packets going through a brick.
+ * Packets are truncated and copied by the poller thread (see Burst) in a
+ * ring overwriting the oldest packets, without any lock or system call,
+ * so recording can stay enabled on all NICs.
+ * The ring can be dumped at any time by another thread.
+ */
+class Recorder {
+ public:
+    /* Create a flight recorder.
+     * @param   size number of packets to keep, rounded up to a power of two,
+     *          0 to record nothing
+     * @param   snaplen maximal number of bytes kept from each packet
+     */
+    explicit Recorder(uint32_t size = RECORDER_SIZE,
+                      uint32_t snaplen = RECORDER_SNAPLEN);
+    /* Callback of user-dipole bricks recording packets going through them
+     * in both directions, private_data must be a Recorder.
+     * Packets are never modified nor dropped.
+     */
+    static void Burst(struct pg_brick *brick, enum pg_side from,
+                      uint16_t pkts_count, struct rte_mbuf **pkts,
+                      uint64_t *pkts_mask, void *private_data);
+    /* Write recorded packets in a pcap file, oldest first.
+     * Packets overwritten by the poller during the dump are skipped.
+     * @param   path path of the pcap file to create
+     * @param   packets set to the number of packets written
+     * @return  false if the file cannot be written, true otherwise
+     */
+    bool Dump(const std::string &path, uint64_t *packets);
+
+ private:
+    uint32_t size_;
+    uint32_t snaplen_;
+    uint32_t slot_size_;
+    std::vector<uint8_t> ring_;
+    // Index of the packet in each slot plus one, 0 while it is written
+    std::unique_ptr<std::atomic<uint64_t>[]> seqs_;
+    // Number of packets recorded since creation
+    std::atomic<uint64_t> head_;
+};
+
+}  // namespace app
+
+#endif  // API_SERVER_CAPTURE_H_
@@ -0,0 +1,454 @@
+/* Copyright 2017 Outscale SAS
+ *
+ * This file is part of Butterfly.
+ *
+ * Butterfly is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License version 3 as published
+ * by the Free Software Foundation.
+ *
+ * Butterfly is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with Butterfly.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+extern "C" {
+#include <arpa/inet.h>
+#include <netinet/in.h>
+}
+#include <string.h>
+#include <algorithm>
+#include <map>
+#include <set>
+#include <string>
+#include <tuple>
+#include <utility>
+#include <vector>
+#include "api/server/app.h"
+#include "api/server/firewall.h"
+
+namespace app {
+
+namespace {
+uint32_t FamilyMaxMask(Ip::type_t family) {
+    return family == Ip::V6 ? 128 : 32;
+}
+
+/* Push sources of the same family in several rules sharing the same
+ * protocol and ports description.
+ */
+void FwPushSources(const FwRule &model, const std::vector<Cidr> &sources,
+                   std::vector<FwRule> *out) {
+    for (auto it = sources.begin(); it != sources.end();) {
+        FwRule r = model;
+        for (int n = 0; n < FW_RULE_MAX_SOURCES && it != sources.end();
+             n++, it++)
+            r.sources.push_back(*it);
+        out->push_back(r);
+    }
+}
+
+/* Prefix of an IPv4 or IPv6 address, in network order. */
+struct Prefix {
+    uint8_t addr[16];
+    uint32_t len;
+};
+
+bool PrefixBit(const Prefix &p, uint32_t bit) {
+    return (p.addr[bit / 8] >> (7 - bit % 8)) & 1;
+}
+
+void PrefixMask(Prefix *p) {
+    for (uint32_t i = p->len; i < 128; i++)
+        p->addr[i / 8] &= ~(1 << (7 - i % 8));
+}
+
+bool PrefixLess(const Prefix &a, const Prefix &b) {
+    int c = memcmp(a.addr, b.addr, 16);
+    return c < 0 || (c == 0 && a.len < b.len);
+}
+
+// Does a contains b ?
+bool PrefixCovers(const Prefix &a, const Prefix &b) {
+    if (a.len > b.len)
+        return false;
+    uint32_t bytes = a.len / 8;
+    if (memcmp(a.addr, b.addr, bytes) != 0)
+        return false;
+    if (a.len % 8 == 0)
+        return true;
+    uint8_t mask = 0xff << (8 - a.len % 8);
+    return (a.addr[bytes] & mask) == (b.addr[bytes] & mask);
+}
+
+// Are a and b the two halves of the same prefix ?
+bool PrefixSiblings(const Prefix &a, const Prefix &b) {
+    if (a.len != b.len || a.len == 0)
+        return false;
+    Prefix parent = a;
+    parent.len--;
+    return PrefixCovers(parent, b) &&
+           PrefixBit(a, a.len - 1) != PrefixBit(b, b.len - 1);
+}
+
+Prefix PrefixFromCidr(const Cidr &c) {
+    Prefix p;
+    memset(p.addr, 0, 16);
+    c.address.Bytes(p.addr);
+    p.len = c.mask_size;
+    PrefixMask(&p);
+    return p;
+}
+
+Cidr PrefixToCidr(const Prefix &p, Ip::type_t family) {
+    char str[INET6_ADDRSTRLEN];
+    Cidr c;
+    inet_ntop(family == Ip::V6 ? AF_INET6 : AF_INET, p.addr, str,
+              INET6_ADDRSTRLEN);
+    c.address = std::string(str);
+    c.mask_size = p.len;
+    return c;
+}
+
+/* Sort, remove nested prefixes and merge siblings prefixes.
+ * Resulting list is sorted and only contains disjoint prefixes.
+ */
+void PrefixMinimize(std::vector<Prefix> *list) {
+    std::sort(list->begin(), list->end(), PrefixLess);
+    std::vector<Prefix> out;
+    for (auto it = list->begin(); it != list->end(); it++) {
+        if (out.size() > 0 && PrefixCovers(out.back(), *it))
+            continue;
+        out.push_back(*it);
+        while (out.size() >= 2 &&
+               PrefixSiblings(out[out.size() - 2], out.back())) {
+            out.pop_back();
+            out.back().len--;
+            PrefixMask(&out.back());
+        }
+    }
+    list->swap(out);
+}
+
+// Is p covered by one prefix of a minimized list ?
+bool PrefixListCovers(const std::vector<Prefix> &list, const Prefix &p) {
+    auto it = std::upper_bound(list.begin(), list.end(), p, PrefixLess);
+    if (it == list.begin())
+        return false;
+    return PrefixCovers(*(--it), p);
+}
+
+/* Rules sharing the same IP version, protocol and port range. */
+struct FwGroup {
+    FwGroup() : any(false) {}
+    // true if any source is allowed
+    bool any;
+    std::vector<Prefix> sources;
+};
+
+// (family, protocol, port start, port end)
+typedef std::tuple<int, int, int, int> FwGroupKey;
+
+bool FwHasPorts(int protocol) {
+    return protocol == IPPROTO_TCP || protocol == IPPROTO_UDP;
+}
+
+// Does rules of group key a allow everything rules of group key b allow ?
+bool FwGroupDominates(const FwGroupKey &a, const FwGroupKey &b) {
+    if (a == b || std::get<0>(a) != std::get<0>(b))
+        return false;
+    if (std::get<1>(a) == -1)
+        return true;
+    if (std::get<1>(a) != std::get<1>(b) || !FwHasPorts(std::get<1>(a)))
+        return false;
+    return std::get<2>(a) <= std::get<2>(b) &&
+           std::get<3>(a) >= std::get<3>(b);
+}
+}  // namespace
+
+FwRule::FwRule() {
+    direction = Rule::INBOUND;
+    family = Ip::V4;
+    protocol = -1;
+    port_start = 0;
+    port_end = 0;
+}
+
+bool FwRule::operator== (const FwRule& a) const {
+    return (direction == a.direction &&
+            family == a.family &&
+            sources == a.sources &&
+            protocol == a.protocol &&
+            port_start == a.port_start &&
+            port_end == a.port_end);
+}
+
+std::string FwRule::Filter() const {
+    std::string r;
+    std::string peer = direction == Rule::OUTBOUND ? "dst" : "src";
+
+    // Build source (or destination for outbound rules)
+    if (sources.size() == 0) {
+        r = family == Ip::V6 ? "ip6" : "ip";
+    } else {
+        r = "(";
+        for (auto it = sources.begin(); it != sources.end(); it++) {
+            if (it != sources.begin())
+                r += " or ";
+            if (it->mask_size == FamilyMaxMask(family))
+                r += peer + " host " + it->address.Str();
+            else
+                r += peer + " net " + it->Str();
+        }
+        r += ")";
+    }
+
+    // Build protocol part
+    switch (protocol) {
+    case IPPROTO_ICMP:
+        r += " and icmp";
+        break;
+    case IPPROTO_ICMPV6:
+        r += " and icmp6";
+        break;
+    case IPPROTO_TCP:
+        r += " and tcp";
+        break;
+    case IPPROTO_UDP:
+        r += " and udp";
+        break;
+    case -1:
+        // Allow all
+        break;
+    default:
+        // Note: this rule match first ipv6 header, not the potential next ones
+        r += std::string(family == Ip::V6 ? " and (ip6" : " and (ip") +
+             " proto " + std::to_string(protocol) + ")";
+    }
+
+    if (protocol == IPPROTO_TCP || protocol == IPPROTO_UDP) {
+        if (port_start == port_end) {
+            r += " dst port " + std::to_string(port_end);
+        } else {
+            r += " dst portrange " + std::to_string(port_start) +
+                 "-" + std::to_string(port_end);
+        }
+    }
+    return r;
+}
+
+bool FwBuildRule(const Rule &rule, std::vector<FwRule> *out) {
+    FwRule r;
+    r.direction = rule.direction;
+    r.protocol = rule.protocol;
+
+    // Build protocol part
+    if (rule.protocol == IPPROTO_TCP || rule.protocol == IPPROTO_UDP) {
+        if (rule.port_start < 0 || rule.port_end > 65535 ||
+            rule.port_start > rule.port_end) {
+            LOG_ERROR_("invalid port range");
+            return false;
+        }
+        r.port_start = rule.port_start;
+        r.port_end = rule.port_end;
+    }
+
+    // Build source
+    if (rule.security_group.length() == 0) {
+        r.family = rule.cidr.address.Type() == Ip::V6 ? Ip::V6 : Ip::V4;
+        if (rule.cidr.mask_size != 0)
+            r.sources.push_back(rule.cidr);
+        out->push_back(r);
+        return true;
+    }
+
+    auto sg = model.security_groups.find(rule.security_group);
+    if (sg == model.security_groups.end()) {
+        std::string m = "security group " + rule.security_group +
+                        " not available";
+        log.Error(m);
+        return false;
+    }
+    const std::vector<Ip> &members = sg->second.members;
+    if (members.size() == 0) {
+        std::string m = "no member in security group " + sg->second.id;
+        log.Warning(m);
+        return false;
+    }
+
+    // Split members by IP version
+    std::vector<Cidr> v4, v6;
+    for (auto ip = members.begin(); ip != members.end(); ip++) {
+        Cidr c;
+        c.address = *ip;
+        c.mask_size = FamilyMaxMask(ip->Type());
+        if (ip->Type() == Ip::V6)
+            v6.push_back(c);
+        else
+            v4.push_back(c);
+    }
+    r.family = Ip::V4;
+    FwPushSources(r, v4, out);
+    r.family = Ip::V6;
+    FwPushSources(r, v6, out);
+    return true;
+}
+
+void FwBuildSg(const Sg &sg, std::vector<FwRule> *out) {
+    for (auto it = sg.rules.begin(); it != sg.rules.end(); it++)
+        FwBuildRule(it->second, out);
+}
+
+void FwBuildNic(const Nic &nic, std::vector<FwRule> *out) {
+    for (auto it = nic.security_groups.begin();
+         it != nic.security_groups.end(); it++) {
+        auto sit = model.security_groups.find(*it);
+        if (sit == model.security_groups.end())
+            continue;
+        FwBuildSg(sit->second, out);
+    }
+}
+
+namespace {
+void FwOptimizeDirection(std::vector<FwRule> *rules,
+                         Rule::direction_t direction) {
+    std::map<FwGroupKey, FwGroup> groups;
+
+    // Group rules by (family, protocol, port range)
+    for (auto it = rules->begin(); it != rules->end(); it++) {
+        int port_start = FwHasPorts(it->protocol) ? it->port_start : 0;
+        int port_end = FwHasPorts(it->protocol) ? it->port_end : 0;
+        FwGroup &g = groups[FwGroupKey(it->family, it->protocol,
+                                       port_start, port_end)];
+        if (it->sources.size() == 0)
+            g.any = true;
+        for (auto s = it->sources.begin(); s != it->sources.end(); s++)
+            g.sources.push_back(PrefixFromCidr(*s));
+    }
+
+    // Merge prefixes of each group
+    for (auto it = groups.begin(); it != groups.end(); it++) {
+        if (it->second.any)
+            it->second.sources.clear();
+        else
+            PrefixMinimize(&it->second.sources);
+    }
+
+    // Remove sources already allowed by a wider rule
+    for (auto a = groups.begin(); a != groups.end(); a++) {
+        for (auto b = groups.begin(); b != groups.end(); b++) {
+            if (!FwGroupDominates(a->first, b->first))
+                continue;
+            FwGroup &ga = a->second;
+            FwGroup &gb = b->second;
+            if (ga.any) {
+                gb.any = false;
+                gb.sources.clear();
+                continue;
+            }
+            if (gb.any)
+                continue;
+            std::vector<Prefix> kept;
+            for (auto p = gb.sources.begin(); p != gb.sources.end(); p++) {
+                if (!PrefixListCovers(ga.sources, *p))
+                    kept.push_back(*p);
+            }
+            gb.sources.swap(kept);
+        }
+    }
+
+    // Merge port ranges of rules sharing the same sources
+    // (family, protocol, sources) -> list of port ranges
+    std::map<std::tuple<int, int, std::string>,
+             std::vector<std::pair<int, int>>> ranges;
+    std::map<std::tuple<int, int, std::string>, const FwGroup *> sources;
+    for (auto it = groups.begin(); it != groups.end(); it++) {
+        const FwGroup &g = it->second;
+        if (!g.any && g.sources.size() == 0)
+            continue;
+        std::string sign = g.any ? "any" : "";
+        for (auto p = g.sources.begin(); p != g.sources.end(); p++) {
+            sign.append(reinterpret_cast<const char *>(p->addr), 16);
+            sign.append(1, static_cast<char>(p->len));
+        }
+        auto k = std::make_tuple(std::get<0>(it->first),
+                                 std::get<1>(it->first), sign);
+        ranges[k].push_back(std::make_pair(std::get<2>(it->first),
+                                           std::get<3>(it->first)));
+        sources[k] = &g;
+    }
+
+    // Rebuild rules
+    rules->clear();
+    for (auto it = ranges.begin(); it != ranges.end(); it++) {
+        std::vector<std::pair<int, int>> &r = it->second;
+        std::sort(r.begin(), r.end());
+        std::vector<std::pair<int, int>> merged;
+        for (auto p = r.begin(); p != r.end(); p++) {
+            if (merged.size() > 0 && p->first <= merged.back().second + 1)
+                merged.back().second = std::max(merged.back().second,
+                                                p->second);
+            else
+                merged.push_back(*p);
+        }
+
+        FwRule model;
+        model.direction = direction;
+        model.family = static_cast<Ip::type_t>(std::get<0>(it->first));
+        model.protocol = std::get<1>(it->first);
+        const FwGroup &g = *sources[it->first];
+        std::vector<Cidr> cidrs;
+        for (auto p = g.sources.begin(); p != g.sources.end(); p++)
+            cidrs.push_back(PrefixToCidr(*p, model.family));
+        for (auto p = merged.begin(); p != merged.end(); p++) {
+            model.port_start = p->first;
+            model.port_end = p->second;
+            if (g.any)
+                rules->push_back(model);
+            else
+                FwPushSources(model, cidrs, rules);
+        }
+    }
+}
+}  // namespace
+
+void FwOptimize(std::vector<FwRule> *rules) {
+    std::vector<FwRule> in, out;
+
+    for (auto it = rules->begin(); it != rules->end(); it++) {
+        if (it->direction == Rule::OUTBOUND)
+            out.push_back(*it);
+        else
+            in.push_back(*it);
+    }
+    FwOptimizeDirection(&in, Rule::INBOUND);
+    FwOptimizeDirection(&out, Rule::OUTBOUND);
+    rules->swap(in);
+    rules->insert(rules->end(), out.begin(), out.end());
+}
+
+bool FwDiff(const std::vector<FwRule> &loaded,
+            const std::vector<FwRule> &rules, std::vector<FwRule> *added) {
+    std::set<std::string> old_filters;
+    std::set<std::string> new_filters;
+
+    for (auto it = loaded.begin(); it != loaded.end(); it++)
+        old_filters.insert(it->Filter());
+    for (auto it = rules.begin(); it != rules.end(); it++) {
+        std::string f = it->Filter();
+        if (!new_filters.insert(f).second)
+            continue;
+        if (old_filters.find(f) == old_filters.end())
+            added->push_back(*it);
+    }
+    for (auto it = old_filters.begin(); it != old_filters.end(); it++) {
+        if (new_filters.find(*it) == new_filters.end())
+            return true;
+    }
+    return false;
+}
+
+}  // namespace app
@@ -0,0 +1,102 @@
+/* Copyright 2017 Outscale SAS
+ *
+ * This file is part of Butterfly.
+ *
+ * Butterfly is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License version 3 as published
+ * by the Free Software Foundation.
+ *
+ * Butterfly is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with Butterfly.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef API_SERVER_FIREWALL_H_
+#define API_SERVER_FIREWALL_H_
+
+#include <string>
+#include <vector>
+#include "api/server/model.h"
+
+// Maximal number of sources packed in a single firewall rule.
+// Keeping each compiled filter small makes the overall compilation time
+// linear with the number of rules and members.
+#define FW_RULE_MAX_SOURCES 32
+
+namespace app {
+
+/* A firewall rule, as loaded in a NIC's firewall brick.
+ * Security group rules are converted to a list of FwRule by the rule builder
+ * and each FwRule is compiled on its own by the firewall.
+ * Inbound rules are loaded on the west side of the firewall, outbound rules
+ * on the east side.
+ */
+struct FwRule {
+    FwRule();
+    // Direction of the rule (INBOUND or OUTBOUND)
+    Rule::direction_t direction;
+    // IP version this rule applies to (V4 or V6)
+    Ip::type_t family;
+    // Allowed remote addresses: sources of inbound packets or destinations
+    // of outbound packets, an empty list allows any address of the family
+    std::vector<Cidr> sources;
+    // Protocol number, -1 for all protocols
+    int16_t protocol;
+    // Destination port range (TCP and UDP only)
+    uint16_t port_start;
+    uint16_t port_end;
+    bool operator== (const FwRule& a) const;
+    /* Build the filter expression to give to the firewall brick.
+     * @return  a short pcap filter matching this rule only
+     */
+    std::string Filter() const;
+};
+
+/* Convert a security group rule to firewall rules.
+ * A rule allowing members of a security group is split in several rules
+ * of at most FW_RULE_MAX_SOURCES members, per IP version.
+ * @param   rule rule model to convert
+ * @param   out list where to append firewall rules
+ * @return  false if the rule cannot be built, true otherwise
+ */
+bool FwBuildRule(const Rule &rule, std::vector<FwRule> *out);
+
+/* Convert all rules of a security group to firewall rules.
+ * @param   sg security group model to convert
+ * @param   out list where to append firewall rules
+ */
+void FwBuildSg(const Sg &sg, std::vector<FwRule> *out);
+
+/* Convert all security groups of a NIC to firewall rules.
+ * @param   nic NIC model
+ * @param   out list where to append firewall rules
+ */
+void FwBuildNic(const Nic &nic, std::vector<FwRule> *out);
+
+/* Reduce a list of firewall rules without changing what they allow.
+ * Rules of each direction are grouped by (IP version, protocol, port range),
+ * sources of each group are merged in a minimal set of prefixes, sources
+ * already allowed by a wider rule are removed and port ranges sharing the
+ * same sources are merged.
+ * @param   rules list of rules to optimize, replaced by the result
+ */
+void FwOptimize(std::vector<FwRule> *rules);
+
+/* Compare a list of loaded rules with a new list of rules.
+ * A rule is identified by its filter, which stays the same as long as the
+ * rule does not change.
+ * @param   loaded rules currently loaded in a firewall
+ * @param   rules new list of rules
+ * @param   added filled with rules of "rules" which are not loaded yet
+ * @return  true if some loaded rules are not in "rules" anymore
+ */
+bool FwDiff(const std::vector<FwRule> &loaded,
+            const std::vector<FwRule> &rules, std::vector<FwRule> *added);
+
+}  // namespace app
+
+#endif  // API_SERVER_FIREWALL_H_
@@ -22,7 +22,11 @@ extern "C" {
 #include <sys/sysinfo.h>
 #include <sys/syscall.h>
 #include <unistd.h>
+#include <rte_cycles.h>
+#include <rte_ether.h>
+#include <rte_mbuf.h>
 }
+#include <algorithm>
 #include <utility>
 #include <thread>
 #include <chrono>
@@ -56,12 +60,340 @@ void BuildMulticastIp6(uint8_t *multicast_ip, uint32_t vni) {
     multicast_ip[12] = reinterpret_cast<uint8_t *>(& vni)[3];
 }
 
+bool FwHasOutbound(const std::vector<app::FwRule> &rules) {
+    for (auto it = rules.begin(); it != rules.end(); it++) {
+        if (it->direction == app::Rule::OUTBOUND)
+            return true;
+    }
+    return false;
+}
+
+/**
+ * Build raw rules for the outgoing traffic of a NIC
+ * @param   has_outbound true if NIC has outbound rules
+ * @param   out_match filter matching NIC's IPs
+ * @return  filter to load on east side of NIC's firewall
+ */
+std::string FwOutRules(bool has_outbound, const std::string &out_match) {
+    std::string out_rules;
+
+    // Without outbound rules, allow any outgoing traffic from NIC's IPs
+    if (!has_outbound && out_match.length() > 0)
+        out_rules = out_match + " || ";
+
+    // Always allow DHCP to exit
+    out_rules += "(src host 0.0.0.0 and dst host 255.255.255.255 and "
+                 "udp src port 68 and udp dst port 67)";
+    return out_rules;
+}
+
+/**
+ * Get DSCP of an IP header
+ * @param   l3 start of IP header
+ * @param   ether_type ethernet type of the header (network order)
+ * @return  DSCP (0 to 63) of the header, -1 if it's not an IP header
+ */
+int IpDscp(const uint8_t *l3, uint16_t ether_type) {
+    if (ether_type == htons(ETHER_TYPE_IPv4))
+        return l3[1] >> 2;
+    if (ether_type == htons(ETHER_TYPE_IPv6))
+        return ((l3[0] & 0x0f) << 2) | (l3[1] >> 6);
+    return -1;
+}
+
+/**
+ * Update a checksum after a 16 bits word has changed (RFC 1624)
+ * @param   cksum checksum to update (network order)
+ * @param   old_word previous value of the word
+ * @param   new_word new value of the word
+ */
+void ChecksumUpdate(uint8_t *cksum, uint16_t old_word, uint16_t new_word) {
+    uint32_t sum = static_cast<uint16_t>(~((cksum[0] << 8) | cksum[1]));
+    sum += static_cast<uint16_t>(~old_word) + new_word;
+    sum = (sum & 0xffff) + (sum >> 16);
+    sum = (sum & 0xffff) + (sum >> 16);
+    cksum[0] = (~sum >> 8) & 0xff;
+    cksum[1] = ~sum & 0xff;
+}
+
+/**
+ * Lower MSS option of a TCP SYN packet
+ * @param   tcp start of TCP header
+ * @param   len length of available data from TCP header
+ * @param   mss maximal MSS
+ * @param   checksum update TCP checksum
+ * @return  true if MSS has been lowered, false otherwise
+ */
+bool TcpClampMss(uint8_t *tcp, uint16_t len, uint16_t mss, bool checksum) {
+    if (len < 20 || !(tcp[13] & 0x02))
+        return false;
+    uint16_t hdr_len = (tcp[12] >> 4) * 4;
+    if (hdr_len > len)
+        return false;
+
+    for (uint16_t o = 20; o < hdr_len;) {
+        uint8_t kind = tcp[o];
+        // End of option list or no-operation
+        if (kind == 0)
+            return false;
+        if (kind == 1) {
+            o++;
+            continue;
+        }
+        if (o + 1 >= hdr_len || tcp[o + 1] < 2 || o + tcp[o + 1] > hdr_len)
+            return false;
+        if (kind != 2 || tcp[o + 1] != 4) {
+            o += tcp[o + 1];
+            continue;
+        }
+        uint16_t old_mss = (tcp[o + 2] << 8) | tcp[o + 3];
+        if (old_mss <= mss)
+            return false;
+        tcp[o + 2] = mss >> 8;
+        tcp[o + 3] = mss & 0xff;
+        if (!checksum)
+            return true;
+        // A word at an odd offset is summed with its bytes swapped
+        if (o & 1)
+            ChecksumUpdate(tcp + 16, __builtin_bswap16(old_mss),
+                           __builtin_bswap16(mss));
+        else
+            ChecksumUpdate(tcp + 16, old_mss, mss);
+        return true;
+    }
+    return false;
+}
+
+/**
+ * Hash addresses and ports of an IP packet (FNV-1a)
+ * @param   l3 start of IP header
+ * @param   ether_type ethernet type of the header (network order)
+ * @param   len length of available data from IP header
+ * @param   l4 also hash TCP and UDP ports
+ * @return  hash of the flow, 0 if it's not an IP packet
+ */
+uint32_t FlowHash(const uint8_t *l3, uint16_t ether_type, uint16_t len,
+                  bool l4) {
+    const uint8_t *addr;
+    uint16_t addr_len;
+    uint16_t l3_len;
+    uint8_t proto;
+
+    if (ether_type == htons(ETHER_TYPE_IPv4) && len >= 20) {
+        addr = l3 + 12;
+        addr_len = 8;
+        l3_len = (l3[0] & 0x0f) * 4;
+        proto = l3[9];
+        // Only the first fragment has ports
+        if ((l3[6] & 0x1f) || l3[7])
+            l4 = false;
+    } else if (ether_type == htons(ETHER_TYPE_IPv6) && len >= 40) {
+        addr = l3 + 8;
+        addr_len = 32;
+        l3_len = 40;
+        proto = l3[6];
+    } else {
+        return 0;
+    }
+
+    uint32_t hash = 2166136261u;
+    for (uint16_t i = 0; i < addr_len; i++)
+        hash = (hash ^ addr[i]) * 16777619u;
+    hash = (hash ^ proto) * 16777619u;
+    if (l4 && (proto == IPPROTO_TCP || proto == IPPROTO_UDP) &&
+        len >= l3_len + 4) {
+        for (uint16_t i = 0; i < 4; i++)
+            hash = (hash ^ l3[l3_len + i]) * 16777619u;
+    }
+    // Mix high bits in low bits as hash is used with a modulo
+    return hash ^ (hash >> 16);
+}
+
+/**
+ * Check if a packet is sent to the VXLAN port
+ * @param   pkt packet received on the physical NIC
+ * @return  true if pkt is an IPv4 or IPv6 UDP packet to the VXLAN port
+ */
+bool IsVxlan(struct rte_mbuf *pkt) {
+    uint8_t *data = rte_pktmbuf_mtod(pkt, uint8_t *);
+    uint16_t len = rte_pktmbuf_data_len(pkt);
+    struct ether_hdr *eth = reinterpret_cast<struct ether_hdr *>(data);
+    uint8_t *l3 = data + sizeof(struct ether_hdr);
+    uint16_t l3_len;
+
+    if (len >= sizeof(struct ether_hdr) + 20 &&
+        eth->ether_type == htons(ETHER_TYPE_IPv4) && l3[9] == IPPROTO_UDP)
+        l3_len = (l3[0] & 0x0f) * 4;
+    else if (len >= sizeof(struct ether_hdr) + 40 &&
+             eth->ether_type == htons(ETHER_TYPE_IPv6) &&
+             l3[6] == IPPROTO_UDP)
+        l3_len = 40;
+    else
+        return false;
+    if (l3_len < 20 || len < sizeof(struct ether_hdr) + l3_len + 8)
+        return false;
+    uint8_t *udp = l3 + l3_len;
+    return ((udp[2] << 8) | udp[3]) == PG_VTEP_DST_PORT;
+}
+
+/**
+ * Check if a packet opens a TCP connection
+ * @param   pkt packet of a NIC branch
+ * @return  true if pkt is an IPv4 or IPv6 TCP SYN packet without ACK
+ */
+bool IsTcpSyn(struct rte_mbuf *pkt) {
+    uint8_t *data = rte_pktmbuf_mtod(pkt, uint8_t *);
+    uint16_t len = rte_pktmbuf_data_len(pkt);
+    struct ether_hdr *eth = reinterpret_cast<struct ether_hdr *>(data);
+    uint8_t *l3 = data + sizeof(struct ether_hdr);
+    uint16_t l3_len;
+
+    // Only the first fragment has a TCP header
+    if (len >= sizeof(struct ether_hdr) + 20 &&
+        eth->ether_type == htons(ETHER_TYPE_IPv4) && l3[9] == IPPROTO_TCP &&
+        !(l3[6] & 0x1f) && !l3[7])
+        l3_len = (l3[0] & 0x0f) * 4;
+    else if (len >= sizeof(struct ether_hdr) + 40 &&
+             eth->ether_type == htons(ETHER_TYPE_IPv6) &&
+             l3[6] == IPPROTO_TCP)
+        l3_len = 40;
+    else
+        return false;
+    if (l3_len < 20 || len < sizeof(struct ether_hdr) + l3_len + 14)
+        return false;
+    // SYN set, ACK not set
+    return (l3[l3_len + 13] & 0x12) == 0x02;
+}
+
+/**
+ * Hash a MAC address (FNV-1a) to find its share of VNI ingress limits
+ * @param   mac destination MAC address of a packet
+ * @return  share index, lower than GRAPH_VNI_POLICE_SHARES
+ */
+uint32_t ShareIndex(const struct ether_addr *mac) {
+    const uint8_t *addr = reinterpret_cast<const uint8_t *>(mac);
+    uint32_t hash = 2166136261u;
+    for (int i = 0; i < ETHER_ADDR_LEN; i++)
+        hash = (hash ^ addr[i]) * 16777619u;
+    return (hash ^ (hash >> 16)) % GRAPH_VNI_POLICE_SHARES;
+}
+
+/**
+ * Set source port of an UDP header
+ * @param   udp start of UDP header
+ * @param   port source port to set
+ * @param   checksum update UDP checksum, false if the NIC computes it
+ */
+void UdpSetSrcPort(uint8_t *udp, uint16_t port, bool checksum) {
+    uint16_t old_port = (udp[0] << 8) | udp[1];
+    udp[0] = port >> 8;
+    udp[1] = port & 0xff;
+    // An offloaded checksum only holds the pseudo header sum, which has no
+    // port. A null checksum is not computed (IPv4 only).
+    if (!checksum || (udp[6] == 0 && udp[7] == 0))
+        return;
+    ChecksumUpdate(udp + 6, old_port, port);
+    if (udp[6] == 0 && udp[7] == 0)
+        udp[6] = udp[7] = 0xff;
+}
+
+/**
+ * Set DSCP of an IP header, ECN bits are kept
+ * @param   l3 start of IP header
+ * @param   ether_type ethernet type of the header (network order)
+ * @param   dscp DSCP to set (0 to 63)
+ * @param   checksum update IPv4 header checksum
+ */
+void IpSetDscp(uint8_t *l3, uint16_t ether_type, int dscp, bool checksum) {
+    if (ether_type == htons(ETHER_TYPE_IPv4)) {
+        uint16_t old_word = (l3[0] << 8) | l3[1];
+        l3[1] = (dscp << 2) | (l3[1] & 0x03);
+        if (checksum)
+            ChecksumUpdate(l3 + 10, old_word, (l3[0] << 8) | l3[1]);
+    } else if (ether_type == htons(ETHER_TYPE_IPv6)) {
+        l3[0] = (l3[0] & 0xf0) | (dscp >> 2);
+        l3[1] = ((dscp & 0x03) << 6) | (l3[1] & 0x3f);
+    }
+}
+
+// Give a burst to a stream, if one is attached
+inline void StreamBurst(const std::atomic<app::Capture *> &stream,
+                        struct pg_brick *brick, enum pg_side from,
+                        uint16_t pkts_count, struct rte_mbuf **pkts,
+                        uint64_t *pkts_mask) {
+    app::Capture *capture = stream.load(std::memory_order_acquire);
+    if (capture != NULL)
+        app::Capture::Burst(brick, from, pkts_count, pkts, pkts_mask,
+                            capture);
+}
+
+// Difference of two counters, a drop counter deduced from them cannot be
+// negative
+inline uint64_t Behind(uint64_t upstream, uint64_t downstream) {
+    return upstream > downstream ? upstream - downstream : 0;
+}
+
+// Add drops of a brick to a list and to the total of their reason
+void AddDrops(std::vector<app::BrickDrops> *bricks,
+              std::vector<app::BrickDrops> *totals, const char *brick,
+              enum app::DropReason reason, uint64_t packets,
+              uint64_t bytes) {
+    app::BrickDrops d;
+    d.brick = brick;
+    d.reason = reason;
+    d.packets = packets;
+    d.bytes = bytes;
+    bricks->push_back(d);
+    (*totals)[reason].packets += packets;
+    (*totals)[reason].bytes += bytes;
+}
+
+// Index of the latency histogram bucket holding a number of TSC cycles
+inline uint32_t LatencyBucket(uint64_t cycles) {
+    if (cycles < (2ULL << LATENCY_SUB_BITS))
+        return cycles;
+    uint32_t shift = 63 - __builtin_clzll(cycles) - LATENCY_SUB_BITS;
+    uint32_t b = ((shift + 1) << LATENCY_SUB_BITS) +
+        ((cycles >> shift) & ((1 << LATENCY_SUB_BITS) - 1));
+    return std::min(b, LATENCY_BUCKETS - 1u);
+}
+
+// Highest number of TSC cycles held by a latency histogram bucket
+uint64_t LatencyBucketMax(uint32_t b) {
+    if (b < (2u << LATENCY_SUB_BITS))
+        return b;
+    uint32_t shift = (b >> LATENCY_SUB_BITS) - 1;
+    uint64_t first = static_cast<uint64_t>(
+        (1 << LATENCY_SUB_BITS) + (b & ((1 << LATENCY_SUB_BITS) - 1))) << shift;
+    return first + (1ULL << shift) - 1;
+}
+
+// TSC of a poll if its latency is sampled, 0 otherwise
+inline uint64_t PollTsc(uint32_t sampling, uint32_t *polls) {
+    if (sampling == 0 || ++*polls < sampling)
+        return 0;
+    *polls = 0;
+    return rte_rdtsc();
+}
+
 }  // namespace
 
+Graph::TxMarkState::TxMarkState() {
+    port_hash = TX_PORT_HASH_NONE;
+    port_min = 0;
+    port_count = 1;
+    stream = NULL;
+    clock = NULL;
+}
+
 Graph::Graph(void) {
     // Init rpc queue
     queue_ = g_async_queue_new();
     started = false;
+    isVtep6_ = false;
+    nic_mtu_ = 1500;
+    stream_count_ = 0;
+    removed_vni_rx_ = 0;
 }
 
 Graph::~Graph(void) {
@@ -71,7 +403,7 @@ Graph::~Graph(void) {
 bool Graph::LinkAndStalk(Graph::BrickShrPtr westBrick,
                          Graph::BrickShrPtr eastBrick,
                          Graph::BrickShrPtr sniffer) {
-    if (app::config.packet_trace) {
+    if (sniffer) {
         if (pg_brick_chained_links(&app::pg_error, westBrick.get(),
                                    sniffer.get(), eastBrick.get()) < 0) {
             PG_ERROR_(app::pg_error);
@@ -108,6 +440,9 @@ void Graph::Stop() {
     exit();
     pthread_join(poller_thread, NULL);
 
+    // Write remaining captured packets
+    capture_writer_.Stop();
+
     // Empty and unref queue
     a = (struct RpcQueue *)g_async_queue_try_pop(queue_);
     while (a != NULL) {
@@ -118,6 +453,7 @@ void Graph::Stop() {
 
     // Byby packetgraph
     vnis_.clear();
+    streams_.clear();
     pg_stop();
     app::DestroyCgroup();
     started = false;
@@ -169,13 +505,21 @@ bool Graph::Start(std::string dpdk_args) {
         pg_nic_get_mac(nic_.get(), &mac);
     }
     pg_nic_capabilities(nic_.get(), &useless, &nic_capa_tx);
-    if (app::config.no_offload ||
-        !(nic_capa_tx & PG_NIC_TX_OFFLOAD_OUTER_IPV4_CKSUM) ||
-        !(nic_capa_tx & PG_NIC_TX_OFFLOAD_TCP_TSO)) {
-        if (app::config.no_offload)
-            app::log.Info("offloading manually desactivated");
-        else
-            app::log.Info("no offloading available");
+    // Guests may only send large TCP packets if the NIC segments them once
+    // encapsulated. Packetgraph does not report tunnel TSO: outer checksum
+    // offload is the only hint the NIC handles VXLAN, even for IPv6 vteps.
+    // There is no software fallback: user bricks can only forward or drop
+    // packets, they cannot split or merge them.
+    if (app::config.no_offload) {
+        app::log.Info("offloading manually desactivated");
+        pg_vhost_global_disable(VIRTIO_NET_F_HOST_TSO4 |
+                                VIRTIO_NET_F_HOST_TSO6);
+    } else if (!(nic_capa_tx & PG_NIC_TX_OFFLOAD_TCP_TSO)) {
+        app::log.Info("no TSO offloading available");
+        pg_vhost_global_disable(VIRTIO_NET_F_HOST_TSO4 |
+                                VIRTIO_NET_F_HOST_TSO6);
+    } else if (!(nic_capa_tx & PG_NIC_TX_OFFLOAD_OUTER_IPV4_CKSUM)) {
+        app::log.Info("no outer IPv4 checksum offloading available");
         pg_vhost_global_disable(VIRTIO_NET_F_HOST_TSO4 |
                                 VIRTIO_NET_F_HOST_TSO6);
     } else {
@@ -183,18 +527,12 @@ bool Graph::Start(std::string dpdk_args) {
     }
 
     // Create sniffer brick
+    capture_writer_.Start(app::config.capture_endpoint);
     if (app::config.packet_trace) {
-        pcap_file_ = fopen(("/tmp/butterfly-" + std::to_string(getpid()) +
-                            "-main.pcap").c_str(), "w");
-        std::string sniffer_name = "main-sniffer-" + std::to_string(getpid());
-        sniffer_ = BrickShrPtr(pg_print_new(sniffer_name.c_str(), pcap_file_,
-                               PG_PRINT_FLAG_PCAP | PG_PRINT_FLAG_CLOSE_FILE,
-                               NULL, &app::pg_error),
-                    pg_brick_destroy);
-        if (sniffer_.get() == NULL) {
-            PG_ERROR_(app::pg_error);
+        sniffer_ = CaptureNew("main-sniffer-" + std::to_string(getpid()),
+                              PortTraceDefaultPath(), &capture_);
+        if (sniffer_.get() == NULL)
             return false;
-        }
     }
 
     // Create vtep brick
@@ -209,7 +547,23 @@ bool Graph::Start(std::string dpdk_args) {
         return false;
     }
 
-    LinkAndStalk(nic_, vtep_, sniffer_);
+    // Create tx mark brick marking packets sent on the physical NIC
+    SetConfigPortHash();
+    tx_mark_state_.clock = &poll_clock_;
+    tx_mark_ = BrickShrPtr(pg_user_dipole_new("tx-mark", TxMark,
+                                               &tx_mark_state_,
+                                               &app::pg_error),
+                            pg_brick_destroy);
+    if (tx_mark_.get() == NULL) {
+        PG_ERROR_(app::pg_error);
+        return false;
+    }
+
+    LinkAndStalk(nic_, tx_mark_, sniffer_);
+    if (pg_brick_link(tx_mark_.get(), vtep_.get(), &app::pg_error) < 0) {
+        PG_ERROR_(app::pg_error);
+        return false;
+    }
 
     // Run poller
     pthread_create(&poller_thread, NULL, Graph::Poller, this);
@@ -267,18 +621,65 @@ exit:
             app::log.Debug("cannot get physical nic mtu");
         } else {
             app::log.Debug("physical nic mtu is " + std::to_string(mtu));
+            nic_mtu_ = mtu;
         }
 }
 
+void Graph::SetConfigPortHash() {
+    struct TxMarkState &s = tx_mark_state_;
+    const std::string &mode = app::config.vxlan_port_hash;
+
+    if (mode == "l3") {
+        s.port_hash = TX_PORT_HASH_L3;
+    } else if (mode == "l4") {
+        s.port_hash = TX_PORT_HASH_L4;
+    } else {
+        if (mode != "none")
+            app::log.Error("bad vxlan-port-hash argument, using none");
+        s.port_hash = TX_PORT_HASH_NONE;
+        return;
+    }
+
+    int min = 49152;
+    int max = 65535;
+    const std::string &range = app::config.vxlan_port_range;
+    if (range.length() > 0) {
+        try {
+            size_t dash = range.find('-');
+            min = std::stoi(range.substr(0, dash));
+            max = dash == std::string::npos ? min :
+                std::stoi(range.substr(dash + 1));
+        } catch(...) {
+            min = -1;
+        }
+        if (min <= 0 || max > 65535 || min > max) {
+            app::log.Error("bad vxlan-port-range argument, using "
+                           "49152-65535");
+            min = 49152;
+            max = 65535;
+        }
+    }
+    s.port_min = min;
+    s.port_count = max - min + 1;
+    app::log.Info("VXLAN source port hashed with " + mode + " in " +
+                  std::to_string(min) + "-" + std::to_string(max));
+}
+
 #define POLLER_CHECK(c) (!((c) & 1023))
-#define FIREWALL_GC(c) ((c) == 100000)
+#define FIREWALL_GC_PERIOD 100000
+#define FIREWALL_GC(c, s) ((c) >= FIREWALL_GC_PERIOD / ((s) ? (s) : 1))
 void *Graph::Poller(void *graph) {
     Graph *g = reinterpret_cast<Graph *>(graph);
     struct RpcUpdatePoll *list = NULL;
     struct RpcQueue *q = NULL;
     uint16_t pkts_count;
     struct pg_brick *nic = g->nic_.get();
+    struct PollClock *clock = &g->poll_clock_;
+    uint32_t sampling = std::max(app::config.latency_sampling, 0);
+    uint32_t polls = 0;
     uint32_t size = 0;
+    uint32_t gc_next = 0;
+    int64_t now = 0;
 
     g_async_queue_ref(g->queue_);
 
@@ -303,21 +704,72 @@ void *Graph::Poller(void *graph) {
         }
 
         /* Poll all pollable vhosts. */
+        clock->nic = NULL;
+        clock->tsc = PollTsc(sampling, &polls);
         if (pg_brick_poll(nic, &pkts_count, &app::pg_error) < 0)
             PG_ERROR_(app::pg_error);
-        for (uint32_t v = 0; v < size; v++) {
+        if (size > 0 && list->limited > 0) {
+            now = g_get_monotonic_time();
+            /* Change the first polled NIC at each loop so NICs sharing
+             * a VNI limit get the same chance to be polled. NICs are
+             * sorted by priority, only rotate between NICs of the same
+             * priority. */
+            if (list->vni_size > 0) {
+                for (uint32_t i = 0; i < size; i += list->group_size[i]) {
+                    list->group_rotation[i] =
+                        (list->group_rotation[i] + 1) % list->group_size[i];
+                }
+            }
+        }
+        for (uint32_t i = 0; i < size; i++) {
+            uint32_t group = list->group_first[i];
+            uint32_t v = group + (i - group + list->group_rotation[group]) %
+                list->group_size[i];
+            struct PollLimit *l = list->limits[v];
+            struct PollLimit *vl = NULL;
+            bool limited = l->bps.load(std::memory_order_relaxed) > 0 ||
+                l->pps.load(std::memory_order_relaxed) > 0;
+            if (limited && !PollLimitAllow(l, now)) {
+                list->counters[v]->egress_throttled.Add(1);
+                continue;
+            }
+            if (list->vni_index[v] >= 0) {
+                uint32_t vni_index = list->vni_index[v];
+                vl = list->vni_limits[vni_index];
+                if (!PollLimitAllow(vl, now)) {
+                    list->vni_counters[vni_index]->egress_throttled.Add(1);
+                    continue;
+                }
+            }
+            clock->nic = list->counters[v];
+            clock->tsc = PollTsc(sampling, &polls);
             if (pg_brick_poll(list->pollables[v],
                               &pkts_count, &app::pg_error) < 0) {
                 PG_ERROR_(app::pg_error);
             }
+            if (limited || vl != NULL) {
+                uint64_t bytes = pg_brick_rx_bytes(list->pollables[v]);
+                uint64_t polled = bytes - list->rx_bytes[v];
+                list->rx_bytes[v] = bytes;
+                if (limited)
+                    PollLimitConsume(l, pkts_count, polled);
+                if (vl != NULL)
+                    PollLimitConsume(vl, pkts_count, polled);
+            }
         }
 
-        /* Call firewall garbage callector. */
-        if (FIREWALL_GC(cnt)) {
+        /* Call firewall garbage callector, one firewall at a time.
+         * Each firewall is still collected every FIREWALL_GC_PERIOD polls
+         * but a NIC with a large connection table won't stall the
+         * polling of all other NICs while every firewall is collected. */
+        if (FIREWALL_GC(cnt, size)) {
             cnt = 0;
-            for (uint32_t v = 0; v < size; v++)
-                pg_firewall_gc(list->firewalls[v]);
-            usleep(5);
+            if (gc_next >= size) {
+                gc_next = 0;
+                usleep(5);
+            }
+            if (size > 0)
+                pg_firewall_gc(list->firewalls[gc_next++]);
         }
     }
     g_async_queue_unref(g->queue_);
@@ -326,6 +778,475 @@ void *Graph::Poller(void *graph) {
 }
 #undef POLLER_CHECK
 #undef FIREWALL_GC
+#undef FIREWALL_GC_PERIOD
+
+bool Graph::PollLimitAllow(struct PollLimit *l, int64_t now) {
+    int64_t elapsed = now - l->date;
+
+    if (elapsed < 0)
+        elapsed = 0;
+    else if (elapsed > GRAPH_LIMIT_BURST_US)
+        elapsed = GRAPH_LIMIT_BURST_US;
+    l->date = now;
+    int64_t bps = l->bps.load(std::memory_order_relaxed);
+    int64_t pps = l->pps.load(std::memory_order_relaxed);
+    if (bps > 0)
+        l->bits = std::min(l->bits + bps * elapsed,
+                           bps * GRAPH_LIMIT_BURST_US);
+    if (pps > 0)
+        l->pkts = std::min(l->pkts + pps * elapsed,
+                           pps * GRAPH_LIMIT_BURST_US);
+    return (bps == 0 || l->bits > 0) && (pps == 0 || l->pkts > 0);
+}
+
+void Graph::PollLimitConsume(struct PollLimit *l, uint16_t pkts,
+                             uint64_t bytes) {
+    // Unlimited buckets are not refilled, so they must not be emptied
+    if (l->bps.load(std::memory_order_relaxed) > 0)
+        l->bits -= static_cast<int64_t>(bytes) * 8 * 1000000;
+    if (l->pps.load(std::memory_order_relaxed) > 0)
+        l->pkts -= static_cast<int64_t>(pkts) * 1000000;
+}
+
+bool Graph::PoliceAllow(struct PollLimit *l, uint32_t bytes) {
+    int64_t bps = l->bps.load(std::memory_order_relaxed);
+    int64_t pps = l->pps.load(std::memory_order_relaxed);
+    int64_t bits = static_cast<int64_t>(bytes) * 8 * 1000000;
+
+    if ((bps > 0 && l->bits < bits) || (pps > 0 && l->pkts < 1000000))
+        return false;
+    if (bps > 0)
+        l->bits -= bits;
+    if (pps > 0)
+        l->pkts -= 1000000;
+    return true;
+}
+
+bool Graph::ShareAllow(struct PoliceShare *s, const struct PollLimit *l,
+                       int64_t nics, uint32_t bytes, int64_t now) {
+    int64_t bps = l->bps.load(std::memory_order_relaxed) / nics;
+    int64_t pps = l->pps.load(std::memory_order_relaxed) / nics;
+    int64_t bits = static_cast<int64_t>(bytes) * 8 * 1000000;
+    int64_t elapsed = now - s->date;
+
+    if (elapsed < 0)
+        elapsed = 0;
+    else if (elapsed > GRAPH_LIMIT_BURST_US)
+        elapsed = GRAPH_LIMIT_BURST_US;
+    s->date = now;
+    if (bps > 0)
+        s->bits = std::min(s->bits + bps * elapsed,
+                           bps * GRAPH_LIMIT_BURST_US);
+    if (pps > 0)
+        s->pkts = std::min(s->pkts + pps * elapsed,
+                           pps * GRAPH_LIMIT_BURST_US);
+    if ((bps > 0 && s->bits < bits) || (pps > 0 && s->pkts < 1000000))
+        return false;
+    if (bps > 0)
+        s->bits -= bits;
+    if (pps > 0)
+        s->pkts -= 1000000;
+    return true;
+}
+
+void Graph::IngressPolice(struct pg_brick *brick, enum pg_side from,
+                          uint16_t pkts_count, struct rte_mbuf **pkts,
+                          uint64_t *pkts_mask, void *private_data) {
+    struct IngressPolicer *p =
+        static_cast<struct IngressPolicer *>(private_data);
+    struct PollLimit *l = &p->limit;
+
+    // Only police packets coming to the NIC (coming from the edge)
+    if (from != PG_WEST_SIDE)
+        return;
+    if (l->bps.load(std::memory_order_relaxed) > 0 ||
+        l->pps.load(std::memory_order_relaxed) > 0) {
+        PollLimitAllow(l, g_get_monotonic_time());
+        for (uint64_t mask = *pkts_mask; mask; mask &= mask - 1) {
+            int i = __builtin_ctzll(mask);
+            if (!PoliceAllow(l, rte_pktmbuf_pkt_len(pkts[i])))
+                *pkts_mask &= ~(1ULL << i);
+        }
+    }
+    p->counters->police_west.Add(__builtin_popcountll(*pkts_mask));
+}
+
+bool Graph::StormAllow(struct StormControl *s, int64_t now) {
+    int64_t pps = s->pps.load(std::memory_order_relaxed);
+    if (pps == 0)
+        return true;
+    int64_t elapsed = now - s->date;
+
+    if (elapsed < 0)
+        elapsed = 0;
+    else if (elapsed > GRAPH_STORM_BURST_US)
+        elapsed = GRAPH_STORM_BURST_US;
+    s->date = now;
+    s->pkts = std::min(s->pkts + pps * elapsed, pps * GRAPH_STORM_BURST_US);
+    if (s->pkts < 1000000)
+        return false;
+    s->pkts -= 1000000;
+    return true;
+}
+
+void Graph::StormFilter(struct pg_brick *brick, enum pg_side from,
+                        uint16_t pkts_count, struct rte_mbuf **pkts,
+                        uint64_t *pkts_mask, void *private_data) {
+    struct StormControl *s = static_cast<struct StormControl *>(private_data);
+    struct StormControl *vs = s->vni.get();
+    struct NicCounters *counters = s->counters.get();
+
+    // Only filter packets sent by the NIC (coming from antispoof)
+    if (from != PG_EAST_SIDE) {
+        counters->storm_west.Add(__builtin_popcountll(*pkts_mask));
+        return;
+    }
+    counters->storm_east_in.Add(__builtin_popcountll(*pkts_mask));
+    if (s->pps.load(std::memory_order_relaxed) == 0 &&
+        vs->pps.load(std::memory_order_relaxed) == 0) {
+        counters->storm_east_out.Add(__builtin_popcountll(*pkts_mask));
+        return;
+    }
+
+    int64_t now = g_get_monotonic_time();
+    for (uint64_t mask = *pkts_mask; mask; mask &= mask - 1) {
+        int i = __builtin_ctzll(mask);
+        struct ether_hdr *eth = rte_pktmbuf_mtod(pkts[i], struct ether_hdr *);
+        // Broadcast is a multicast address too
+        if (!is_multicast_ether_addr(&eth->d_addr))
+            continue;
+        if (!StormAllow(s, now)) {
+            s->dropped.fetch_add(1, std::memory_order_relaxed);
+        } else if (!StormAllow(vs, now)) {
+            vs->dropped.fetch_add(1, std::memory_order_relaxed);
+        } else {
+            continue;
+        }
+        *pkts_mask &= ~(1ULL << i);
+    }
+    counters->storm_east_out.Add(__builtin_popcountll(*pkts_mask));
+}
+
+bool Graph::ConnAllow(struct ConnLimit *l, int64_t now) {
+    int64_t pps = l->pps.load(std::memory_order_relaxed);
+    int64_t elapsed = now - l->date;
+
+    if (elapsed < 0)
+        elapsed = 0;
+    else if (elapsed > GRAPH_CONN_BURST_US)
+        elapsed = GRAPH_CONN_BURST_US;
+    l->date = now;
+    l->pkts = std::min(l->pkts + pps * elapsed, pps * GRAPH_CONN_BURST_US);
+    if (l->pkts < 1000000)
+        return false;
+    l->pkts -= 1000000;
+    return true;
+}
+
+void Graph::ConnFilter(struct pg_brick *brick, enum pg_side from,
+                       uint16_t pkts_count, struct rte_mbuf **pkts,
+                       uint64_t *pkts_mask, void *private_data) {
+    struct ConnSide *c = static_cast<struct ConnSide *>(private_data);
+    struct ConnLimit *l = c->limit.get();
+
+    // Packets coming from the firewall already went through the other
+    // connection limit brick
+    if (from != c->side)
+        return;
+    if (l->pps.load(std::memory_order_relaxed) > 0) {
+        int64_t now = g_get_monotonic_time();
+        for (uint64_t mask = *pkts_mask; mask; mask &= mask - 1) {
+            int i = __builtin_ctzll(mask);
+            if (IsTcpSyn(pkts[i]) && !ConnAllow(l, now))
+                *pkts_mask &= ~(1ULL << i);
+        }
+    }
+    c->counters->conn[from].Add(__builtin_popcountll(*pkts_mask));
+    struct RuleHits *r = c->rule_hits.load(std::memory_order_acquire);
+    if (r != NULL)
+        RuleHitsCount(r, pkts, *pkts_mask);
+}
+
+Graph::RuleHits::~RuleHits() {
+    for (auto it = filters.begin(); it != filters.end(); it++) {
+        for (auto f = it->begin(); f != it->end(); f++)
+            app::Capture::FreeFilter(*f);
+    }
+}
+
+Graph::ConnSide::~ConnSide() {
+    delete rule_hits.load();
+    for (auto it = retired.begin(); it != retired.end(); it++)
+        delete *it;
+}
+
+void Graph::RuleHitsCount(struct RuleHits *r, struct rte_mbuf **pkts,
+                          uint64_t pkts_mask) {
+    for (uint64_t mask = pkts_mask; mask; mask &= mask - 1) {
+        // Running each rule filter is too slow for all packets
+        if (++r->sample < GRAPH_RULE_HITS_SAMPLING)
+            continue;
+        r->sample = 0;
+        struct rte_mbuf *pkt = pkts[__builtin_ctzll(mask)];
+        // Filters only look at the first segment of the packet
+        bpf_args_t args;
+        memset(&args, 0, sizeof(args));
+        args.pkt = rte_pktmbuf_mtod(pkt, const uint8_t *);
+        args.wirelen = rte_pktmbuf_pkt_len(pkt);
+        args.buflen = rte_pktmbuf_data_len(pkt);
+        for (std::size_t i = 0; i < r->filters.size(); i++) {
+            for (auto f = r->filters[i].begin(); f != r->filters[i].end();
+                 f++) {
+                if ((*f)(NULL, &args)) {
+                    r->hits[i].Add(GRAPH_RULE_HITS_SAMPLING);
+                    break;
+                }
+            }
+        }
+    }
+}
+
+void Graph::TxMark(struct pg_brick *brick, enum pg_side from,
+                   uint16_t pkts_count, struct rte_mbuf **pkts,
+                   uint64_t *pkts_mask, void *private_data) {
+    struct TxMarkState *c = static_cast<struct TxMarkState *>(private_data);
+
+    // Only look at packets going to the physical NIC (coming from vtep),
+    // they are streamed once marked
+    if (from != PG_EAST_SIDE) {
+        uint64_t vxlan = 0;
+        for (uint64_t mask = *pkts_mask; mask; mask &= mask - 1)
+            vxlan += IsVxlan(pkts[__builtin_ctzll(mask)]);
+        c->vxlan_rx.Add(vxlan);
+        StreamBurst(c->stream, brick, from, pkts_count, pkts, pkts_mask);
+        return;
+    }
+
+    for (uint64_t mask = *pkts_mask; mask; mask &= mask - 1) {
+        struct rte_mbuf *pkt = pkts[__builtin_ctzll(mask)];
+        uint8_t *data = rte_pktmbuf_mtod(pkt, uint8_t *);
+        uint16_t len = rte_pktmbuf_data_len(pkt);
+        int dscp = 0;
+
+        // Outer ethernet, IP, UDP and VXLAN headers
+        struct ether_hdr *eth = reinterpret_cast<struct ether_hdr *>(data);
+        uint8_t *l3 = data + sizeof(struct ether_hdr);
+        uint16_t l3_len = 0;
+        if (len >= sizeof(struct ether_hdr) + 20 &&
+            eth->ether_type == htons(ETHER_TYPE_IPv4) && l3[9] == IPPROTO_UDP)
+            l3_len = (l3[0] & 0x0f) * 4;
+        else if (len >= sizeof(struct ether_hdr) + 40 &&
+                 eth->ether_type == htons(ETHER_TYPE_IPv6) &&
+                 l3[6] == IPPROTO_UDP)
+            l3_len = 40;
+        // Inner ethernet and IP headers
+        uint16_t inner = sizeof(struct ether_hdr) + l3_len + 8 + 8;
+        if (l3_len > 0 && len >= inner + sizeof(struct ether_hdr) + 2) {
+            struct ether_hdr *inner_eth =
+                reinterpret_cast<struct ether_hdr *>(data + inner);
+            uint8_t *inner_l3 = data + inner + sizeof(struct ether_hdr);
+            dscp = IpDscp(inner_l3, inner_eth->ether_type);
+            if (dscp < 0)
+                dscp = 0;
+            else if (dscp != IpDscp(l3, eth->ether_type))
+                IpSetDscp(l3, eth->ether_type, dscp,
+                          !(pkt->ol_flags & PKT_TX_OUTER_IP_CKSUM));
+
+            // Outer UDP source port from inner flow
+            if (c->port_hash != TX_PORT_HASH_NONE) {
+                uint32_t hash = FlowHash(inner_l3, inner_eth->ether_type,
+                                         len - inner - sizeof(struct ether_hdr),
+                                         c->port_hash == TX_PORT_HASH_L4);
+                uint16_t offset = hash % c->port_count;
+                // L4 flags describe the inner packet with tunnel offload
+                bool checksum = (pkt->ol_flags & PKT_TX_TUNNEL_MASK) ||
+                    (pkt->ol_flags & PKT_TX_L4_MASK) != PKT_TX_UDP_CKSUM;
+                UdpSetSrcPort(l3 + l3_len, c->port_min + offset, checksum);
+                c->port_spread[offset * TX_PORT_SPREAD_NB /
+                               c->port_count].Add(1);
+            }
+        }
+
+        c->packets[dscp >> 3].Add(1);
+        c->bytes[dscp >> 3].Add(rte_pktmbuf_pkt_len(pkt));
+    }
+    StreamBurst(c->stream, brick, from, pkts_count, pkts, pkts_mask);
+    // Packets are now given to the physical NIC
+    if (c->clock->nic != NULL)
+        LatencyAdd(&c->clock->nic->egress_latency, c->clock, *pkts_mask);
+}
+
+inline void Graph::CountBurst(struct BranchCounters *c, enum pg_side from,
+                              struct rte_mbuf **pkts, uint64_t pkts_mask) {
+    uint64_t bytes = 0;
+
+    for (uint64_t mask = pkts_mask; mask; mask &= mask - 1)
+        bytes += rte_pktmbuf_pkt_len(pkts[__builtin_ctzll(mask)]);
+    c->packets[from].Add(__builtin_popcountll(pkts_mask));
+    c->bytes[from].Add(bytes);
+}
+
+inline void Graph::LatencyAdd(struct LatencyHistogram *h,
+                              const struct PollClock *clock,
+                              uint64_t pkts_mask) {
+    if (clock->tsc == 0)
+        return;
+    uint64_t cycles = rte_rdtsc() - clock->tsc;
+    h->buckets[LatencyBucket(cycles)].Add(__builtin_popcountll(pkts_mask));
+}
+
+void Graph::LatencyGetStats(const struct LatencyHistogram &h,
+                            app::LatencyStats *stats) {
+    uint64_t counts[LATENCY_BUCKETS];
+    uint64_t total = 0;
+
+    for (uint32_t b = 0; b < LATENCY_BUCKETS; b++) {
+        counts[b] = h.buckets[b].Get();
+        total += counts[b];
+    }
+    *stats = app::LatencyStats();
+    stats->samples = total;
+    if (total == 0)
+        return;
+
+    // A percentile is the highest latency of the bucket holding its rank
+    const uint64_t per_mille[] = {500, 990, 999};
+    uint64_t *results[] = {&stats->p50, &stats->p99, &stats->p999};
+    double ns_per_cycle = 1e9 / rte_get_tsc_hz();
+    uint64_t seen = 0;
+    uint32_t p = 0;
+    for (uint32_t b = 0; b < LATENCY_BUCKETS && p < 3; b++) {
+        seen += counts[b];
+        while (p < 3 && seen > 0 &&
+               seen >= (total * per_mille[p] + 999) / 1000) {
+            *results[p] = LatencyBucketMax(b) * ns_per_cycle;
+            p++;
+        }
+    }
+}
+
+void Graph::NicTap(struct pg_brick *brick, enum pg_side from,
+                   uint16_t pkts_count, struct rte_mbuf **pkts,
+                   uint64_t *pkts_mask, void *private_data) {
+    struct NicTapState *t = static_cast<struct NicTapState *>(private_data);
+
+    CountBurst(&t->counters->tap, from, pkts, *pkts_mask);
+    app::Recorder::Burst(brick, from, pkts_count, pkts, pkts_mask,
+                         t->recorder.get());
+    StreamBurst(t->stream, brick, from, pkts_count, pkts, pkts_mask);
+    // Packets going to the vhost are now given to the NIC
+    if (from == PG_WEST_SIDE)
+        LatencyAdd(&t->counters->ingress_latency, t->clock, *pkts_mask);
+}
+
+void Graph::Edge(struct pg_brick *brick, enum pg_side from,
+                 uint16_t pkts_count, struct rte_mbuf **pkts,
+                 uint64_t *pkts_mask, void *private_data) {
+    CountBurst(static_cast<struct BranchCounters *>(private_data), from,
+               pkts, *pkts_mask);
+}
+
+void Graph::VniEdge(struct pg_brick *brick, enum pg_side from,
+                    uint16_t pkts_count, struct rte_mbuf **pkts,
+                    uint64_t *pkts_mask, void *private_data) {
+    struct VniPolicer *p = static_cast<struct VniPolicer *>(private_data);
+    struct PollLimit *l = &p->limit;
+
+    // Count before policing, packets given to the VNI are not vtep drops
+    CountBurst(&p->counters->edge, from, pkts, *pkts_mask);
+    // Only police packets going to the VNI (coming from the vtep)
+    if (from != PG_WEST_SIDE ||
+        (l->bps.load(std::memory_order_relaxed) == 0 &&
+         l->pps.load(std::memory_order_relaxed) == 0))
+        return;
+
+    int64_t now = g_get_monotonic_time();
+    int64_t nics = std::max(p->nic_count.load(std::memory_order_relaxed),
+                            1u);
+    uint64_t dropped = 0;
+    PollLimitAllow(l, now);
+    for (uint64_t mask = *pkts_mask; mask; mask &= mask - 1) {
+        int i = __builtin_ctzll(mask);
+        struct ether_hdr *eth = rte_pktmbuf_mtod(pkts[i], struct ether_hdr *);
+        uint32_t len = rte_pktmbuf_pkt_len(pkts[i]);
+        // Packets within their NIC's share always pass but still use VNI
+        // tokens, other packets pass if the VNI has tokens left
+        // Broadcast and multicast packets have no share.
+        if (!is_multicast_ether_addr(&eth->d_addr) &&
+            ShareAllow(&p->shares[ShareIndex(&eth->d_addr)], l, nics, len,
+                       now)) {
+            PollLimitConsume(l, 1, len);
+        } else if (!PoliceAllow(l, len)) {
+            *pkts_mask &= ~(1ULL << i);
+            dropped++;
+        }
+    }
+    p->counters->ingress_policed.Add(dropped);
+}
+
+void Graph::MssClampInit(struct MssClamp *clamp, bool enable) {
+    int overhead = isVtep6_ ? GRAPH_VXLAN6_OVERHEAD : GRAPH_VXLAN4_OVERHEAD;
+    int mtu = nic_mtu_ - overhead;
+
+    // Don't go below the minimal MSS of IPv4 (RFC 879)
+    if (!enable || mtu < 60 + 536) {
+        clamp->mss4 = 0;
+        clamp->mss6 = 0;
+        return;
+    }
+    // Remove IP and TCP headers without options
+    clamp->mss4 = mtu - 40;
+    clamp->mss6 = mtu - 60;
+}
+
+void Graph::MssClampFilter(struct pg_brick *brick, enum pg_side from,
+                           uint16_t pkts_count, struct rte_mbuf **pkts,
+                           uint64_t *pkts_mask, void *private_data) {
+    struct MssClamp *m = static_cast<struct MssClamp *>(private_data);
+    uint16_t mss4 = m->mss4.load(std::memory_order_relaxed);
+    uint16_t mss6 = m->mss6.load(std::memory_order_relaxed);
+
+    if (mss4 == 0 && mss6 == 0)
+        return;
+
+    for (uint64_t mask = *pkts_mask; mask; mask &= mask - 1) {
+        struct rte_mbuf *pkt = pkts[__builtin_ctzll(mask)];
+        uint8_t *data = rte_pktmbuf_mtod(pkt, uint8_t *);
+        uint16_t len = rte_pktmbuf_data_len(pkt);
+        struct ether_hdr *eth = reinterpret_cast<struct ether_hdr *>(data);
+        uint8_t *l3 = data + sizeof(struct ether_hdr);
+        uint16_t l3_len;
+        uint16_t mss;
+
+        if (len < sizeof(struct ether_hdr) + 40)
+            continue;
+        len -= sizeof(struct ether_hdr);
+        if (eth->ether_type == htons(ETHER_TYPE_IPv4)) {
+            // Only look at the first fragment of TCP packets
+            if (l3[9] != IPPROTO_TCP || (l3[6] & 0x1f) || l3[7])
+                continue;
+            l3_len = (l3[0] & 0x0f) * 4;
+            // Skip malformed headers
+            if (l3_len < 20)
+                continue;
+            mss = mss4;
+        } else if (eth->ether_type == htons(ETHER_TYPE_IPv6)) {
+            if (l3[6] != IPPROTO_TCP)
+                continue;
+            l3_len = 40;
+            mss = mss6;
+        } else {
+            continue;
+        }
+        if (l3_len >= len)
+            continue;
+        // Checksum is computed later when checksum offloading is requested
+        bool checksum = (pkt->ol_flags & PKT_TX_L4_MASK) != PKT_TX_TCP_CKSUM &&
+            !(pkt->ol_flags & PKT_TX_TCP_SEG);
+        if (TcpClampMss(l3 + l3_len, len - l3_len, mss, checksum))
+            m->clamped.fetch_add(1, std::memory_order_relaxed);
+    }
+}
 
 int Graph::SetCpu(int core_id) {
     cpu_set_t cpu_set;
@@ -408,9 +1329,22 @@ bool Graph::PollerUpdate(struct RpcQueue **list) {
                 *list = tmp;
                 break;
             case FW_RELOAD:
-                if (pg_firewall_reload(a->fw_reload.firewall,
+                if (a->fw_reload.firewall != NULL &&
+                    pg_firewall_reload(a->fw_reload.firewall,
                                        &app::pg_error) < 0)
                     PG_ERROR_(app::pg_error);
+                if (!a->fw_reload.rule_hits_set)
+                    break;
+                // Replaced tables are freed by the API
+                for (int side = 0; side < PG_MAX_SIDE; side++) {
+                    struct ConnSide *c = a->fw_reload.conn_side[side];
+                    struct RuleHits *old =
+                        c->rule_hits.exchange(a->fw_reload.rule_hits[side]);
+                    if (old != NULL) {
+                        std::lock_guard<std::mutex> lock(c->retired_lock);
+                        c->retired.push_back(old);
+                    }
+                }
                 break;
             case FW_NEW:
                 *(a->fw_new.result) = pg_firewall_new(a->fw_new.name,
@@ -450,6 +1384,30 @@ bool Graph::NicAdd(app::Nic *nic_) {
     if (it == vnis_.end()) {
         struct GraphVni v;
         v.vni = nic.vni;
+        v.egress_limit = std::make_shared<PollLimit>();
+        auto model_vni = app::model.vnis.find(nic.vni);
+        if (model_vni != app::model.vnis.end()) {
+            v.egress_limit->bps = model_vni->second.egress_bps_limit;
+            v.egress_limit->pps = model_vni->second.egress_pps_limit;
+        }
+        v.counters = std::make_shared<VniCounters>();
+        v.storm_control = std::make_shared<StormControl>();
+        v.policer = std::make_shared<VniPolicer>();
+        v.policer->counters = v.counters;
+        if (model_vni != app::model.vnis.end()) {
+            v.storm_control->pps = model_vni->second.bum_pps_limit;
+            v.policer->limit.bps = model_vni->second.ingress_bps_limit;
+            v.policer->limit.pps = model_vni->second.ingress_pps_limit;
+        }
+        name = "vni-" + std::to_string(nic.vni);
+        v.edge = BrickShrPtr(pg_user_dipole_new(name.c_str(), VniEdge,
+                                                v.policer.get(),
+                                                &app::pg_error),
+                             pg_brick_destroy);
+        if (!v.edge) {
+            PG_ERROR_(app::pg_error);
+            return false;
+        }
         std::pair<uint32_t, struct GraphVni> p(nic.vni, v);
         vnis_.insert(p);
         it = vnis_.find(nic.vni);
@@ -464,6 +1422,27 @@ bool Graph::NicAdd(app::Nic *nic_) {
 
     gn.enable = true;
     gn.id = nic.id;
+    gn.fw_loaded = false;
+    gn.rule_hits_changed = false;
+    for (int side = 0; side < PG_MAX_SIDE; side++)
+        gn.rule_hits_next[side] = NULL;
+    gn.egress_limit = std::make_shared<PollLimit>();
+    gn.egress_limit->bps = nic.egress_bps_limit;
+    gn.egress_limit->pps = nic.egress_pps_limit;
+    gn.priority = nic.priority;
+    gn.counters = std::make_shared<NicCounters>();
+    gn.policer = std::make_shared<IngressPolicer>();
+    gn.policer->limit.bps = nic.ingress_bps_limit;
+    gn.policer->limit.pps = nic.ingress_pps_limit;
+    gn.policer->counters = gn.counters;
+    gn.conn_limit = std::make_shared<ConnLimit>();
+    gn.conn_limit->pps = nic.new_conn_pps_limit;
+    gn.storm_control = std::make_shared<StormControl>();
+    gn.storm_control->pps = nic.bum_pps_limit;
+    gn.storm_control->vni = vni.storm_control;
+    gn.storm_control->counters = gn.counters;
+    gn.mss_clamp = std::make_shared<MssClamp>();
+    MssClampInit(gn.mss_clamp.get(), nic.mss_clamp);
     name = "firewall-" + gn.id;
     fw_new(name.c_str(), 1, 1, PG_NO_CONN_WORKER, &tmp_fw);
     WaitEmptyQueue();
@@ -473,6 +1452,44 @@ bool Graph::NicAdd(app::Nic *nic_) {
     }
 
     gn.firewall = BrickShrPtr(tmp_fw, PgfakeDestroy);
+    name = "edge-" + gn.id;
+    gn.edge = BrickShrPtr(pg_user_dipole_new(name.c_str(), Edge,
+                                             &gn.counters->edge,
+                                             &app::pg_error),
+                          pg_brick_destroy);
+    if (!gn.edge) {
+        PG_ERROR_(app::pg_error);
+        return false;
+    }
+
+    name = "police-" + gn.id;
+    gn.police = BrickShrPtr(pg_user_dipole_new(name.c_str(), IngressPolice,
+                                               gn.policer.get(),
+                                               &app::pg_error),
+                            pg_brick_destroy);
+    if (!gn.police) {
+        PG_ERROR_(app::pg_error);
+        return false;
+    }
+
+    // Connections are limited before the firewall in both directions
+    for (int side = 0; side < PG_MAX_SIDE; side++) {
+        auto cs = std::make_shared<ConnSide>();
+        cs->limit = gn.conn_limit;
+        cs->side = static_cast<enum pg_side>(side);
+        cs->counters = gn.counters;
+        gn.conn_side[side] = cs;
+        name = (side == PG_WEST_SIDE ? "conn-in-" : "conn-out-") + gn.id;
+        gn.conn[side] = BrickShrPtr(pg_user_dipole_new(name.c_str(),
+                                                       ConnFilter, cs.get(),
+                                                       &app::pg_error),
+                                    pg_brick_destroy);
+        if (!gn.conn[side]) {
+            PG_ERROR_(app::pg_error);
+            return false;
+        }
+    }
+
     name = "antispoof-" + gn.id;
     struct ether_addr mac;
     nic.mac.Bytes(mac.ether_addr_octet);
@@ -484,6 +1501,42 @@ bool Graph::NicAdd(app::Nic *nic_) {
         return false;
     }
 
+    name = "storm-" + gn.id;
+    gn.storm = BrickShrPtr(pg_user_dipole_new(name.c_str(), StormFilter,
+                                              gn.storm_control.get(),
+                                              &app::pg_error),
+                           pg_brick_destroy);
+    if (!gn.storm) {
+        PG_ERROR_(app::pg_error);
+        return false;
+    }
+
+    name = "mss-" + gn.id;
+    gn.mss = BrickShrPtr(pg_user_dipole_new(name.c_str(), MssClampFilter,
+                                            gn.mss_clamp.get(),
+                                            &app::pg_error),
+                         pg_brick_destroy);
+    if (!gn.mss) {
+        PG_ERROR_(app::pg_error);
+        return false;
+    }
+
+    gn.tap = std::make_shared<NicTapState>();
+    gn.tap->counters = gn.counters;
+    gn.tap->clock = &poll_clock_;
+    gn.tap->recorder = std::make_shared<app::Recorder>(
+        std::max(app::config.record_size, 0),
+        std::max(app::config.record_snaplen, 0));
+    name = "recorder-" + gn.id;
+    gn.recorder = BrickShrPtr(pg_user_dipole_new(name.c_str(), NicTap,
+                                                 gn.tap.get(),
+                                                 &app::pg_error),
+                              pg_brick_destroy);
+    if (!gn.recorder) {
+        PG_ERROR_(app::pg_error);
+        return false;
+    }
+
     if (nic.ip_anti_spoof) {
         for (auto it = nic.ip_list.begin(); it != nic.ip_list.end(); it++) {
             uint32_t ip;
@@ -522,50 +1575,53 @@ bool Graph::NicAdd(app::Nic *nic_) {
     if (nic.packet_trace) {
         name = "sniffer-" + gn.id;
         gn.packet_trace_path = nic.packet_trace_path;
-        gn.pcap_file = fopen(gn.packet_trace_path.c_str(), "w");
-        gn.sniffer = BrickShrPtr(pg_print_new(name.c_str(), gn.pcap_file,
-                                 PG_PRINT_FLAG_PCAP |
-                                 PG_PRINT_FLAG_CLOSE_FILE,
-                                 NULL, &app::pg_error),
-                       pg_brick_destroy);
-        if (!gn.sniffer) {
-            PG_ERROR_(app::pg_error);
+        gn.sniffer = CaptureNew(name, gn.packet_trace_path, &gn.capture);
+        if (!gn.sniffer)
             return false;
-        }
+        CaptureConfig(gn.capture.get(), nic.packet_trace_filter,
+                      nic.packet_trace_snaplen, nic.packet_trace_sampling);
     }
 
-    // Build branch and set head
+    // Build branch and set head, the recorder is always just before the
+    // vhost (or the sniffer)
     if (nic.bypass_filtering) {
-        if (nic.packet_trace) {
-            gn.head = gn.sniffer;
-            if (pg_brick_link(gn.sniffer.get(), gn.vhost.get(),
-                              &app::pg_error) < 0) {
-                PG_ERROR_(app::pg_error);
-                return false;
-            }
-        } else {
-            gn.head = gn.vhost;
-        }
+        gn.head = gn.recorder;
     } else {
-        gn.head = gn.firewall;
-        if (pg_brick_link(gn.firewall.get(),
-                          gn.antispoof.get(), &app::pg_error) < 0) {
+        gn.head = gn.edge;
+        if (pg_brick_chained_links(&app::pg_error, gn.edge.get(),
+                                   gn.police.get(),
+                                   gn.conn[PG_WEST_SIDE].get(),
+                                   gn.firewall.get(),
+                                   gn.conn[PG_EAST_SIDE].get(),
+                                   gn.storm.get(), gn.mss.get(),
+                                   gn.antispoof.get(),
+                                   gn.recorder.get()) < 0) {
+            PG_ERROR_(app::pg_error);
+            return false;
+        }
+    }
+    if (nic.packet_trace) {
+        if (pg_brick_chained_links(&app::pg_error, gn.recorder.get(),
+                                   gn.sniffer.get(), gn.vhost.get()) < 0) {
             PG_ERROR_(app::pg_error);
             return false;
         }
-        LinkAndStalk(gn.antispoof, gn.vhost, gn.sniffer);
+    } else if (pg_brick_link(gn.recorder.get(), gn.vhost.get(),
+                             &app::pg_error) < 0) {
+        PG_ERROR_(app::pg_error);
+        return false;
     }
 
-    // Link branch to the vtep
+    // Link branch to the vtep, through the VNI's edge
     if (vni.nics.size() == 0) {
-        // Link directly vtep to branch's head
-        link(vtep_, gn.head);
-        add_vni(vtep_, gn.head, nic.vni);
+        // Link the VNI's edge to the vtep and branch's head to the edge
+        link(vtep_, vni.edge);
+        add_vni(vtep_, vni.edge, nic.vni);
+        link(vni.edge, gn.head);
     } else if (vni.nics.size() == 1) {
         // We have to insert a switch
-        // - unlink the first branch head from the graph
-        // - link a new switch to the vtep
-        // - add the vni on the vtep with the switch
+        // - unlink the first branch head from the VNI's edge
+        // - link a new switch to the VNI's edge
         // - link the first branch head to the switch
         // - link the second branch head to the switch
         name = "switch-" + std::to_string(nic.vni);
@@ -577,13 +1633,8 @@ bool Graph::NicAdd(app::Nic *nic_) {
         }
 
         BrickShrPtr head1 = vni.nics.begin()->second.head;
-        if (pg_brick_unlink_edge(vtep_.get(), head1.get(),
-                                 &app::pg_error) < 0) {
-            PG_ERROR_(app::pg_error);
-            return false;
-        }
-        link(vtep_, vni.sw);
-        add_vni(vtep_, vni.sw, nic.vni);
+        unlink_edge(vni.edge, head1);
+        link(vni.edge, vni.sw);
         link(vni.sw, head1);
         link(vni.sw, gn.head);
     } else {
@@ -594,6 +1645,7 @@ bool Graph::NicAdd(app::Nic *nic_) {
     // Add branch to the list of NICs
     std::pair<std::string, struct GraphNic> p(nic.id, gn);
     vni.nics.insert(p);
+    vni.policer->nic_count = vni.nics.size();
 
     // Update the list of pollable bricks
     update_poll();
@@ -663,21 +1715,21 @@ void Graph::NicDel(const app::Nic &nic) {
 
     // Disconnect branch from vtep or switch
     if (vni.nics.size() == 1) {
-        // We should only have a branch head directly connected to vtep
+        // We should only have a branch head connected to the VNI's edge,
+        // the edge is removed from the vtep with the VNI
         unlink(n.head);
+        unlink(vni.edge);
     } else if (vni.nics.size() == 2) {
         // We have do:
         // - unlink the switch which unlink all branch heads.
-        // - connect the other head to vtep
-        // - re-add other head to vni
+        // - connect the other head to the VNI's edge
         // - destroy the switch
         auto it = vni.nics.begin();
         if (it->second.id == nic.id)
             it++;
         struct GraphNic &other = it->second;
         unlink(vni.sw);
-        link(app::graph.vtep_, other.head);
-        add_vni(vtep_, other.head, nic.vni);
+        link(vni.edge, other.head);
         WaitEmptyQueue();
         vni.sw.reset();
     } else {
@@ -691,10 +1743,20 @@ void Graph::NicDel(const app::Nic &nic) {
     // Wait that queue is done before removing bricks
     WaitEmptyQueue();
     vni.nics.erase(nic_it);
+    vni.policer->nic_count = std::max(vni.nics.size(), size_t(1));
+
+    // Stream of the NIC ends with it
+    auto stream_it = streams_.find(nic.id);
+    if (stream_it != streams_.end()) {
+        stream_it->second->Close();
+        streams_.erase(stream_it);
+    }
 
-    // Remove empty vni
-    if (vni.nics.empty())
+    // Remove empty vni, keep what it received for vtep drops
+    if (vni.nics.empty()) {
+        removed_vni_rx_ += vni.counters->edge.packets[PG_WEST_SIDE].Get();
         vnis_.erase(vni.vni);
+    }
 }
 
 std::string Graph::NicExport(const app::Nic &nic) {
@@ -703,18 +1765,403 @@ std::string Graph::NicExport(const app::Nic &nic) {
         return "";
     }
 
-    // TODO(jerome.jutteau)
+    // The firewall brick gives no access to its connection table
     std::string data = "";
     return data;
 }
 
-void Graph::NicGetStats(const app::Nic &nic, uint64_t *in, uint64_t *out) {
-    *in = *out = 0;
+void Graph::NicGetStats(const app::Nic &nic, app::NicStats *stats) {
+    *stats = app::NicStats();
+    Graph::GraphNic *graph_nic = FindNic(nic);
+    if (graph_nic == NULL)
+        return;
+    NicCounterStats(*graph_nic, stats);
+}
+
+int64_t Graph::NicGetStatsBulk(const std::set<std::string> &ids,
+                               bool has_vni, uint32_t vni,
+                               std::map<std::string, app::NicStats> *stats) {
+    stats->clear();
+    int64_t date = g_get_monotonic_time();
+    auto vni_it = has_vni ? vnis_.find(vni) : vnis_.begin();
+    for (; vni_it != vnis_.end(); vni_it++) {
+        for (auto &n : vni_it->second.nics) {
+            if (!ids.empty() && ids.find(n.first) == ids.end())
+                continue;
+            app::NicStats &s = (*stats)[n.first];
+            NicCounterStats(n.second, &s);
+        }
+        if (has_vni)
+            break;
+    }
+    return date;
+}
+
+void Graph::NicCounterStats(const GraphNic &gn, app::NicStats *stats) {
+    struct NicCounters *c = gn.counters.get();
+    stats->egress_throttled = c->egress_throttled.Get();
+
+    // Read counters in the order packets go through the branch, so a packet
+    // moving while reading is never counted as dropped
+    uint64_t tap_east = c->tap.packets[PG_EAST_SIDE].Get();
+    uint64_t storm_east_in = c->storm_east_in.Get();
+    uint64_t storm_east_out = c->storm_east_out.Get();
+    uint64_t conn_east = c->conn[PG_EAST_SIDE].Get();
+    uint64_t edge_east = c->edge.packets[PG_EAST_SIDE].Get();
+    uint64_t edge_west = c->edge.packets[PG_WEST_SIDE].Get();
+    uint64_t edge_west_bytes = c->edge.bytes[PG_WEST_SIDE].Get();
+    uint64_t police_west = c->police_west.Get();
+    uint64_t conn_west = c->conn[PG_WEST_SIDE].Get();
+    uint64_t storm_west = c->storm_west.Get();
+    uint64_t tap_west = c->tap.packets[PG_WEST_SIDE].Get();
+    uint64_t tap_west_bytes = c->tap.bytes[PG_WEST_SIDE].Get();
+    stats->in = pg_brick_rx_bytes(gn.vhost.get());
+    stats->out = pg_brick_tx_bytes(gn.vhost.get());
+
+    stats->egress_packets = tap_east;
+    stats->egress_bytes = c->tap.bytes[PG_EAST_SIDE].Get();
+    // Bytes the vhost brick could not give to the guest
+    stats->ingress_vhost_dropped_bytes = Behind(tap_west_bytes, stats->out);
+    if (gn.head == gn.edge) {
+        stats->ingress_packets = edge_west;
+        stats->ingress_bytes = edge_west_bytes;
+        stats->egress_antispoof_dropped = Behind(tap_east, storm_east_in);
+        stats->egress_conn_rejected = Behind(storm_east_out, conn_east);
+        stats->egress_firewall_dropped = Behind(conn_east, edge_east);
+        stats->ingress_policed = Behind(edge_west, police_west);
+        stats->ingress_conn_rejected = Behind(police_west, conn_west);
+        stats->ingress_firewall_dropped = Behind(conn_west, storm_west);
+        stats->ingress_antispoof_dropped = Behind(storm_west, tap_west);
+    } else {
+        stats->ingress_packets = tap_west;
+        stats->ingress_bytes = tap_west_bytes;
+    }
+    stats->bum_dropped = gn.storm_control->dropped;
+    stats->mss_clamped = gn.mss_clamp->clamped;
+    if (gn.capture)
+        stats->trace_dropped = gn.capture->Dropped();
+    if (app::config.latency_sampling > 0) {
+        stats->has_latency = true;
+        LatencyGetStats(c->egress_latency, &stats->egress_latency);
+        LatencyGetStats(c->ingress_latency, &stats->ingress_latency);
+    }
+}
+
+bool Graph::NicRecordDump(const app::Nic &nic, const std::string &path,
+                          uint64_t *packets) {
+    Graph::GraphNic *graph_nic = FindNic(nic);
+    *packets = 0;
+    if (graph_nic == NULL)
+        return false;
+    return graph_nic->tap->recorder->Dump(path, packets);
+}
+
+void Graph::VniConfigEgressLimit(const app::Vni &vni) {
+    auto vni_it = vnis_.find(vni.vni);
+    // Limits will be applied when the first NIC of this VNI is created
+    if (vni_it == vnis_.end())
+        return;
+    vni_it->second.egress_limit->bps = vni.egress_bps_limit;
+    vni_it->second.egress_limit->pps = vni.egress_pps_limit;
+    app::log.Debug("egress limits of vni " + std::to_string(vni.vni) + ": " +
+                   std::to_string(vni.egress_bps_limit) + " bps, " +
+                   std::to_string(vni.egress_pps_limit) + " pps");
+    update_poll();
+}
+
+void Graph::VniConfigIngressLimit(const app::Vni &vni) {
+    auto vni_it = vnis_.find(vni.vni);
+    // Limits will be applied when the first NIC of this VNI is created
+    if (vni_it == vnis_.end())
+        return;
+    vni_it->second.policer->limit.bps = vni.ingress_bps_limit;
+    vni_it->second.policer->limit.pps = vni.ingress_pps_limit;
+    app::log.Debug("ingress limits of vni " + std::to_string(vni.vni) +
+                   ": " + std::to_string(vni.ingress_bps_limit) + " bps, " +
+                   std::to_string(vni.ingress_pps_limit) + " pps");
+}
+
+void Graph::VniGetStats(const app::Vni &vni, app::VniStats *stats) {
+    *stats = app::VniStats();
+    auto vni_it = vnis_.find(vni.vni);
+    if (vni_it == vnis_.end())
+        return;
+    stats->nic_count = vni_it->second.nics.size();
+    stats->egress_throttled = vni_it->second.counters->egress_throttled.Get();
+    stats->bum_dropped = vni_it->second.storm_control->dropped;
+    stats->ingress_policed = vni_it->second.counters->ingress_policed.Get();
+}
+
+void Graph::DropStats(std::vector<app::BrickDrops> *bricks,
+                      std::vector<app::BrickDrops> *totals) {
+    bricks->clear();
+    totals->clear();
+    for (int r = 0; r < app::DROP_REASON_NB; r++) {
+        app::BrickDrops t;
+        t.reason = static_cast<enum app::DropReason>(r);
+        totals->push_back(t);
+    }
+    if (!started)
+        return;
+
+    // VXLAN packets received on the physical NIC and given to no VNI,
+    // other packets (ARP, ICMP...) are for the vtep itself
+    uint64_t vxlan_rx = tx_mark_state_.vxlan_rx.Get();
+    uint64_t vni_rx = removed_vni_rx_;
+    for (auto &v : vnis_)
+        vni_rx += v.second.counters->edge.packets[PG_WEST_SIDE].Get();
+    AddDrops(bricks, totals, pg_brick_name(vtep_.get()), app::DROP_VTEP,
+             Behind(vxlan_rx, vni_rx), 0);
+
+    for (auto &v : vnis_) {
+        AddDrops(bricks, totals, pg_brick_name(v.second.edge.get()),
+                 app::DROP_POLICER,
+                 v.second.counters->ingress_policed.Get(), 0);
+        for (auto &n : v.second.nics) {
+            struct GraphNic &gn = n.second;
+            app::NicStats s;
+            NicCounterStats(gn, &s);
+            if (gn.head == gn.edge) {
+                struct NicCounters *c = gn.counters.get();
+                uint64_t storm_in = c->storm_east_in.Get();
+                uint64_t storm_out = c->storm_east_out.Get();
+                AddDrops(bricks, totals, pg_brick_name(gn.police.get()),
+                         app::DROP_POLICER, s.ingress_policed, 0);
+                AddDrops(bricks, totals,
+                         pg_brick_name(gn.conn[PG_WEST_SIDE].get()),
+                         app::DROP_CONN_LIMIT, s.ingress_conn_rejected, 0);
+                AddDrops(bricks, totals,
+                         pg_brick_name(gn.conn[PG_EAST_SIDE].get()),
+                         app::DROP_CONN_LIMIT, s.egress_conn_rejected, 0);
+                AddDrops(bricks, totals, pg_brick_name(gn.firewall.get()),
+                         app::DROP_FIREWALL, s.egress_firewall_dropped +
+                         s.ingress_firewall_dropped, 0);
+                AddDrops(bricks, totals, pg_brick_name(gn.antispoof.get()),
+                         app::DROP_ANTISPOOF, s.egress_antispoof_dropped +
+                         s.ingress_antispoof_dropped, 0);
+                AddDrops(bricks, totals, pg_brick_name(gn.storm.get()),
+                         app::DROP_STORM, Behind(storm_in, storm_out), 0);
+            }
+            AddDrops(bricks, totals, pg_brick_name(gn.vhost.get()),
+                     app::DROP_VHOST_FULL, 0, s.ingress_vhost_dropped_bytes);
+        }
+    }
+}
+
+void Graph::VniConfigStormLimit(const app::Vni &vni) {
+    auto vni_it = vnis_.find(vni.vni);
+    // Limit will be applied when the first NIC of this VNI is created
+    if (vni_it == vnis_.end())
+        return;
+    vni_it->second.storm_control->pps = vni.bum_pps_limit;
+    app::log.Debug("storm control of vni " + std::to_string(vni.vni) +
+                   ": " + std::to_string(vni.bum_pps_limit) + " pps");
+}
+
+void Graph::NicConfigEgressLimit(const app::Nic &nic) {
+    Graph::GraphNic *graph_nic = FindNic(nic);
+    if (graph_nic == NULL)
+        return;
+    graph_nic->egress_limit->bps = nic.egress_bps_limit;
+    graph_nic->egress_limit->pps = nic.egress_pps_limit;
+    app::log.Debug("egress limits of nic " + nic.id + ": " +
+                   std::to_string(nic.egress_bps_limit) + " bps, " +
+                   std::to_string(nic.egress_pps_limit) + " pps");
+    update_poll();
+}
+
+void Graph::NicConfigIngressLimit(const app::Nic &nic) {
+    Graph::GraphNic *graph_nic = FindNic(nic);
+    if (graph_nic == NULL)
+        return;
+    graph_nic->policer->limit.bps = nic.ingress_bps_limit;
+    graph_nic->policer->limit.pps = nic.ingress_pps_limit;
+    if ((nic.ingress_bps_limit > 0 || nic.ingress_pps_limit > 0) &&
+        nic.bypass_filtering)
+        LOG_WARNING_("%s: no ingress limits when bypass filtering is on",
+                     nic.id.c_str());
+    app::log.Debug("ingress limits of nic " + nic.id + ": " +
+                   std::to_string(nic.ingress_bps_limit) + " bps, " +
+                   std::to_string(nic.ingress_pps_limit) + " pps");
+}
+
+void Graph::NicConfigConnLimit(const app::Nic &nic) {
+    Graph::GraphNic *graph_nic = FindNic(nic);
+    if (graph_nic == NULL)
+        return;
+    graph_nic->conn_limit->pps = nic.new_conn_pps_limit;
+    if (nic.new_conn_pps_limit > 0 && nic.bypass_filtering)
+        LOG_WARNING_("%s: no connection limit when bypass filtering is on",
+                     nic.id.c_str());
+    app::log.Debug("new connections limit of nic " + nic.id + ": " +
+                   std::to_string(nic.new_conn_pps_limit) + " per second");
+}
+
+void Graph::NicConfigRuleHits(const app::Nic &nic) {
+    Graph::GraphNic *graph_nic = FindNic(nic);
+    if (graph_nic == NULL)
+        return;
+    if (nic.count_rule_hits && nic.bypass_filtering)
+        LOG_WARNING_("%s: rule hits not counted when bypass filtering is on",
+                     nic.id.c_str());
+    RuleHitsBuild(graph_nic, nic);
+    fw_reload(graph_nic, false);
+}
+
+void Graph::RuleHitsBuild(GraphNic *gn, const app::Nic &nic) {
+    struct RuleHits *tables[PG_MAX_SIDE] = {NULL, NULL};
+
+    RuleHitsCollect(gn);
+    if (nic.count_rule_hits && !nic.bypass_filtering) {
+        for (int side = 0; side < PG_MAX_SIDE; side++)
+            tables[side] = new RuleHits();
+        for (auto it = nic.security_groups.begin();
+             it != nic.security_groups.end(); it++) {
+            auto sit = app::model.security_groups.find(*it);
+            if (sit == app::model.security_groups.end())
+                continue;
+            const app::Sg &sg = sit->second;
+            for (auto r = sg.rules.begin(); r != sg.rules.end(); r++) {
+                // Outbound rules match packets sent by the NIC
+                struct RuleHits *t = tables[
+                    r->second.direction == app::Rule::OUTBOUND ?
+                    PG_EAST_SIDE : PG_WEST_SIDE];
+                std::vector<app::FwRule> fw_rules;
+                app::FwBuildRule(r->second, &fw_rules);
+                t->rules.push_back(RuleKey(sg.id, r->first));
+                t->filters.push_back(std::vector<bpfjit_func_t>());
+                for (auto f = fw_rules.begin(); f != fw_rules.end(); f++) {
+                    std::string error;
+                    bpfjit_func_t func =
+                        app::Capture::CompileFilter(f->Filter(), &error);
+                    if (func == NULL) {
+                        app::log.Error("cannot count hits of a rule of " +
+                                       sg.id + ": " + error);
+                        continue;
+                    }
+                    t->filters.back().push_back(func);
+                }
+            }
+        }
+        for (int side = 0; side < PG_MAX_SIDE; side++) {
+            struct RuleHits *t = tables[side];
+            t->hits.reset(new PollerCounter[t->rules.size()]);
+        }
+    }
+
+    // Tables built but not sent yet are replaced
+    for (int side = 0; side < PG_MAX_SIDE; side++) {
+        if (gn->rule_hits_changed)
+            delete gn->rule_hits_next[side];
+        gn->rule_hits_next[side] = tables[side];
+    }
+    gn->rule_hits_changed = true;
+}
+
+void Graph::RuleHitsCollect(GraphNic *gn) {
+    for (int side = 0; side < PG_MAX_SIDE; side++) {
+        struct ConnSide *c = gn->conn_side[side].get();
+        std::vector<RuleHits *> retired;
+        {
+            std::lock_guard<std::mutex> lock(c->retired_lock);
+            retired.swap(c->retired);
+        }
+        for (auto it = retired.begin(); it != retired.end(); it++) {
+            struct RuleHits *r = *it;
+            for (std::size_t i = 0; i < r->rules.size(); i++)
+                gn->rule_hits_base[r->rules[i]] += r->hits[i].Get();
+            delete r;
+        }
+    }
+}
+
+bool Graph::SgRuleHits(const std::string &sg,
+                       std::map<std::size_t, uint64_t> *hits) {
+    bool counted = false;
+
+    hits->clear();
+    for (auto vit = vnis_.begin(); vit != vnis_.end(); vit++) {
+        for (auto nit = vit->second.nics.begin();
+             nit != vit->second.nics.end(); nit++) {
+            GraphNic &gn = nit->second;
+            auto m = app::model.nics.find(gn.id);
+            if (m == app::model.nics.end() || !m->second.count_rule_hits ||
+                m->second.bypass_filtering)
+                continue;
+            const std::vector<std::string> &sgs = m->second.security_groups;
+            if (std::find(sgs.begin(), sgs.end(), sg) == sgs.end())
+                continue;
+            counted = true;
+            // Tables replaced by the poller are only freed by this thread
+            RuleHitsCollect(&gn);
+            for (auto b = gn.rule_hits_base.begin();
+                 b != gn.rule_hits_base.end(); b++) {
+                if (b->first.first == sg)
+                    (*hits)[b->first.second] += b->second;
+            }
+            for (int side = 0; side < PG_MAX_SIDE; side++) {
+                struct RuleHits *r = gn.conn_side[side]->rule_hits.load();
+                if (r == NULL)
+                    continue;
+                for (std::size_t i = 0; i < r->rules.size(); i++) {
+                    if (r->rules[i].first == sg)
+                        (*hits)[r->rules[i].second] += r->hits[i].Get();
+                }
+            }
+        }
+    }
+    return counted;
+}
+
+void Graph::NicConfigStormLimit(const app::Nic &nic) {
+    Graph::GraphNic *graph_nic = FindNic(nic);
+    if (graph_nic == NULL)
+        return;
+    graph_nic->storm_control->pps = nic.bum_pps_limit;
+    app::log.Debug("storm control of nic " + nic.id + ": " +
+                   std::to_string(nic.bum_pps_limit) + " pps");
+}
+
+void Graph::NicConfigMssClamp(const app::Nic &nic) {
+    Graph::GraphNic *graph_nic = FindNic(nic);
+    if (graph_nic == NULL)
+        return;
+    MssClampInit(graph_nic->mss_clamp.get(), nic.mss_clamp);
+    if (nic.mss_clamp && nic.bypass_filtering)
+        LOG_WARNING_("%s: no mss clamping when bypass filtering is on",
+                     nic.id.c_str());
+    app::log.Debug("mss clamping of nic " + nic.id + ": " +
+                   std::to_string(graph_nic->mss_clamp->mss4) + " (IPv4), " +
+                   std::to_string(graph_nic->mss_clamp->mss6) + " (IPv6)");
+}
+
+void Graph::NicConfigPriority(const app::Nic &nic) {
     Graph::GraphNic *graph_nic = FindNic(nic);
     if (graph_nic == NULL)
         return;
-    *in = pg_brick_rx_bytes(graph_nic->vhost.get());
-    *out = pg_brick_tx_bytes(graph_nic->vhost.get());
+    graph_nic->priority = nic.priority;
+    app::log.Debug("priority of nic " + nic.id + ": " +
+                   std::to_string(nic.priority));
+    update_poll();
+}
+
+void Graph::TxClassGetStats(std::vector<app::TxClassStats> *stats) {
+    stats->clear();
+    for (int c = 0; c < TX_CLASS_NB; c++) {
+        app::TxClassStats s;
+        s.dscp_class = c;
+        s.packets = tx_mark_state_.packets[c].Get();
+        s.bytes = tx_mark_state_.bytes[c].Get();
+        stats->push_back(s);
+    }
+}
+
+void Graph::TxPortSpreadGetStats(std::vector<uint64_t> *spread) {
+    spread->clear();
+    if (tx_mark_state_.port_hash == TX_PORT_HASH_NONE)
+        return;
+    for (int s = 0; s < TX_PORT_SPREAD_NB; s++)
+        spread->push_back(tx_mark_state_.port_spread[s].Get());
 }
 
 void Graph::NicConfigAntiSpoof(const app::Nic &nic, bool enable) {
@@ -738,21 +2185,117 @@ void Graph::NicConfigAntiSpoof(const app::Nic &nic, bool enable) {
     }
 }
 
-void Graph::LinkSniffer(const app::Nic &nic, Graph::BrickShrPtr n_sniffer) {
+Graph::BrickShrPtr Graph::CaptureNew(const std::string &name,
+                                     const std::string &path,
+                                     std::shared_ptr<app::Capture> *capture) {
+    std::shared_ptr<app::Capture> c = app::Capture::Open(path);
+    if (!c)
+        return BrickShrPtr();
+    BrickShrPtr brick(pg_user_dipole_new(name.c_str(), app::Capture::Burst,
+                                         c.get(), &app::pg_error),
+                      pg_brick_destroy);
+    if (!brick) {
+        PG_ERROR_(app::pg_error);
+        return brick;
+    }
+    capture_writer_.Add(c);
+    *capture = c;
+    return brick;
+}
+
+bool Graph::CaptureConfig(app::Capture *capture, const std::string &filter,
+                          uint32_t snaplen, uint32_t sampling) {
+    std::string error;
+
+    capture->SetSnaplen(snaplen);
+    capture->SetSampling(sampling);
+    if (!capture->SetFilter(filter, &error)) {
+        LOG_ERROR_("cannot set capture filter \"%s\": %s", filter.c_str(),
+                   error.c_str());
+        return false;
+    }
+    // Previous filter can be freed once the poller went through an update
+    WaitEmptyQueue();
+    capture->ReleaseFilter();
+    return true;
+}
+
+void Graph::NicConfigPacketTraceFilter(const app::Nic &nic) {
     Graph::GraphNic *g_nic = FindNic(nic);
+    if (g_nic == NULL || !g_nic->capture)
+        return;
+    CaptureConfig(g_nic->capture.get(), nic.packet_trace_filter,
+                  nic.packet_trace_snaplen, nic.packet_trace_sampling);
+}
 
-    if (nic.bypass_filtering) {
-        unlink(g_nic->vhost);
-        g_nic->head = n_sniffer;
-        link(n_sniffer, g_nic->vhost);
-        link(vtep_, g_nic->head);
-        add_vni(vtep_, g_nic->head, nic.vni);
+std::string Graph::PortTraceDefaultPath() {
+    return "/tmp/butterfly-" + std::to_string(getpid()) + "-main.pcap";
+}
+
+bool Graph::PortConfigTrace(const app::PortTrace &trace) {
+    std::string path = trace.path.empty() ? PortTraceDefaultPath() :
+        trace.path;
+    std::string error;
+    // Previous trace is released at the end, once the poller left it
+    std::shared_ptr<app::Capture> old_capture = capture_;
+    BrickShrPtr old_sniffer = sniffer_;
+
+    if (!trace.enable) {
+        if (!sniffer_)
+            return true;
+        unlink(sniffer_);
+        link(nic_, tx_mark_);
+        sniffer_.reset();
+        capture_.reset();
+    } else if (capture_ && capture_->Path() == path) {
+        if (!CaptureConfig(capture_.get(), trace.filter, trace.snaplen,
+                           trace.sampling))
+            return false;
+        capture_->SetDuration(trace.duration);
+        return true;
     } else {
-        unlink_edge(g_nic->antispoof, g_nic->vhost);
-        g_nic->head = n_sniffer;
-        link(g_nic->antispoof, n_sniffer);
-        link(n_sniffer, g_nic->vhost);
+        std::shared_ptr<app::Capture> n_capture;
+        BrickShrPtr n_sniffer = CaptureNew(
+            "main-sniffer-" + std::to_string(getpid()), path, &n_capture);
+        if (!n_sniffer)
+            return false;
+        if (!n_capture->SetFilter(trace.filter, &error)) {
+            LOG_ERROR_("cannot set capture filter \"%s\": %s",
+                       trace.filter.c_str(), error.c_str());
+            return false;
+        }
+        n_capture->SetSnaplen(trace.snaplen);
+        n_capture->SetSampling(trace.sampling);
+        n_capture->SetDuration(trace.duration);
+        if (sniffer_)
+            unlink(sniffer_);
+        else
+            unlink_edge(nic_, tx_mark_);
+        link(nic_, n_sniffer);
+        link(n_sniffer, tx_mark_);
+        sniffer_ = n_sniffer;
+        capture_ = n_capture;
     }
+    WaitEmptyQueue();
+    return true;
+}
+
+void Graph::PortTraceStatus(std::string *path, uint64_t *packets) {
+    path->clear();
+    *packets = 0;
+    if (!capture_)
+        return;
+    if (!capture_->Finished(g_get_real_time()))
+        *path = capture_->Path();
+    *packets = capture_->Captured();
+}
+
+void Graph::LinkSniffer(const app::Nic &nic, Graph::BrickShrPtr n_sniffer) {
+    Graph::GraphNic *g_nic = FindNic(nic);
+
+    unlink_edge(g_nic->recorder, g_nic->vhost);
+    link(g_nic->recorder, n_sniffer);
+    link(n_sniffer, g_nic->vhost);
 }
 
 void Graph::EnablePacketTrace(const app::Nic &nic) {
@@ -766,17 +2309,13 @@ void Graph::EnablePacketTrace(const app::Nic &nic) {
 
     if (g_nic->sniffer == NULL) {
         name = "sniffer-" + g_nic->id;
-        g_nic->pcap_file = fopen(nic.packet_trace_path.c_str(), "w");
-        g_nic->sniffer = BrickShrPtr(pg_print_new(name.c_str(),
-                                 g_nic->pcap_file, PG_PRINT_FLAG_PCAP |
-                                 PG_PRINT_FLAG_CLOSE_FILE,
-                                 NULL, &app::pg_error),
-                       pg_brick_destroy);
-        if (!g_nic->sniffer) {
-            PG_ERROR_(app::pg_error);
+        g_nic->sniffer = CaptureNew(name, nic.packet_trace_path,
+                                    &g_nic->capture);
+        if (!g_nic->sniffer)
             return;
-        }
     }
+    CaptureConfig(g_nic->capture.get(), nic.packet_trace_filter,
+                  nic.packet_trace_snaplen, nic.packet_trace_sampling);
     LinkSniffer(nic, g_nic->sniffer);
 }
 
@@ -793,16 +2332,8 @@ void Graph::DisablePacketTrace(const app::Nic &nic) {
         return;
     }
 
-    if (nic.bypass_filtering) {
-        unlink(g_nic->sniffer);
-        g_nic->head = g_nic->vhost;
-        link(vtep_, g_nic->head);
-        add_vni(vtep_, g_nic->head, nic.vni);
-    } else {
-        unlink(g_nic->sniffer);
-        g_nic->head = g_nic->antispoof;
-        link(g_nic->antispoof, g_nic->vhost);
-    }
+    unlink(g_nic->sniffer);
+    link(g_nic->recorder, g_nic->vhost);
 }
 
 void Graph::NicConfigPacketTrace(const app::Nic &nic, bool is_trace_set) {
@@ -816,7 +2347,7 @@ void Graph::NicConfigPacketTrace(const app::Nic &nic, bool is_trace_set) {
 void Graph::NicConfigPacketTracePath(const app::Nic &nic,
                                      std::string update_path) {
     Graph::GraphNic *g_nic = FindNic(nic);
-    FILE *n_pcap_file;
+    std::shared_ptr<app::Capture> n_capture;
     std::string name;
     if (nic.packet_trace_path == update_path) {
         app::log.Info("packet trace path %s is already exist",
@@ -826,125 +2357,101 @@ void Graph::NicConfigPacketTracePath(const app::Nic &nic,
 
     DisablePacketTrace(nic);
     name = "sniffer-" + g_nic->id;
-    n_pcap_file = fopen(update_path.c_str(), "w");
-    BrickShrPtr n_sniffer = BrickShrPtr(pg_print_new(name.c_str(),
-                                  n_pcap_file, PG_PRINT_FLAG_PCAP |
-                                  PG_PRINT_FLAG_CLOSE_FILE,
-                                  NULL, &app::pg_error), pg_brick_destroy);
-    if (!n_sniffer) {
-        PG_ERROR_(app::pg_error);
+    BrickShrPtr n_sniffer = CaptureNew(name, update_path, &n_capture);
+    if (!n_sniffer)
         return;
-    }
+    CaptureConfig(n_capture.get(), nic.packet_trace_filter,
+                  nic.packet_trace_snaplen, nic.packet_trace_sampling);
     LinkSniffer(nic, n_sniffer);
     update_poll();
+    // Old trace is closed once the poller does not use it anymore
+    WaitEmptyQueue();
+    g_nic->sniffer = n_sniffer;
+    g_nic->capture = n_capture;
+    g_nic->packet_trace_path = update_path;
 }
 
-std::string Graph::FwBuildRule(const app::Rule &rule) {
-    // Note that we only take into account inbound rules
-    if (rule.direction == app::Rule::OUTBOUND)
-        return "";
-
-    std::string r;
+std::atomic<app::Capture *> *Graph::StreamHook(const std::string &nic_id) {
+    if (nic_id.empty())
+        return &tx_mark_state_.stream;
+    auto nic = app::model.nics.find(nic_id);
+    if (nic == app::model.nics.end())
+        return NULL;
+    Graph::GraphNic *g_nic = FindNic(nic->second);
+    if (g_nic == NULL)
+        return NULL;
+    return &g_nic->tap->stream;
+}
 
-    // Build source
-    if (rule.security_group.length() == 0) {
-        if (rule.cidr.mask_size != 0) {
-            r += "src net " + rule.cidr.address.Str() +
-                 "/" +  std::to_string(rule.cidr.mask_size);
-        } else if (rule.cidr.address.Type() == app::Ip::V4) {
-            r += "ip";
-        } else {
-            r += "ip6";
-        }
-    } else {
-        auto sg = app::model.security_groups.find(rule.security_group);
-        if (sg == app::model.security_groups.end()) {
-            std::string m = "security group " + rule.security_group +
-                            " not available";
-            app::log.Error(m);
-            return "";
-        }
-        if (sg->second.members.size() > 0) {
-            r += " (";
-            for (auto ip = sg->second.members.begin();
-                 ip != sg->second.members.end();) {
-                r += " src host " + ip->Str();
-                if (++ip != sg->second.members.end())
-                    r += " or";
-            }
-            r += ")";
-        } else {
-            std::string m = "no member in security group " + sg->second.id;
-            app::log.Warning(m);
-            return "";
-        }
-    }
+bool Graph::StreamStart(const app::CaptureStream &stream,
+                        std::string *topic) {
+    std::atomic<app::Capture *> *hook = StreamHook(stream.nic_id);
+    std::string error;
+    if (hook == NULL || !capture_writer_.Streaming())
+        return false;
 
-    // Build protocol part
-    switch (rule.protocol) {
-    case IPPROTO_ICMP:
-        r += " and icmp";
-        break;
-    case IPPROTO_ICMPV6:
-        r += " and icmp6";
-        break;
-    case IPPROTO_TCP:
-        r += " and tcp";
-        break;
-    case IPPROTO_UDP:
-        r += " and udp";
-        break;
-    case -1:
-        // Allow all
-        break;
-    default:
-        // Note: this rule match first ipv6 header, not the potential next ones
-        std::string p = std::to_string(rule.protocol);
-        if (rule.cidr.address.Type() == app::Ip::V4) {
-            r += " and (ip proto " + p + ")";
-        } else {
-            r += " and (ip6 proto " + p + ")";
-        }
+    // Topics start with a unique number so no topic prefixes another one
+    std::string t = std::to_string(++stream_count_) + "/" +
+        (stream.nic_id.empty() ? "port" : stream.nic_id);
+    std::shared_ptr<app::Capture> c = app::Capture::Stream(t);
+    if (!c->SetFilter(stream.filter, &error)) {
+        LOG_ERROR_("cannot set capture filter \"%s\": %s",
+                   stream.filter.c_str(), error.c_str());
+        return false;
     }
-
-    if (rule.protocol == IPPROTO_TCP || rule.protocol == IPPROTO_UDP) {
-        if (rule.port_start < 65536 && rule.port_end < 65536) {
-            if (rule.port_start == rule.port_end) {
-                r += " dst port " + std::to_string(rule.port_end);
-            } else if (rule.port_start < rule.port_end) {
-                r += " dst portrange " + std::to_string(rule.port_start) +
-                     "-" + std::to_string(rule.port_end);
-            } else {
-                LOG_ERROR_("invalid port range");
-                return "";
-            }
-        } else {
-            LOG_ERROR_("invalid port range");
-            return "";
-        }
+    c->SetSnaplen(stream.snaplen);
+    c->SetSampling(stream.sampling);
+    c->SetRateLimit(stream.pps_limit);
+    c->SetDuration(stream.duration);
+    capture_writer_.Add(c);
+    hook->store(c.get(), std::memory_order_release);
+
+    // Previous stream ends once the poller does not use it anymore
+    auto it = streams_.find(stream.nic_id);
+    if (it != streams_.end()) {
+        WaitEmptyQueue();
+        it->second->Close();
     }
+    streams_[stream.nic_id] = c;
+    *topic = t;
+    return true;
+}
 
-    return r;
+bool Graph::StreamStop(const std::string &nic_id) {
+    auto it = streams_.find(nic_id);
+    if (it == streams_.end())
+        return false;
+    std::atomic<app::Capture *> *hook = StreamHook(nic_id);
+    if (hook != NULL)
+        hook->store(NULL, std::memory_order_release);
+    WaitEmptyQueue();
+    it->second->Close();
+    streams_.erase(it);
+    return true;
 }
 
-std::string Graph::FwBuildSg(const app::Sg &sg) {
-    std::string r;
-    for (auto it = sg.rules.begin(); it != sg.rules.end();) {
-        std::string fw_rule = FwBuildRule(it->second);
-        if (fw_rule.length() == 0) {
-            it++;
-            continue;
+bool Graph::FwLoadRules(BrickShrPtr fw,
+                        const std::vector<app::FwRule> &rules,
+                        const std::string &out_match, bool in_stateful) {
+    for (auto it = rules.begin(); it != rules.end(); it++) {
+        std::string r = it->Filter();
+        enum pg_side side = PG_WEST_SIDE;
+        int stateful = in_stateful ? 1 : 0;
+        if (it->direction == app::Rule::OUTBOUND) {
+            if (out_match.length() == 0)
+                continue;
+            r = "(" + out_match + ") and (" + r + ")";
+            side = PG_EAST_SIDE;
+            stateful = 1;
+        }
+        if (pg_firewall_rule_add(fw.get(), r.c_str(), side, stateful,
+                                 &app::pg_error) < 0) {
+            app::log.Debug(r);
+            PG_ERROR_(app::pg_error);
+            return false;
         }
-        r += "(" + fw_rule + ")";
-        if (++it != sg.rules.end())
-            r += "||";
-    }
-    // Special case when last rule is empty
-    if (r.back() == '|') {
-        r.pop_back();
-        r.pop_back();
     }
-    return r;
+    return true;
 }
 
 void Graph::FwUpdate(const app::Nic &nic) {
@@ -966,76 +2473,99 @@ void Graph::FwUpdate(const app::Nic &nic) {
     auto itnic = itvni->second.nics.find(nic.id);
     if (itnic == itvni->second.nics.end())
         return;
-    BrickShrPtr &fw = itnic->second.firewall;
-
-    // For each security groups, build rules inside a BIG one
-    std::string in_rules;
-    for (auto it = nic.security_groups.begin();
-          it != nic.security_groups.end();) {
-        auto sit = app::model.security_groups.find(*it);
-        if (sit == app::model.security_groups.end()) {
-            it++;
-            continue;
-        }
-        std::string sg_rules = FwBuildSg(sit->second);
-        if (sg_rules.length() == 0) {
-            it++;
-            continue;
-        }
+    struct GraphNic &gn = itnic->second;
+
+    // Rules or their members may have changed, new rule hits tables are
+    // sent with the firewall reload
+    if (nic.count_rule_hits)
+        RuleHitsBuild(&gn, nic);
+    FwUpdateRules(nic, &gn);
+    if (gn.rule_hits_changed)
+        fw_reload(&gn, false);
+}
 
-        in_rules += "(" + FwBuildSg(sit->second) + ")";
-        if (++it != nic.security_groups.end())
-            in_rules += "||";
-    }
-    // Special case when last rule is empty
-    if (in_rules.back() == '|') {
-        in_rules.pop_back();
-        in_rules.pop_back();
-    }
+void Graph::FwUpdateRules(const app::Nic &nic, GraphNic *graph_nic) {
+    struct GraphNic &gn = *graph_nic;
+    BrickShrPtr &fw = gn.firewall;
 
-    // Set rules for the outgoing traffic: allow NIC's IPs
-    std::string out_rules;
+    // Build rules of all security groups and merge them
+    std::vector<app::FwRule> rules;
+    app::FwBuildNic(nic, &rules);
+    std::size_t raw_size = rules.size();
+    app::FwOptimize(&rules);
+
+    // Outgoing traffic must come from NIC's IPs
+    std::string out_match;
     for (auto it = nic.ip_list.begin(); it != nic.ip_list.end();) {
-        out_rules += "(src host " + it->Str() + ")";
+        out_match += "(src host " + it->Str() + ")";
         if (++it != nic.ip_list.end())
-            out_rules += " || ";
+            out_match += " || ";
     }
 
-    // Allow DHCP to exit
-    // FIXME jerome.jutteau@outscale.com
-    // This will be removed with OUTBOUND direction support.
-    if (out_rules.length() > 0) {
-        out_rules += " || ";
+    std::string out_rules = FwOutRules(FwHasOutbound(rules), out_match);
+
+    // Only load new rules if no loaded rule has to be removed
+    std::vector<app::FwRule> added;
+    if (gn.fw_loaded && out_rules == gn.fw_out_rules &&
+        out_match == gn.fw_out_match &&
+        !app::FwDiff(gn.fw_rules, rules, &added)) {
+        if (added.size() == 0) {
+            app::log.Debug("rules of nic " + nic.id + " did not change");
+            return;
+        }
+        app::log.Debug("adding " + std::to_string(added.size()) +
+                       " rule(s) to nic " + nic.id + " without flush");
+        if (!FwLoadRules(fw, added, out_match, FwHasOutbound(gn.fw_rules))) {
+            std::string m = "cannot load rules for nic " + nic.id;
+            app::log.Error(m);
+            return;
+        }
+        gn.fw_rules = rules;
+        fw_reload(&gn, true);
+        return;
     }
-    out_rules += "(src host 0.0.0.0 and dst host 255.255.255.255 and "
-                 "udp src port 68 and udp dst port 67)";
 
-    // Push rules to the firewall
-    pg_firewall_rule_flush(fw.get());
     std::string m;
-    m = "rules (in) for nic " + nic.id + ": " + in_rules;
+    m = "rules for nic " + nic.id + ": " +
+        std::to_string(rules.size()) + " rule(s) (" +
+        std::to_string(raw_size) + " before optimization)";
     app::log.Debug(m);
-    m = "rules (out) for nic " + nic.id + ": " + out_rules;
+    FwLoad(nic, &gn, rules, out_rules, out_match);
+}
+
+void Graph::FwLoad(const app::Nic &nic, GraphNic *gn,
+                   const std::vector<app::FwRule> &rules,
+                   const std::string &out_rules,
+                   const std::string &out_match) {
+    BrickShrPtr &fw = gn->firewall;
+
+    // Push rules to the firewall
+    pg_firewall_rule_flush(fw.get());
+    gn->fw_rules.clear();
+    gn->fw_out_rules.clear();
+    gn->fw_out_match.clear();
+    gn->fw_loaded = false;
+    std::string m = "rules (out) for nic " + nic.id + ": " + out_rules;
     app::log.Debug(m);
-    if (in_rules.length() > 0 &&
-        (pg_firewall_rule_add(fw.get(), in_rules.c_str(), PG_WEST_SIDE,
-                              0, &app::pg_error) < 0)) {
-        std::string m = "cannot build rules (in) for nic " + nic.id;
+    if (!FwLoadRules(fw, rules, out_match, FwHasOutbound(rules))) {
+        m = "cannot build rules for nic " + nic.id;
         app::log.Error(m);
-        PG_ERROR_(app::pg_error);
         return;
     }
-    if (out_rules.length() > 0 &&
-        pg_firewall_rule_add(fw.get(), out_rules.c_str(), PG_EAST_SIDE,
+    if (pg_firewall_rule_add(fw.get(), out_rules.c_str(), PG_EAST_SIDE,
                              1,  &app::pg_error) < 0) {
-        std::string m = "cannot build rules (out) for nic " + nic.id;
+        m = "cannot build rules (out) for nic " + nic.id;
         app::log.Error(m);
         PG_ERROR_(app::pg_error);
         return;
     }
+    gn->fw_rules = rules;
+    gn->fw_out_rules = out_rules;
+    gn->fw_out_match = out_match;
+    gn->fw_loaded = true;
 
     // Reload firewall
-    fw_reload(fw);
+    fw_reload(gn, true);
 }
 
 void Graph::FwAddRule(const app::Nic &nic, const app::Rule &rule) {
@@ -1051,40 +2581,23 @@ void Graph::FwAddRule(const app::Nic &nic, const app::Rule &rule) {
         return;
     }
 
-    std::string r = FwBuildRule(rule);
-    if (r.length() == 0) {
+    std::vector<app::FwRule> rules;
+    if (!app::FwBuildRule(rule, &rules)) {
         m = "cannot build rule (add) for nic " + nic.id;
         app::log.Error(m);
-        PG_ERROR_(app::pg_error);
-        return;
-    }
-
-    m = "adding new rule to firewall of nic " + nic.id + ": " + r;
-    app::log.Debug(m);
-
-    // Get firewall brick
-    auto itvni = vnis_.find(nic.vni);
-    if (itvni == vnis_.end()) {
-        LOG_ERROR_("cannot find nic's firewall");
         return;
     }
-    auto itnic = itvni->second.nics.find(nic.id);
-    if (itnic == itvni->second.nics.end()) {
-        m = "nic " + nic.id + " not found";
-        app::log.Error(m);
+    if (rules.size() == 0)
         return;
-    }
-    BrickShrPtr &fw = itnic->second.firewall;
 
-    // Add rule & reload firewall
-    if (pg_firewall_rule_add(fw.get(), r.c_str(), PG_WEST_SIDE,
-                             0, &app::pg_error) < 0) {
-        m = "cannot load rule (add) for nic " + nic.id;
-        app::log.Error(m);
-        app::log.Debug(r);
-        return;
-    }
-    fw_reload(fw);
+    // The rule is already in the model: rebuild the optimized rule set so
+    // loaded rules stay comparable with the next update. Only rules which
+    // are not loaded yet are added, unless the new rule merges with loaded
+    // ones.
+    m = "adding " + std::to_string(rules.size()) +
+        " new rule(s) to firewall of nic " + nic.id;
+    app::log.Debug(m);
+    FwUpdate(nic);
 }
 
 std::string Graph::Dot() {
@@ -1133,10 +2646,17 @@ void Graph::unlink_edge(BrickShrPtr w, BrickShrPtr e) {
     g_async_queue_push(queue_, a);
 }
 
-void Graph::fw_reload(BrickShrPtr b) {
+void Graph::fw_reload(GraphNic *gn, bool firewall) {
     struct RpcQueue *a = g_new(struct RpcQueue, 1);
     a->action = FW_RELOAD;
-    a->fw_reload.firewall = b.get();
+    a->fw_reload.firewall = firewall ? gn->firewall.get() : NULL;
+    a->fw_reload.rule_hits_set = gn->rule_hits_changed;
+    for (int side = 0; side < PG_MAX_SIDE; side++) {
+        a->fw_reload.conn_side[side] = gn->conn_side[side].get();
+        a->fw_reload.rule_hits[side] = gn->rule_hits_next[side];
+        gn->rule_hits_next[side] = NULL;
+    }
+    gn->rule_hits_changed = false;
     g_async_queue_push(queue_, a);
 }
 
@@ -1185,31 +2705,79 @@ void Graph::update_poll() {
     // Create a table with all pollable bricks
     std::map<uint32_t, struct GraphVni>::iterator vni_it;
     std::map<std::string, struct GraphNic>::iterator nic_it;
+    std::vector<std::pair<struct GraphNic *, int32_t>> nics;
     struct RpcQueue *a = g_new(struct RpcQueue, 1);
     struct RpcUpdatePoll &p = a->update_poll;
 
     a->action = UPDATE_POLL;
     // Add physical NIC brick
     p.size = 0;
+    p.limited = 0;
+    p.vni_size = 0;
     // Add all vhost bricks
+    bool full = false;
     for (vni_it = vnis_.begin();
-            vni_it != vnis_.end();
+            vni_it != vnis_.end() && !full;
             vni_it++) {
+        struct GraphVni &vni = vni_it->second;
+        bool vni_limited = vni.egress_limit->bps > 0 ||
+                           vni.egress_limit->pps > 0;
+        int32_t vni_index = -1;
         for (nic_it = vni_it->second.nics.begin();
                 nic_it != vni_it->second.nics.end();
                 nic_it ++) {
-            if (p.size + 1 >= GRAPH_VHOST_MAX_SIZE) {
+            if (nics.size() + 1 >= GRAPH_VHOST_MAX_SIZE) {
                 LOG_ERROR_("Not enough pollable bricks slot available");
+                full = true;
                 break;
             }
             if (!nic_it->second.enable)
                 continue;
-            p.pollables[p.size] = nic_it->second.vhost.get();
-            p.firewalls[p.size] = nic_it->second.firewall.get();
-            p.size++;
+            // Add VNI limits shared by all NICs of the VNI with its first
+            // NIC, so there are never more VNI limits than pollables
+            if (vni_limited && vni_index < 0) {
+                vni_index = p.vni_size++;
+                p.vni_limits[vni_index] = vni.egress_limit.get();
+                p.vni_counters[vni_index] = vni.counters.get();
+            }
+            nics.push_back(std::make_pair(&nic_it->second, vni_index));
         }
     }
 
+    // Poll NICs with the highest priority first
+    std::stable_sort(nics.begin(), nics.end(),
+                     [](const std::pair<struct GraphNic *, int32_t> &a,
+                        const std::pair<struct GraphNic *, int32_t> &b) {
+                         return a.first->priority > b.first->priority;
+                     });
+    for (auto it = nics.begin(); it != nics.end(); it++) {
+        struct GraphNic &gn = *it->first;
+        int32_t vni_index = it->second;
+        p.pollables[p.size] = gn.vhost.get();
+        p.firewalls[p.size] = gn.firewall.get();
+        p.counters[p.size] = gn.counters.get();
+        p.limits[p.size] = gn.egress_limit.get();
+        p.vni_index[p.size] = vni_index;
+        p.rx_bytes[p.size] = pg_brick_rx_bytes(gn.vhost.get());
+        if (gn.egress_limit->bps > 0 || gn.egress_limit->pps > 0 ||
+            vni_index >= 0)
+            p.limited++;
+        // Start a new group when priority changes
+        if (p.size == 0 || gn.priority != (it - 1)->first->priority)
+            p.group_first[p.size] = p.size;
+        else
+            p.group_first[p.size] = p.group_first[p.size - 1];
+        p.size++;
+    }
+    for (uint32_t i = 0; i < p.size; i++) {
+        p.group_size[i] = 0;
+        p.group_rotation[i] = 0;
+    }
+    for (uint32_t i = 0; i < p.size; i++)
+        p.group_size[p.group_first[i]]++;
+    for (uint32_t i = 0; i < p.size; i++)
+        p.group_size[i] = p.group_size[p.group_first[i]];
+
     // Pass this new listing to packetgraph thread
     g_async_queue_push(queue_, a);
 }
@@ -21,14 +21,43 @@
 extern "C" {
 #include <glib.h>
 }
+#include <atomic>
 #include <mutex>
 #include <memory>
 #include <map>
+#include <set>
 #include <string>
+#include <utility>
 #include <vector>
 #include "api/server/app.h"
+#include "api/server/capture.h"
+#include "api/server/firewall.h"
 
 #define GRAPH_VHOST_MAX_SIZE 50
+// Maximal burst allowed by NIC rate limits, in microseconds of traffic
+#define GRAPH_LIMIT_BURST_US 10000
+// Number of guaranteed shares of VNI ingress limits, NICs use the share of
+// their MAC address hash
+#define GRAPH_VNI_POLICE_SHARES 64
+// Maximal burst allowed by broadcast and multicast storm control,
+// in microseconds of traffic
+#define GRAPH_STORM_BURST_US 1000000
+// Maximal burst of new TCP connections, in microseconds of connections
+#define GRAPH_CONN_BURST_US 1000000
+// Rule hits are counted on one packet out of N going to the firewall
+#define GRAPH_RULE_HITS_SAMPLING 16
+// Headers added by VXLAN encapsulation in an IPv4 or IPv6 vtep, counted in
+// the physical MTU (inner ethernet, VXLAN, UDP and outer IP headers)
+#define GRAPH_VXLAN4_OVERHEAD 50
+#define GRAPH_VXLAN6_OVERHEAD 70
+// Number of slices of the VXLAN source port range in spread statistics
+#define TX_PORT_SPREAD_NB 16
+// Latency histograms have one bucket per value below
+// 2 << LATENCY_SUB_BITS TSC cycles, then each power of two is split in
+// 1 << LATENCY_SUB_BITS buckets (error below 12.5%)
+#define LATENCY_SUB_BITS 3
+// Last bucket holds all latencies above 2^34 cycles (seconds)
+#define LATENCY_BUCKETS 256
 
 class Graph {
  public:
@@ -57,16 +86,127 @@ class Graph {
      */
     void NicDel(const app::Nic &nic);
     /** Get a snapshot containing the current firewall state attached to the NIC.
+     * Not implemented: the firewall brick cannot export its connections.
      * @param  id id of the NIC attached to the firewall.
-     * @return an opaque string containing firewall's state data.
+     * @return an empty string
      */
     std::string NicExport(const app::Nic &nic);
     /** Get NIC statistics.
-     * @param  id id of the NIC
-     * @param  in number of bytes who has been received by the NIC
-     * @param  out number of bytes who has been transmitted by the NIC
+     * @param  nic model of the NIC
+     * @param  stats statistics to fill
+     */
+    void NicGetStats(const app::Nic &nic, app::NicStats *stats);
+    /** Get statistics of several NICs in one pass over the graph.
+     * @param  ids NICs to read, all NICs if empty
+     * @param  has_vni only read NICs of vni if true
+     * @param  vni VNI of NICs to read
+     * @param  stats filled with NIC id -> statistics
+     * @return monotonic date of the read in microseconds
+     */
+    int64_t NicGetStatsBulk(const std::set<std::string> &ids, bool has_vni,
+                            uint32_t vni,
+                            std::map<std::string, app::NicStats> *stats);
+    /** Apply egress rate limits of a VNI.
+     * Limits are shared by all NICs of the VNI, on top of their own limits.
+     * @param  vni model of the VNI
+     */
+    void VniConfigEgressLimit(const app::Vni &vni);
+    /** Apply ingress rate limits of a VNI.
+     * Packets going to the VNI above its limits are dropped before reaching
+     * its NICs, each NIC being guaranteed an equal share of the limits.
+     * @param  vni model of the VNI
+     */
+    void VniConfigIngressLimit(const app::Vni &vni);
+    /** Get VNI statistics.
+     * @param  vni model of the VNI
+     * @param  stats statistics to fill
+     */
+    void VniGetStats(const app::Vni &vni, app::VniStats *stats);
+    /** Get packets dropped by the graph and why.
+     * Drops of packetgraph bricks are deduced from packets counted around
+     * them. Counters have a single writer, the poller thread, and are read
+     * here without locking: counters of one brick may be read in the middle
+     * of a burst, so a drop count can be briefly off by one burst but never
+     * negative (see Behind).
+     * @param  bricks filled with drops of each brick which can drop packets
+     * @param  totals filled with drops of all bricks for each reason
+     */
+    void DropStats(std::vector<app::BrickDrops> *bricks,
+                   std::vector<app::BrickDrops> *totals);
+    /** Apply egress rate limits of a NIC.
+     * Once a NIC has sent more than its limits, the poller stops polling it
+     * until enough time has passed.
+     * @param  nic model of the NIC
+     */
+    void NicConfigEgressLimit(const app::Nic &nic);
+    /** Apply ingress rate limits of a NIC.
+     * Packets coming to the NIC above its limits are dropped before its
+     * firewall. NICs bypassing filtering have no policer brick.
+     * @param  nic model of the NIC
+     */
+    void NicConfigIngressLimit(const app::Nic &nic);
+    /** Apply new TCP connections limit of a NIC.
+     * TCP SYN packets sent and received by the NIC above the limit are
+     * dropped before its firewall. NICs bypassing filtering are not limited.
+     * @param  nic model of the NIC
+     */
+    void NicConfigConnLimit(const app::Nic &nic);
+    /** Start or stop counting packets matching each rule of a NIC.
+     * Rules are counted before the firewall, with their own compiled
+     * filters. NICs bypassing filtering are not counted.
+     * @param  nic model of the NIC
+     */
+    void NicConfigRuleHits(const app::Nic &nic);
+    /** Get packets which matched each rule of a security group, on all
+     * NICs counting rule hits.
+     * @param  sg id of the security group
+     * @param  hits hash of the rule -> packets, filled
+     * @return false if no NIC using the security group counts rule hits
      */
-    void NicGetStats(const app::Nic &nic, uint64_t *in, uint64_t *out);
+    bool SgRuleHits(const std::string &sg,
+                    std::map<std::size_t, uint64_t> *hits);
+    /** Apply broadcast and multicast storm control limit of a NIC.
+     * Packets above the limit are dropped before reaching the firewall
+     * and the VNI switch.
+     * @param  nic model of the NIC
+     */
+    void NicConfigStormLimit(const app::Nic &nic);
+    /** Apply broadcast and multicast storm control limit of a VNI.
+     * The limit is shared by all NICs of the VNI, on top of their own limits.
+     * @param  vni model of the VNI
+     */
+    void VniConfigStormLimit(const app::Vni &vni);
+    /** Apply polling priority of a NIC.
+     * NICs are polled by decreasing priority so packets of high priority
+     * NICs are sent first on the physical NIC.
+     * @param  nic model of the NIC
+     */
+    void NicConfigPriority(const app::Nic &nic);
+    /** Enable or disable TCP MSS clamping of a NIC.
+     * MSS of TCP SYN packets sent and received by the NIC is lowered so
+     * encapsulated packets fit in the physical MTU.
+     * NICs bypassing filtering have no mss brick and are never clamped.
+     * @param  nic model of the NIC
+     */
+    void NicConfigMssClamp(const app::Nic &nic);
+    /** Write the last packets sent and received by a NIC in a pcap file.
+     * Packets are kept by the NIC's flight recorder, see config.record_size.
+     * @param  nic model of the NIC
+     * @param  path path of the pcap file to create
+     * @param  packets set to the number of packets written
+     * @return false if the file cannot be written, true otherwise
+     */
+    bool NicRecordDump(const app::Nic &nic, const std::string &path,
+                       uint64_t *packets);
+    /** Get statistics of traffic sent on the physical NIC per DSCP class.
+     * @param  stats where to put statistics, one per class
+     */
+    void TxClassGetStats(std::vector<app::TxClassStats> *stats);
+    /** Get number of packets sent per slice of VXLAN source port range.
+     * @param  spread where to put TX_PORT_SPREAD_NB counters, empty if
+     *         source port is not hashed by Butterfly
+     */
+    void TxPortSpreadGetStats(std::vector<uint64_t> *spread);
     /** Enable on disable IP antispoof on the NIC.
      * @param  id id of the NIC
      * @param  enable true to enable IP antispoof, false otherwise
@@ -90,11 +230,56 @@ class Graph {
      * @param  path path to store packet trace file (pcap file)
      */
     void NicConfigPacketTracePath(const app::Nic &nic, std::string path);
+    /** Apply packet trace filter, snaplen and sampling of a NIC to its
+     * current packet trace, if any
+     * @param  nic nic to update
+     */
+    void NicConfigPacketTraceFilter(const app::Nic &nic);
+    /** Insert, update or remove the packet trace of the physical NIC.
+     * The sniffer is linked between the physical NIC and the vtep through
+     * the poller's queue, like NIC packet traces, so the dataplane keeps
+     * running. Enabling the trace again with the same path only changes its
+     * filter, snaplen, sampling and duration.
+     * Once its duration expired, the sniffer stays linked but does not
+     * capture anything until it is removed or enabled again.
+     * @param  trace packet trace of the physical NIC
+     * @return false if the trace cannot be created, true otherwise
+     */
+    bool PortConfigTrace(const app::PortTrace &trace);
+    /** Get the packet trace of the physical NIC.
+     * @param  path set to the path of the pcap file, empty if the physical
+     *         NIC is not traced or if the trace duration expired
+     * @param  packets set to the number of traced packets
+     */
+    void PortTraceStatus(std::string *path, uint64_t *packets);
+    /** Check if packets can be streamed, see config.capture_endpoint.
+     * @return true if the capture stream socket is bound
+     */
+    bool StreamEnabled() const { return capture_writer_.Streaming(); }
+    /** Stream packets going through a NIC or the physical NIC.
+     * Packets are published on the capture stream socket until the stream
+     * duration expires or StreamStop is called. Streams are attached to
+     * bricks always present (NIC's flight recorder and tx mark), so the
+     * graph is not modified. A new stream on the same NIC replaces the
+     * previous one.
+     * @param  stream NIC, filter and limits of the stream
+     * @param  topic set to the topic of the stream
+     * @return false if streams are disabled or the NIC does not exist,
+     *         true otherwise
+     */
+    bool StreamStart(const app::CaptureStream &stream, std::string *topic);
+    /** Stop streaming packets of a NIC or of the physical NIC.
+     * @param  nic_id NIC id, empty for the physical NIC
+     * @return false if no stream is running on the NIC, true otherwise
+     */
+    bool StreamStop(const std::string &nic_id);
     /** Rebuild all firewall rules of a NIC
      * @param  nic model of the NIC
      */
     void FwUpdate(const app::Nic &nic);
     /** Add a single rule in the corresponding firewall of a NIC.
+     * The rule must already be in the NIC's security groups. Other loaded
+     * rules are kept unless the optimized rule set changed them.
      * @param  nic nic model
      * @param  rule model of the rule
      */
@@ -153,8 +338,15 @@ class Graph {
         };
     };
 
+    struct ConnSide;
+    struct RuleHits;
     struct RpcFwReload {
+        // Firewall to reload, NULL to only replace rule hits tables
         struct pg_brick *firewall;
+        // Set if rule hits tables of conn_side must be replaced
+        bool rule_hits_set;
+        struct ConnSide *conn_side[PG_MAX_SIDE];
+        struct RuleHits *rule_hits[PG_MAX_SIDE];
     };
 
     struct RpcFwNew {
@@ -169,11 +361,268 @@ class Graph {
         struct pg_brick *b;
     };
 
+    // Counter only updated by the poller thread, so it is never
+    // incremented with an atomic read-modify-write: readers may only get a
+    // slightly late value
+    struct PollerCounter {
+        PollerCounter() : value(0) {}
+        inline void Add(uint64_t n) {
+            value.store(value.load(std::memory_order_relaxed) + n,
+                        std::memory_order_relaxed);
+        }
+        inline uint64_t Get() const {
+            return value.load(std::memory_order_relaxed);
+        }
+        std::atomic<uint64_t> value;
+    };
+
+    // Packets and bytes going through a brick, per side they come from
+    struct BranchCounters {
+        PollerCounter packets[PG_MAX_SIDE];
+        PollerCounter bytes[PG_MAX_SIDE];
+    };
+
+    // Number of packets per latency in TSC cycles, see LatencyBucket
+    struct LatencyHistogram {
+        PollerCounter buckets[LATENCY_BUCKETS];
+    };
+
+    // Counters of a NIC, updated by the poller
+    // Drops of each brick are deduced from packets counted around it, see
+    // NicGetStats.
+    struct NicCounters {
+        PollerCounter egress_throttled;
+        // Packets entering and leaving the branch on the vtep side (before
+        // the policer), not counted when filtering is bypassed
+        struct BranchCounters edge;
+        // Packets coming to the NIC allowed by the ingress policer
+        PollerCounter police_west;
+        // Packets going to the firewall allowed by the new connections
+        // limit, per side they come from
+        PollerCounter conn[PG_MAX_SIDE];
+        // Packets allowed by the firewall, and packets allowed by antispoof
+        // before and after storm control
+        PollerCounter storm_west;
+        PollerCounter storm_east_in;
+        PollerCounter storm_east_out;
+        // Packets going to and coming from the vhost
+        struct BranchCounters tap;
+        // Latency of sampled packets sent by the NIC (until the physical
+        // NIC) and coming to the NIC (until the vhost)
+        struct LatencyHistogram egress_latency;
+        struct LatencyHistogram ingress_latency;
+    };
+
+    // Poll being processed, only used by the poller thread
+    // Bricks are called during the poll, so a packet's latency is the time
+    // elapsed since its poll.
+    struct PollClock {
+        PollClock() : tsc(0), nic(NULL) {}
+        // TSC of the poll, 0 if latency is not sampled on this poll
+        uint64_t tsc;
+        // Counters of the polled NIC, NULL for the physical NIC
+        struct NicCounters *nic;
+    };
+
+    // Token buckets limiting what the poller gets from a NIC or a VNI
+    // Limits are set by the API, tokens are only used by the poller thread
+    // and are kept when the list of polled NICs is updated.
+    struct PollLimit {
+        PollLimit() : bps(0), pps(0), bits(0), pkts(0), date(0) {}
+        // Limits per second, 0 for no limit
+        std::atomic<uint64_t> bps;
+        std::atomic<uint64_t> pps;
+        // Available tokens in millionths of bits and packets (so refilling
+        // during one microsecond adds exactly bps and pps), can be negative
+        int64_t bits;
+        int64_t pkts;
+        // Date of last refill in microseconds, 0 to start with full buckets
+        int64_t date;
+    };
+
+    // Token buckets dropping packets coming to a NIC above its ingress
+    // limits, see IngressPolice
+    struct IngressPolicer {
+        struct PollLimit limit;
+        std::shared_ptr<NicCounters> counters;
+    };
+
+    // Counters of a VNI, updated by the poller
+    struct VniCounters {
+        PollerCounter egress_throttled;
+        // Packets going from the vtep to the VNI and the other way
+        struct BranchCounters edge;
+        // Packets going to the VNI dropped by its ingress limits
+        PollerCounter ingress_policed;
+    };
+
+    // Token buckets of a share of VNI ingress limits, only used by the
+    // poller thread
+    struct PoliceShare {
+        PoliceShare() : bits(0), pkts(0), date(0) {}
+        int64_t bits;
+        int64_t pkts;
+        int64_t date;
+    };
+
+    // Ingress limits of a VNI, shared fairly by its NICs, see VniEdge
+    // Each NIC is guaranteed limits divided by the number of NICs, through
+    // the share of its MAC address, and can use what other NICs leave.
+    struct VniPolicer {
+        VniPolicer() : nic_count(1) {}
+        // Limits and tokens of the whole VNI
+        struct PollLimit limit;
+        // Number of NICs of the VNI, set by the API
+        std::atomic<uint32_t> nic_count;
+        struct PoliceShare shares[GRAPH_VNI_POLICE_SHARES];
+        std::shared_ptr<VniCounters> counters;
+    };
+
+    // Broadcast and multicast storm control of a NIC or a VNI
+    // Limit is set by the API, tokens are only used by the poller thread.
+    struct StormControl {
+        StormControl() : pps(0), pkts(0), date(0), dropped(0) {}
+        // Limit in packets per second, 0 for no limit
+        std::atomic<uint64_t> pps;
+        // Available tokens in millionths of packets
+        int64_t pkts;
+        // Date of last refill in microseconds
+        int64_t date;
+        // Number of packets dropped by this limit
+        std::atomic<uint64_t> dropped;
+        // Storm control of the NIC's VNI, not set for a VNI
+        std::shared_ptr<StormControl> vni;
+        // Counters of the NIC, not set for a VNI
+        std::shared_ptr<NicCounters> counters;
+    };
+
+    // New TCP connections limit of a NIC, shared by both directions
+    // Limit is set by the API, tokens are only used by the poller thread.
+    struct ConnLimit {
+        ConnLimit() : pps(0), pkts(0), date(0) {}
+        // Limit in connections per second, 0 for no limit
+        std::atomic<uint64_t> pps;
+        // Available tokens in millionths of connections
+        int64_t pkts;
+        // Date of last refill in microseconds
+        int64_t date;
+    };
+
+    // Identifies a rule of a NIC: security group id and hash of the rule
+    typedef std::pair<std::string, std::size_t> RuleKey;
+
+    // Rules of a NIC matched by packets of one direction, see RuleHitsBuild
+    // Tables are built by the API and replaced as a whole by the poller with
+    // the firewall reload, hits are only counted by the poller thread.
+    struct RuleHits {
+        RuleHits() : sample(0) {}
+        ~RuleHits();
+        std::vector<RuleKey> rules;
+        // Compiled filters of each rule, a rule matching several sources
+        // can have several filters
+        std::vector<std::vector<bpfjit_func_t>> filters;
+        // Estimated packets which matched each rule
+        std::unique_ptr<PollerCounter[]> hits;
+        // Packets seen since the last sampled packet
+        uint32_t sample;
+    };
+
+    // Side of the firewall a connection limit brick filters, see ConnFilter
+    struct ConnSide {
+        ConnSide() : rule_hits(NULL) {}
+        ~ConnSide();
+        std::shared_ptr<ConnLimit> limit;
+        // Side packets going to the firewall come from
+        enum pg_side side;
+        std::shared_ptr<NicCounters> counters;
+        // Rules counted on this side, NULL if rule hits are not counted
+        // Only replaced by the poller.
+        std::atomic<RuleHits *> rule_hits;
+        // Tables replaced by the poller, their counts are collected and
+        // they are freed by the API (see RuleHitsCollect)
+        std::mutex retired_lock;
+        std::vector<RuleHits *> retired;
+    };
+
+    // TCP MSS clamping of a NIC
+    // MSS are set by the API, 0 to disable clamping.
+    struct MssClamp {
+        MssClamp() : mss4(0), mss6(0), clamped(0) {}
+        // Maximal MSS of IPv4 and IPv6 TCP connections
+        std::atomic<uint16_t> mss4;
+        std::atomic<uint16_t> mss6;
+        // Number of clamped SYN packets
+        std::atomic<uint64_t> clamped;
+    };
+
+    // How outer UDP source port of VXLAN packets is chosen
+    enum TxPortHash {
+        // Keep port set by the vtep
+        TX_PORT_HASH_NONE,
+        // Hash of inner IP addresses and protocol
+        TX_PORT_HASH_L3,
+        // Hash of inner IP addresses, protocol and TCP or UDP ports
+        TX_PORT_HASH_L4,
+    };
+
+    // State of the tx mark brick, counters are updated by the poller
+    // Packets are not queued per class before the physical NIC: user bricks
+    // cannot hold packets, so classes are only served in order by polling
+    // high priority NICs first.
+    struct TxMarkState {
+        TxMarkState();
+        // Traffic sent on the physical NIC per DSCP class
+        PollerCounter packets[TX_CLASS_NB];
+        PollerCounter bytes[TX_CLASS_NB];
+        // Outer UDP source port hashing, set before the poller starts
+        enum TxPortHash port_hash;
+        uint16_t port_min;
+        uint32_t port_count;
+        // Packets per slice of the source port range
+        PollerCounter port_spread[TX_PORT_SPREAD_NB];
+        // Stream of the physical NIC, see StreamStart
+        std::atomic<app::Capture *> stream;
+        // VXLAN packets received on the physical NIC
+        PollerCounter vxlan_rx;
+        // Poll of the packets, to measure egress latency
+        struct PollClock *clock;
+    };
+
+    // State of the flight recorder brick of a NIC
+    struct NicTapState {
+        NicTapState() : clock(NULL), stream(NULL) {}
+        std::shared_ptr<app::Recorder> recorder;
+        std::shared_ptr<NicCounters> counters;
+        // Poll of the packets, to measure ingress latency
+        struct PollClock *clock;
+        // Stream of the NIC, see StreamStart
+        std::atomic<app::Capture *> stream;
+    };
+
     // This rpc message is kept by the poller
     struct RpcUpdatePoll {
         struct pg_brick *pollables[GRAPH_VHOST_MAX_SIZE];
         struct pg_brick *firewalls[GRAPH_VHOST_MAX_SIZE];
+        struct PollLimit *limits[GRAPH_VHOST_MAX_SIZE];
+        struct NicCounters *counters[GRAPH_VHOST_MAX_SIZE];
+        // Last value of the byte counter of limited pollables
+        uint64_t rx_bytes[GRAPH_VHOST_MAX_SIZE];
+        // Index of the VNI limit of each pollable, -1 if VNI is not limited
+        int32_t vni_index[GRAPH_VHOST_MAX_SIZE];
+        // Pollables are sorted by decreasing priority, each pollable has
+        // the index and the size of its group of same priority pollables
+        uint32_t group_first[GRAPH_VHOST_MAX_SIZE];
+        uint32_t group_size[GRAPH_VHOST_MAX_SIZE];
+        // Offset of the first polled pollable of a group, only set at the
+        // index of the group's first pollable
+        uint32_t group_rotation[GRAPH_VHOST_MAX_SIZE];
         uint32_t size;
+        // Number of pollables having limits (own or VNI's)
+        uint32_t limited;
+        // Limits shared by all pollables of a VNI
+        struct PollLimit *vni_limits[GRAPH_VHOST_MAX_SIZE];
+        struct VniCounters *vni_counters[GRAPH_VHOST_MAX_SIZE];
+        uint32_t vni_size;
     };
 
     struct RpcQueue {
@@ -197,7 +646,14 @@ class Graph {
     void unlink_edge(BrickShrPtr w, BrickShrPtr e);
     void add_vni(BrickShrPtr vtep, BrickShrPtr neighbor, uint32_t vni);
     void update_poll();
-    void fw_reload(BrickShrPtr b);
+    struct GraphNic;
+    /**
+     * Reload the firewall of a NIC and replace its rule hits tables built
+     * since the last reload, if any.
+     * @param   gn branch of the NIC
+     * @param   firewall false to only replace rule hits tables
+     */
+    void fw_reload(GraphNic *gn, bool firewall);
     void fw_new(const char *name,
                 uint32_t west_max,
                 uint32_t east_max,
@@ -226,20 +682,222 @@ class Graph {
      * @return  true if poller must continue polling, otherwhise exit.
      */
     inline bool PollerUpdate(struct RpcQueue **list);
-
     /**
-     * Build a rule string based on a rule model
-     * @param   a list of security groups to apply
-     * @return  return a pcap filter string of the rule
+     * Refill token buckets of a NIC.
+     * @param   l limits of the NIC
+     * @param   now current date in microseconds
+     * @return  true if the NIC can be polled, false otherwise
+     */
+    static inline bool PollLimitAllow(struct PollLimit *l, int64_t now);
+    /**
+     * Take what has been polled from the NIC's token buckets.
+     * @param   l limits of the NIC
+     * @param   pkts number of polled packets
+     * @param   bytes number of polled bytes
+     */
+    static inline void PollLimitConsume(struct PollLimit *l, uint16_t pkts,
+                                        uint64_t bytes);
+    /**
+     * Refill storm control tokens and take one packet.
+     * @param   s storm control of a NIC or a VNI
+     * @param   now current date in microseconds
+     * @return  true if the packet can pass, false otherwise
+     */
+    static inline bool StormAllow(struct StormControl *s, int64_t now);
+    /**
+     * Take one packet from token buckets refilled by PollLimitAllow.
+     * @param   l ingress limits of a NIC
+     * @param   bytes size of the packet
+     * @return  true if the packet can pass, false otherwise
+     */
+    static inline bool PoliceAllow(struct PollLimit *l, uint32_t bytes);
+    /**
+     * Refill a guaranteed share of VNI ingress limits and take one packet.
+     * @param   s share of the packet's destination
+     * @param   l ingress limits of the VNI
+     * @param   nics number of NICs sharing the limits
+     * @param   bytes size of the packet
+     * @param   now current date in microseconds
+     * @return  true if the packet fits in the share, false otherwise
+     */
+    static inline bool ShareAllow(struct PoliceShare *s,
+                                  const struct PollLimit *l, int64_t nics,
+                                  uint32_t bytes, int64_t now);
+    /**
+     * Policer brick callback, called by the poller thread for each burst.
+     * Drop packets coming to the NIC once its ingress limits have been
+     * reached, packets sent by the NIC are shaped by the poller instead.
+     * @param   brick policer brick of the NIC
+     * @param   from side packets are coming from
+     * @param   pkts_count number of packets in the burst
+     * @param   pkts packets of the burst
+     * @param   pkts_mask mask of packets to forward, updated
+     * @param   private_data policer of the NIC (struct IngressPolicer)
+     */
+    static void IngressPolice(struct pg_brick *brick, enum pg_side from,
+                              uint16_t pkts_count, struct rte_mbuf **pkts,
+                              uint64_t *pkts_mask, void *private_data);
+    /**
+     * Storm brick callback, called by the poller thread for each burst.
+     * Drop broadcast and multicast packets sent by the NIC once its own
+     * limit or its VNI limit has been reached.
+     * @param   brick storm brick of the NIC
+     * @param   from side packets are coming from
+     * @param   pkts_count number of packets in the burst
+     * @param   pkts packets of the burst
+     * @param   pkts_mask mask of packets to forward, updated
+     * @param   private_data storm control of the NIC (struct StormControl)
+     */
+    static void StormFilter(struct pg_brick *brick, enum pg_side from,
+                            uint16_t pkts_count, struct rte_mbuf **pkts,
+                            uint64_t *pkts_mask, void *private_data);
+    /**
+     * Refill new connections tokens and take one connection.
+     * @param   l new connections limit of a NIC
+     * @param   now current date in microseconds
+     * @return  true if the connection can be opened, false otherwise
+     */
+    static inline bool ConnAllow(struct ConnLimit *l, int64_t now);
+    /**
+     * Connection limit brick callback, called by the poller thread for each
+     * burst. Drop TCP SYN packets going to the firewall once the NIC's new
+     * connections limit has been reached, so they create no firewall state.
+     * Forwarded packets then count the hits of the NIC's rules, if enabled.
+     * @param   brick connection limit brick of the NIC, one on each side
+     *          of the firewall
+     * @param   from side packets are coming from
+     * @param   pkts_count number of packets in the burst
+     * @param   pkts packets of the burst
+     * @param   pkts_mask mask of packets to forward, updated
+     * @param   private_data side of the brick (struct ConnSide)
+     */
+    static void ConnFilter(struct pg_brick *brick, enum pg_side from,
+                           uint16_t pkts_count, struct rte_mbuf **pkts,
+                           uint64_t *pkts_mask, void *private_data);
+    /**
+     * Count rules matched by packets going to the firewall.
+     * Each rule is counted at most once per packet.
+     * @param   r rules of one side of a NIC
+     * @param   pkts packets of the burst
+     * @param   pkts_mask mask of packets going to the firewall
+     */
+    static inline void RuleHitsCount(struct RuleHits *r,
+                                     struct rte_mbuf **pkts,
+                                     uint64_t pkts_mask);
+    /**
+     * Compute maximal MSS from physical MTU and vtep overhead.
+     * @param   clamp MSS clamping of a NIC
+     * @param   enable false to disable clamping
+     */
+    void MssClampInit(struct MssClamp *clamp, bool enable);
+    /**
+     * MSS brick callback, called by the poller thread for each burst.
+     * Lower MSS option of TCP SYN packets in both directions.
+     * @param   brick MSS brick of the NIC
+     * @param   from side packets are coming from
+     * @param   pkts_count number of packets in the burst
+     * @param   pkts packets of the burst
+     * @param   pkts_mask mask of packets to forward
+     * @param   private_data MSS clamping of the NIC (struct MssClamp)
+     */
+    static void MssClampFilter(struct pg_brick *brick, enum pg_side from,
+                               uint16_t pkts_count, struct rte_mbuf **pkts,
+                               uint64_t *pkts_mask, void *private_data);
+    /**
+     * Tx mark brick callback, called by the poller thread for each burst.
+     * Copy DSCP of encapsulated packets to their outer IP header, set their
+     * outer UDP source port from the inner flow and count packets sent on
+     * the physical NIC per class.
+     * @param   brick tx mark brick
+     * @param   from side packets are coming from
+     * @param   pkts_count number of packets in the burst
+     * @param   pkts packets of the burst
+     * @param   pkts_mask mask of packets to forward
+     * @param   private_data state of the brick (struct TxMarkState)
+     */
+    static void TxMark(struct pg_brick *brick, enum pg_side from,
+                       uint16_t pkts_count, struct rte_mbuf **pkts,
+                       uint64_t *pkts_mask, void *private_data);
+    /* Set outer UDP source port hashing from config. */
+    void SetConfigPortHash();
+    /**
+     * Flight recorder brick callback, called by the poller thread for each
+     * burst.
+     * Record packets going through the brick in both directions and give
+     * them to the NIC's stream, if any.
+     * @param   brick recorder brick of the NIC
+     * @param   from side packets are coming from
+     * @param   pkts_count number of packets in the burst
+     * @param   pkts packets of the burst
+     * @param   pkts_mask mask of packets to forward
+     * @param   private_data state of the brick (struct NicTapState)
+     */
+    static void NicTap(struct pg_brick *brick, enum pg_side from,
+                       uint16_t pkts_count, struct rte_mbuf **pkts,
+                       uint64_t *pkts_mask, void *private_data);
+    /**
+     * Edge brick callback, called by the poller thread for each burst.
+     * Count packets entering and leaving a NIC branch, or a VNI, on the
+     * vtep side.
+     * @param   brick edge brick of the NIC or the VNI
+     * @param   from side packets are coming from
+     * @param   pkts_count number of packets in the burst
+     * @param   pkts packets of the burst
+     * @param   pkts_mask mask of packets to forward
+     * @param   private_data counters of the brick (struct BranchCounters)
+     */
+    static void Edge(struct pg_brick *brick, enum pg_side from,
+                     uint16_t pkts_count, struct rte_mbuf **pkts,
+                     uint64_t *pkts_mask, void *private_data);
+    /**
+     * VNI edge brick callback, called by the poller thread for each burst.
+     * Count packets like Edge, then drop packets going from the vtep to the
+     * VNI once the VNI's ingress limits have been reached.
+     * @param   brick edge brick of the VNI
+     * @param   from side packets are coming from
+     * @param   pkts_count number of packets in the burst
+     * @param   pkts packets of the burst
+     * @param   pkts_mask mask of packets to forward, updated
+     * @param   private_data policer of the VNI (struct VniPolicer)
+     */
+    static void VniEdge(struct pg_brick *brick, enum pg_side from,
+                        uint16_t pkts_count, struct rte_mbuf **pkts,
+                        uint64_t *pkts_mask, void *private_data);
+    // Count packets and bytes of a burst
+    static inline void CountBurst(struct BranchCounters *c,
+                                  enum pg_side from, struct rte_mbuf **pkts,
+                                  uint64_t pkts_mask);
+    /**
+     * Add the latency of a burst to a histogram, if its poll is sampled.
+     * @param   h histogram to update
+     * @param   clock poll of the burst
+     * @param   pkts_mask mask of packets of the burst
+     */
+    static inline void LatencyAdd(struct LatencyHistogram *h,
+                                  const struct PollClock *clock,
+                                  uint64_t pkts_mask);
+    /**
+     * Compute percentiles of a latency histogram.
+     * @param   h histogram to read
+     * @param   stats percentiles to fill
      */
-    std::string FwBuildRule(const app::Rule &rule);
+    static void LatencyGetStats(const struct LatencyHistogram &h,
+                                app::LatencyStats *stats);
 
     /**
-     * Build a big rule string based on a security group
-     * @param   a list of security groups to apply
-     * @return  return a pcap filter rule of the whole SG
+     * Load a list of rules in a firewall brick
+     * Inbound rules are loaded on west side, outbound rules are loaded as
+     * stateful rules on east side.
+     * @param   fw firewall brick
+     * @param   rules rules to load
+     * @param   out_match filter outgoing packets must also match to be
+     *          allowed by outbound rules, outbound rules are skipped if empty
+     * @param   in_stateful make inbound rules stateful, needed as soon as
+     *          outgoing traffic is filtered so replies can exit
+     * @return  true if all rules has been loaded, false otherwise
      */
-    std::string FwBuildSg(const app::Sg &sg);
+    bool FwLoadRules(BrickShrPtr fw, const std::vector<app::FwRule> &rules,
+                     const std::string &out_match, bool in_stateful);
 
     const char *NicPath(BrickShrPtr nic);
     /**
@@ -248,6 +906,28 @@ class Graph {
      */
     bool LinkAndStalk(BrickShrPtr westBrick, BrickShrPtr eastBrick,
                       BrickShrPtr sniffer);
+    // Default path of the physical NIC's packet trace
+    static std::string PortTraceDefaultPath();
+    /**
+     * Create a brick capturing packets going through it in a pcap file.
+     * Packets are written to the file by the capture writer thread.
+     * @param   name name of the brick
+     * @param   path path of the pcap file
+     * @param   capture set to the capture of the brick
+     * @return  the capture brick, NULL on error
+     */
+    BrickShrPtr CaptureNew(const std::string &name, const std::string &path,
+                           std::shared_ptr<app::Capture> *capture);
+    /**
+     * Change packets copied by a capture, while the poller may use it.
+     * @param   capture capture to configure
+     * @param   filter pcap filter of captured packets, empty for all
+     * @param   snaplen bytes kept from each packet, 0 for full packets
+     * @param   sampling capture one packet out of sampling packets
+     * @return  false if the filter cannot be used, true otherwise
+     */
+    bool CaptureConfig(app::Capture *capture, const std::string &filter,
+                       uint32_t snaplen, uint32_t sampling);
 
     /* VM branch. */
     struct GraphNic {
@@ -255,18 +935,65 @@ class Graph {
        std::string packet_trace_path;
        // head is a pointer to the first brick in the branch
        BrickShrPtr head;
+       BrickShrPtr edge;
+       BrickShrPtr police;
+       // Connection limit bricks before the firewall, per side they filter
+       BrickShrPtr conn[PG_MAX_SIDE];
+       // Every packet goes through NPF: its connection table tracks TCP
+       // state and timeouts, so verdicts cannot be cached in front of it.
        BrickShrPtr firewall;
+       BrickShrPtr storm;
+       BrickShrPtr mss;
        BrickShrPtr antispoof;
        BrickShrPtr vhost;
+       // Flight recorder and stream, must be released after its brick
+       std::shared_ptr<NicTapState> tap;
+       BrickShrPtr recorder;
+       // Packet trace, must be released after its brick
+       std::shared_ptr<app::Capture> capture;
        BrickShrPtr sniffer;
-       FILE *pcap_file;
        // If we should add this branch or not to our poll updates
        bool enable;
+       // Rules currently loaded in the firewall
+       std::vector<app::FwRule> fw_rules;
+       // Raw rules currently loaded for the outgoing traffic
+       std::string fw_out_rules;
+       // Filter matching NIC's IPs, combined with outbound rules
+       std::string fw_out_match;
+       // Set once fw_rules, fw_out_rules and fw_out_match describe what
+       // is loaded in the firewall
+       bool fw_loaded;
+       // Egress rate limits
+       std::shared_ptr<PollLimit> egress_limit;
+       // Ingress rate limits
+       std::shared_ptr<IngressPolicer> policer;
+       // New TCP connections limit
+       std::shared_ptr<ConnLimit> conn_limit;
+       std::shared_ptr<ConnSide> conn_side[PG_MAX_SIDE];
+       // Hits of rules counted by replaced rule hits tables
+       std::map<RuleKey, uint64_t> rule_hits_base;
+       // Rule hits tables to send with the next firewall reload
+       bool rule_hits_changed;
+       struct RuleHits *rule_hits_next[PG_MAX_SIDE];
+       // Polling priority
+       uint32_t priority;
+       std::shared_ptr<NicCounters> counters;
+       std::shared_ptr<StormControl> storm_control;
+       std::shared_ptr<MssClamp> mss_clamp;
     };
 
     /* VNI branch. */
     struct GraphVni {
        uint32_t vni;
+       // Egress rate limits shared by all NICs
+       std::shared_ptr<PollLimit> egress_limit;
+       std::shared_ptr<VniCounters> counters;
+       std::shared_ptr<StormControl> storm_control;
+       // Ingress rate limits
+       std::shared_ptr<VniPolicer> policer;
+       // Counts and polices packets between the vtep and the VNI's head or
+       // switch
+       BrickShrPtr edge;
        /* Switch brick */
        BrickShrPtr sw;
        /* nic id -> nic branch */
@@ -274,13 +1001,71 @@ class Graph {
     };
 
     GraphNic *FindNic(const app::Nic &nic);
+    /**
+     * Build rule hits tables of a NIC from its security groups, they
+     * replace the current ones with the next firewall reload.
+     * @param   gn branch of the NIC
+     * @param   nic model of the NIC
+     */
+    void RuleHitsBuild(GraphNic *gn, const app::Nic &nic);
+    /**
+     * Add counts of rule hits tables replaced by the poller to
+     * gn->rule_hits_base and free them.
+     * @param   gn branch of the NIC
+     */
+    void RuleHitsCollect(GraphNic *gn);
+    /**
+     * Load security group rules of a NIC in its firewall, see FwUpdate
+     * @param   nic model of the NIC
+     * @param   gn NIC's branch in the graph
+     */
+    void FwUpdateRules(const app::Nic &nic, GraphNic *gn);
+    /**
+     * Read the counters of a NIC branch.
+     * @param   gn branch of the NIC
+     * @param   stats statistics to fill, other fields are left untouched
+     */
+    void NicCounterStats(const GraphNic &gn, app::NicStats *stats);
+    /**
+     * Replace all rules of a NIC's firewall and reload it
+     * @param   nic model of the NIC
+     * @param   gn NIC's branch in the graph
+     * @param   rules rules to load (see FwLoadRules)
+     * @param   out_rules raw rules to load on east side
+     * @param   out_match filter matching NIC's IPs
+     */
+    void FwLoad(const app::Nic &nic, GraphNic *gn,
+                const std::vector<app::FwRule> &rules,
+                const std::string &out_rules, const std::string &out_match);
     void LinkSniffer(const app::Nic &nic, BrickShrPtr n_sniffer);
+    /**
+     * Get where the poller looks for the stream of a NIC.
+     * @param   nic_id NIC id, empty for the physical NIC
+     * @return  stream pointer read by the poller, NULL if the NIC does not
+     *          exist
+     */
+    std::atomic<app::Capture *> *StreamHook(const std::string &nic_id);
     /* Global branch. */
     BrickShrPtr nic_;
     BrickShrPtr vtep_;
     bool isVtep6_;
+    // MTU of the physical NIC
+    uint16_t nic_mtu_;
+    BrickShrPtr tx_mark_;
+    struct TxMarkState tx_mark_state_;
+    // Poll being processed by the poller
+    struct PollClock poll_clock_;
+    // Writes all packet traces to their files
+    app::CaptureWriter capture_writer_;
+    // Packet trace of the physical NIC, must be released after its brick
+    std::shared_ptr<app::Capture> capture_;
     BrickShrPtr sniffer_;
-    FILE *pcap_file_;
+    // NIC id (empty for the physical NIC) -> running stream
+    std::map<std::string, std::shared_ptr<app::Capture>> streams_;
+    // Number of streams started, used to build unique topics
+    uint64_t stream_count_;
+    // Packets given by the vtep to VNIs which have been removed since
+    uint64_t removed_vni_rx_;
     /* vni -> vni branch */
     std::map<uint32_t, struct GraphVni> vnis_;
 
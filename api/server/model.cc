@@ -30,8 +30,91 @@ Nic::Nic() {
     ip_anti_spoof = false;
     packet_trace = false;
     packet_trace_path = "";
+    packet_trace_snaplen = 0;
+    packet_trace_sampling = 0;
     bypass_filtering = false;
     type = VHOST_USER_SERVER;
+    egress_bps_limit = 0;
+    egress_pps_limit = 0;
+    ingress_bps_limit = 0;
+    ingress_pps_limit = 0;
+    new_conn_pps_limit = 0;
+    bum_pps_limit = 0;
+    priority = 0;
+    mss_clamp = false;
+    count_rule_hits = false;
+}
+
+Vni::Vni() {
+    vni = 0;
+    egress_bps_limit = 0;
+    egress_pps_limit = 0;
+    ingress_bps_limit = 0;
+    ingress_pps_limit = 0;
+    bum_pps_limit = 0;
+}
+
+VniStats::VniStats() {
+    nic_count = 0;
+    egress_throttled = 0;
+    bum_dropped = 0;
+    ingress_policed = 0;
+}
+
+BrickDrops::BrickDrops() {
+    reason = DROP_VTEP;
+    packets = 0;
+    bytes = 0;
+}
+
+LatencyStats::LatencyStats() {
+    samples = 0;
+    p50 = 0;
+    p99 = 0;
+    p999 = 0;
+}
+
+NicStats::NicStats() {
+    in = 0;
+    out = 0;
+    egress_throttled = 0;
+    bum_dropped = 0;
+    mss_clamped = 0;
+    trace_dropped = 0;
+    egress_packets = 0;
+    egress_bytes = 0;
+    ingress_packets = 0;
+    ingress_bytes = 0;
+    egress_firewall_dropped = 0;
+    ingress_firewall_dropped = 0;
+    egress_antispoof_dropped = 0;
+    ingress_antispoof_dropped = 0;
+    ingress_policed = 0;
+    egress_conn_rejected = 0;
+    ingress_conn_rejected = 0;
+    ingress_vhost_dropped_bytes = 0;
+    has_latency = false;
+}
+
+CaptureStream::CaptureStream() {
+    snaplen = 0;
+    sampling = 0;
+    pps_limit = 0;
+    duration = 0;
+}
+
+PortTrace::PortTrace() {
+    enable = false;
+    path = "";
+    snaplen = 0;
+    sampling = 0;
+    duration = 0;
+}
+
+TxClassStats::TxClassStats() {
+    dscp_class = 0;
+    packets = 0;
+    bytes = 0;
 }
 
 Error::Error() {
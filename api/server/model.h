@@ -23,6 +23,11 @@
 #include <map>
 #include <functional>
 
+// Number of traffic classes, a class is a DSCP class selector (DSCP >> 3)
+#define TX_CLASS_NB 8
+// Highest NIC priority
+#define NIC_PRIORITY_MAX 7
+
 namespace app {
 
 class Ip {
@@ -84,11 +89,84 @@ struct Nic {
     std::vector<std::string> security_groups;
     bool packet_trace;
     std::string packet_trace_path;
+    // Pcap filter of traced packets, empty to trace all packets
+    std::string packet_trace_filter;
+    // Bytes traced from each packet, 0 for full packets
+    uint32_t packet_trace_snaplen;
+    // Trace one packet out of N, 0 or 1 to trace all packets
+    uint32_t packet_trace_sampling;
     bool ip_anti_spoof;
     std::string sniff_target_nic_id;
     bool bypass_filtering;
     enum NicType type;
     std::string path;
+    // Egress rate limits in bits and packets per second, 0 for no limit
+    uint64_t egress_bps_limit;
+    uint64_t egress_pps_limit;
+    // Ingress rate limits in bits and packets per second, 0 for no limit
+    uint64_t ingress_bps_limit;
+    uint64_t ingress_pps_limit;
+    // New TCP connections per second the NIC can open and accept,
+    // 0 for no limit
+    uint64_t new_conn_pps_limit;
+    // Broadcast and multicast packets per second the NIC can send,
+    // 0 for no limit
+    uint64_t bum_pps_limit;
+    // Polling priority, from 0 (default) to NIC_PRIORITY_MAX
+    uint32_t priority;
+    // Lower TCP MSS so encapsulated packets fit in the physical MTU
+    bool mss_clamp;
+    // Count packets matching each rule of the NIC's security groups
+    bool count_rule_hits;
+};
+
+// Time packets spent in the graph, from their poll to their transmission
+struct LatencyStats {
+    LatencyStats();
+    // Number of measured packets
+    uint64_t samples;
+    // Percentiles in nanoseconds
+    uint64_t p50;
+    uint64_t p99;
+    uint64_t p999;
+};
+
+struct NicStats {
+    NicStats();
+    // Bytes received and transmitted by the NIC
+    uint64_t in;
+    uint64_t out;
+    // Polls of the NIC skipped because its egress limit has been reached
+    uint64_t egress_throttled;
+    // Broadcast and multicast packets dropped by the NIC's storm control
+    uint64_t bum_dropped;
+    // TCP SYN packets which MSS has been lowered
+    uint64_t mss_clamped;
+    // Packets missing in the packet trace because the writer was late
+    uint64_t trace_dropped;
+    // Packets and bytes sent by the NIC, and coming to the NIC before
+    // being filtered
+    uint64_t egress_packets;
+    uint64_t egress_bytes;
+    uint64_t ingress_packets;
+    uint64_t ingress_bytes;
+    // Packets dropped by the firewall and antispoof in each direction
+    uint64_t egress_firewall_dropped;
+    uint64_t ingress_firewall_dropped;
+    uint64_t egress_antispoof_dropped;
+    uint64_t ingress_antispoof_dropped;
+    // Packets coming to the NIC dropped by its ingress limits
+    uint64_t ingress_policed;
+    // TCP SYN packets dropped by the new connections limit in each direction
+    uint64_t egress_conn_rejected;
+    uint64_t ingress_conn_rejected;
+    // Bytes which could not be given to the NIC (guest ring full)
+    uint64_t ingress_vhost_dropped_bytes;
+    // Latency of packets sent by the NIC and coming to the NIC, only
+    // measured if has_latency is set (see config.latency_sampling)
+    bool has_latency;
+    struct LatencyStats egress_latency;
+    struct LatencyStats ingress_latency;
 };
 
 struct Rule {
@@ -116,11 +194,111 @@ struct Sg {
     bool operator== (const Sg& a) const;
 };
 
+struct Vni {
+    Vni();
+    uint32_t vni;
+    // Egress rate limits shared by all NICs of the VNI, 0 for no limit
+    uint64_t egress_bps_limit;
+    uint64_t egress_pps_limit;
+    // Ingress rate limits shared fairly by all NICs of the VNI, 0 for no
+    // limit
+    uint64_t ingress_bps_limit;
+    uint64_t ingress_pps_limit;
+    // Broadcast and multicast packets per second all NICs of the VNI can
+    // send, 0 for no limit
+    uint64_t bum_pps_limit;
+};
+
+struct VniStats {
+    VniStats();
+    // Number of NICs of the VNI
+    uint32_t nic_count;
+    // Polls of a NIC skipped because the VNI's egress limit has been reached
+    uint64_t egress_throttled;
+    // Broadcast and multicast packets dropped by the VNI's storm control
+    uint64_t bum_dropped;
+    // Packets going to the VNI dropped by its ingress limits
+    uint64_t ingress_policed;
+};
+
+// Why packets are dropped by the graph
+enum DropReason {
+    // VXLAN packets for an unknown VNI, dropped by the vtep
+    DROP_VTEP = 0,
+    // No firewall rule nor state allows the packet
+    DROP_FIREWALL = 1,
+    // Bad MAC, IP or ARP sent by a NIC
+    DROP_ANTISPOOF = 2,
+    // Broadcast and multicast storm control of a NIC or of its VNI
+    DROP_STORM = 3,
+    // Receive ring of the NIC is full
+    DROP_VHOST_FULL = 4,
+    // Ingress rate limits of a NIC or of a VNI
+    DROP_POLICER = 5,
+    // New TCP connections limit of a NIC
+    DROP_CONN_LIMIT = 6,
+    DROP_REASON_NB
+};
+
+struct BrickDrops {
+    BrickDrops();
+    // Name of the brick, empty for drops of all bricks
+    std::string brick;
+    enum DropReason reason;
+    // Dropped packets, unknown for DROP_VHOST_FULL
+    uint64_t packets;
+    // Dropped bytes, only known for DROP_VHOST_FULL
+    uint64_t bytes;
+};
+
+struct CaptureStream {
+    CaptureStream();
+    // NIC to capture, empty for the physical port
+    std::string nic_id;
+    // pcap filter of streamed packets, empty for all packets
+    std::string filter;
+    // Bytes kept from each packet, 0 for full packets
+    uint32_t snaplen;
+    // Stream one packet out of sampling packets matching the filter
+    uint32_t sampling;
+    // Packets streamed per second, 0 for no limit
+    uint32_t pps_limit;
+    // Seconds before the stream ends, 0 for no limit
+    uint32_t duration;
+};
+
+struct PortTrace {
+    PortTrace();
+    // Trace packets going through the physical NIC
+    bool enable;
+    // Path of the pcap file, empty for the default path
+    std::string path;
+    // pcap filter of traced packets, empty for all packets
+    std::string filter;
+    // Bytes kept from each packet, 0 for full packets
+    uint32_t snaplen;
+    // Trace one packet out of sampling packets matching the filter
+    uint32_t sampling;
+    // Seconds before tracing stops, 0 for no limit
+    uint32_t duration;
+};
+
+struct TxClassStats {
+    TxClassStats();
+    // DSCP class selector (DSCP >> 3) of sent packets
+    uint32_t dscp_class;
+    // Packets and bytes sent on the physical NIC in this class
+    uint64_t packets;
+    uint64_t bytes;
+};
+
 struct Model {
     // SG id -> SG
     std::map<std::string, Sg> security_groups;
     // NIC id -> NIC
     std::map<std::string, Nic> nics;
+    // VNI -> VNI configuration
+    std::map<uint32_t, Vni> vnis;
 };
 
 struct Error {
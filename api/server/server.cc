@@ -18,6 +18,7 @@ extern "C" {
 #include <unistd.h>
 }
 #include <thread>
+#include <vector>
 #include "api/server/server.h"
 #include "api/server/app.h"
 #include "api/server/api.h"
@@ -25,6 +26,7 @@ extern "C" {
 ApiServer::ApiServer(std::string zmq_endpoint, bool *end_trigger) {
     endpoint_ = zmq_endpoint;
     end_ = end_trigger;
+    counters_date_ = 0;
     Prepare();
 }
 
@@ -57,6 +59,7 @@ void
 ApiServer::Run() {
     while (42) {
         Loop();
+        PublishCounters();
         std::this_thread::sleep_for(std::chrono::milliseconds(100));
         if (end_ != nullptr && *end_ == true)
             break;
@@ -76,6 +79,24 @@ ApiServer::Prepare() {
     }
 }
 
+void
+ApiServer::PublishCounters() {
+    if (!app::counters.Opened())
+        return;
+    int64_t now = g_get_monotonic_time();
+    if (now - counters_date_ < COUNTERS_PERIOD_MS * 1000)
+        return;
+    counters_date_ = now;
+
+    // Counters are read from the API thread, like any request
+    std::vector<Counters::Counter> counters;
+    Api::ActionCounters(&counters);
+    size_t written = app::counters.Update(counters, now);
+    if (written < counters.size())
+        LOG_WARNING_("%zu counters not published",
+                     counters.size() - written);
+}
+
 void ApiServer::StaticLoop(ApiServer *me) {
     if (me != NULL)
         me->Run();
@@ -33,10 +33,14 @@ class ApiServer {
     inline void Loop();
     inline void Process(const zmqpp::message &req, zmqpp::message *res);
     static void StaticLoop(ApiServer *me);
+    // Update the counter region if it is time to
+    void PublishCounters();
     std::string endpoint_;
     zmqpp::context context_;
     std::shared_ptr <zmqpp::socket> socket_;
     bool *end_;
+    // Monotonic date of the last counter update in microseconds
+    int64_t counters_date_;
 };
 
 #endif  // API_SERVER_SERVER_H_
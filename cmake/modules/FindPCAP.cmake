@@ -0,0 +1,30 @@
+# - Find pcap library
+# Defines:
+#  PCAP_INCLUDE_DIR    - where to find header files, etc.
+#  PCAP_LIBRARY        - List of pcap libraries.
+#  PCAP_FOUND          - True if libpcap is found.
+
+find_path(PCAP_ROOT_DIR
+    NAMES include/pcap/pcap.h
+)
+
+find_library(PCAP_LIBRARY
+    NAMES pcap
+    HINTS ${PCAP_ROOT_DIR}/lib
+)
+
+find_path(PCAP_INCLUDE_DIR
+    NAMES pcap/pcap.h
+    HINTS ${PCAP_ROOT_DIR}/include
+)
+
+include(FindPackageHandleStandardArgs)
+find_package_handle_standard_args(PCAP REQUIRED_VARS
+	PCAP_LIBRARY
+	PCAP_INCLUDE_DIR)
+
+mark_as_advanced(
+	PCAP_ROOT_DIR
+	PCAP_LIBRARY
+	PCAP_INCLUDE_DIR
+)
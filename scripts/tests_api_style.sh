@@ -11,6 +11,8 @@ $BUTTERFLY_ROOT/api/client/sg.cc \
 $BUTTERFLY_ROOT/api/client/shutdown.cc \
 $BUTTERFLY_ROOT/api/client/status.cc \
 $BUTTERFLY_ROOT/api/client/dump.cc \
+$BUTTERFLY_ROOT/api/client/counters.cc \
+$BUTTERFLY_ROOT/api/client/capture.cc \
 $BUTTERFLY_ROOT/api/server/app.cc \
 $BUTTERFLY_ROOT/api/server/app.h \
 $BUTTERFLY_ROOT/api/server/server.cc \
@@ -22,8 +24,14 @@ $BUTTERFLY_ROOT/api/server/api.h \
 $BUTTERFLY_ROOT/api/server/api_0.cc \
 $BUTTERFLY_ROOT/api/server/graph.cc \
 $BUTTERFLY_ROOT/api/server/graph.h \
+$BUTTERFLY_ROOT/api/server/firewall.cc \
+$BUTTERFLY_ROOT/api/server/firewall.h \
+$BUTTERFLY_ROOT/api/server/capture.cc \
+$BUTTERFLY_ROOT/api/server/capture.h \
 $BUTTERFLY_ROOT/api/common/crypto.cc \
-$BUTTERFLY_ROOT/api/common/crypto.h"
+$BUTTERFLY_ROOT/api/common/crypto.h \
+$BUTTERFLY_ROOT/api/common/counters.cc \
+$BUTTERFLY_ROOT/api/common/counters.h"
 
 $BUTTERFLY_ROOT/scripts/cpplint.py --filter=-build/c++11 --root=$BUTTERFLY_ROOT $sources
 if [ $? != 0 ]; then
@@ -9,6 +9,8 @@ set -e
 # 4th argument is the file path containing expected responses
 # If there is a 5th parameter, then execute test and write client output to
 # expected response file (in verbose mode so you can check response).
+# If a file named like the request file ending with _opts instead of _in
+# exists, its content is added to server's options.
 if [ -z "$4" ]; then
     echo "Usage: $0 CLIENT_BIN SERVER_BIN REQUEST_FILE EXPECTED_RESPONSE_FILE [LEARN_MODE]"
     echo "if LEARN_MODE is set (any parameter is ok), then client output will be written to"
@@ -44,8 +46,15 @@ echo ----------- $request_file ------------ >> out.txt
 echo >> out.txt
 echo >> out.txt # add some blank lines
 
+# Extra server options of this test
+server_opts=""
+opts_file=$(echo $request_file | sed -e 's/_in$/_opts/')
+if [ -f $opts_file ]; then
+    server_opts=$(cat $opts_file)
+fi
+
 # Start server
-$server --dpdk-args "-c1 -n1 --vdev=eth_ring0" -l debug -i ::101 -s /tmp --endpoint=tcp://0.0.0.0:8765 --packet-trace &>> out.txt &
+$server --dpdk-args "-c1 -n1 --vdev=eth_ring0" -l debug -i ::101 -s /tmp --endpoint=tcp://0.0.0.0:8765 --packet-trace $server_opts &>> out.txt &
 server_pid=$!
 sleep 1
 set +e
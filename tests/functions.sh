@@ -737,6 +737,40 @@ function nic_update {
      fi
 }
 
+# Print the value of a NIC statistic, e.g. nic_stats_value 0 1 "bum dropped"
+function nic_stats_value {
+    but_id=$1
+    nic_id=$2
+    label=$3
+
+    $BUTTERFLY_BUILD_ROOT/api/client/butterfly nic stats nic-$nic_id -e tcp://127.0.0.1:876$but_id | sed -n "s/^$label: //p"
+}
+
+# Update a VNI, e.g. vni_update 0 42 "ingress_pps_limit: 100"
+function vni_update {
+    but_id=$1
+    vni=$2
+    update_options=${@:3}
+    f=/tmp/butterfly.req
+
+    echo "[butterfly-$but_id] update vni $vni with: $update_options"
+    echo "messages { revision: 0 message_0 { request { vni_update {" \
+         "vni: $vni $update_options } } } }" > $f
+    request $but_id $f
+}
+
+# Print the value of a VNI statistic, e.g. vni_stats_value 0 42 bum_dropped
+function vni_stats_value {
+    but_id=$1
+    vni=$2
+    field=$3
+    f=/tmp/butterfly-vni-stats.req
+
+    echo "messages { revision: 0 message_0 { request { vni_stats: $vni } } }" > $f
+    $BUTTERFLY_BUILD_ROOT/api/client/butterfly request $f --stdout -e tcp://127.0.0.1:876$but_id | sed -n "s/^ *$field: //p"
+    rm $f
+}
+
 function tap_del {
     nic_id=$1
 
@@ -1020,6 +1054,31 @@ function sg_rule_del_ip_and_port {
     cli $but_id 0 sg rule del $sg --dir in --ip-proto $protocol --port-start $port --port-end $port --cidr $ip/$mask_size
 }
 
+function sg_rule_add_ip_and_port_range {
+    protocol=$1
+    but_id=$2
+    ip=$3
+    mask_size=$4
+    port_start=$5
+    port_end=$6
+    sg=$7
+    echo "[butterfly-$but_id] add rule $protocol ports $port_start-$port_end ip $ip/$mask_size in $sg"
+    cli $but_id 0 sg rule add $sg --dir in --ip-proto $protocol --port-start $port_start --port-end $port_end --cidr $ip/$mask_size
+}
+
+function sg_rule_del_ip_and_port_range {
+    protocol=$1
+    but_id=$2
+    ip=$3
+    mask_size=$4
+    port_start=$5
+    port_end=$6
+    sg=$7
+    echo "[butterfly-$but_id] del rule $protocol ports $port_start-$port_end ip $ip/$mask_size in $sg"
+
+    cli $but_id 0 sg rule del $sg --dir in --ip-proto $protocol --port-start $port_start --port-end $port_end --cidr $ip/$mask_size
+}
+
 function sg_rule_add_ip {
     but_id=$1
     ip=$2
@@ -1042,6 +1101,28 @@ function sg_rule_del_ip {
     cli $but_id 0 sg rule del $sg --dir in --ip-proto -1 --cidr $ip/$mask_size
 }
 
+function sg_rule_add_out_ip {
+    but_id=$1
+    ip=$2
+    mask_size=$3
+    sg=$4
+
+    echo "[butterfly-$but_id] add rule on $sg: allow $ip/$mask_size outbound on all protocols"
+
+    cli $but_id 0 sg rule add $sg --dir out --ip-proto -1 --cidr $ip/$mask_size
+}
+
+function sg_rule_del_out_ip {
+    but_id=$1
+    ip=$2
+    mask_size=$3
+    sg=$4
+
+    echo "[butterfly-$but_id] delete rule on $sg: allow $ip/$mask_size outbound on all protocols"
+
+    cli $but_id 0 sg rule del $sg --dir out --ip-proto -1 --cidr $ip/$mask_size
+}
+
 function sg_rule_add_with_sg_member {
     protocol=$1
     sg=$2
@@ -0,0 +1,32 @@
+#!/bin/bash
+
+BUTTERFLY_BUILD_ROOT=$1
+BUTTERFLY_SRC_ROOT=$(cd "$(dirname $0)/../../../.." && pwd)
+source $BUTTERFLY_SRC_ROOT/tests/functions.sh
+
+network_connect 0 1
+server_start 0
+nic_add 0 1 42 sg-1
+nic_add 0 2 42 sg-2
+sg_rule_add_all_open 0 sg-1
+sg_rule_add_all_open 0 sg-2
+qemus_start 1 2
+
+ssh_ping 1 2
+ssh_ping 2 1
+
+sg_rule_add_out_ip 0 42.0.0.3 32 sg-1
+ssh_no_ping 1 2
+ssh_ping 2 1
+
+sg_rule_add_out_ip 0 42.0.0.2 32 sg-1
+ssh_ping 1 2
+
+sg_rule_del_out_ip 0 42.0.0.2 32 sg-1
+ssh_no_ping 1 2
+ssh_ping 2 1
+
+qemus_stop 1 2
+server_stop 0
+network_disconnect 0 1
+return_result
@@ -0,0 +1,41 @@
+#!/bin/bash
+
+BUTTERFLY_BUILD_ROOT=$1
+BUTTERFLY_SRC_ROOT=$(cd "$(dirname $0)/../../../.." && pwd)
+source $BUTTERFLY_SRC_ROOT/tests/functions.sh
+
+network_connect 0 1
+server_start 0
+nic_add 0 1 42 sg-1
+nic_add 0 2 42 sg-1
+qemus_start 1 2
+
+sg_rule_add_ip_and_port tcp 0 42.0.0.1 32 6000 sg-1
+ssh_connection_test tcp 1 2 6000
+ssh_no_connection_test tcp 1 2 6001
+ssh_no_connection_test tcp 2 1 6000
+
+sg_rule_add_ip_and_port tcp 0 42.0.0.1 32 6001 sg-1
+ssh_connection_test tcp 1 2 6000
+ssh_connection_test tcp 1 2 6001
+ssh_no_connection_test tcp 2 1 6000
+
+sg_rule_add_ip_and_port tcp 0 42.0.0.0 24 6000 sg-1
+ssh_connection_test tcp 1 2 6000
+ssh_connection_test tcp 1 2 6001
+ssh_connection_test tcp 2 1 6000
+
+nic_set_sg 0 2 sg-1
+ssh_connection_test tcp 1 2 6000
+ssh_connection_test tcp 1 2 6001
+ssh_connection_test tcp 2 1 6000
+
+sg_rule_del_ip_and_port tcp 0 42.0.0.0 24 6000 sg-1
+ssh_connection_test tcp 1 2 6000
+ssh_connection_test tcp 1 2 6001
+ssh_no_connection_test tcp 2 1 6000
+
+qemus_stop 1 2
+server_stop 0
+network_disconnect 0 1
+return_result
@@ -0,0 +1,34 @@
+#!/bin/bash
+
+BUTTERFLY_BUILD_ROOT=$1
+BUTTERFLY_SRC_ROOT=$(cd "$(dirname $0)/../../../.." && pwd)
+source $BUTTERFLY_SRC_ROOT/tests/functions.sh
+
+network_connect 0 1
+server_start 0
+nic_add 0 1 42 sg-2
+nic_add 0 2 42 sg-1
+nic_add 0 3 42 sg-3
+qemus_start 1 2 3
+
+for i in $(seq 1 40); do
+    sg_member_add 0 sg-2 42.0.1.$i
+done
+sg_member_add 0 sg-2 42.0.0.1
+sg_rule_add_with_sg_member tcp sg-1 0 6000 sg-2
+ssh_connection_test tcp 1 2 6000
+ssh_no_connection_test tcp 3 2 6000
+ssh_no_connection_test tcp 2 1 6000
+
+sg_member_add 0 sg-2 42.0.0.3
+ssh_connection_test tcp 1 2 6000
+ssh_connection_test tcp 3 2 6000
+
+sg_member_del 0 sg-2 42.0.0.1
+ssh_no_connection_test tcp 1 2 6000
+ssh_connection_test tcp 3 2 6000
+
+qemus_stop 1 2 3
+server_stop 0
+network_disconnect 0 1
+return_result
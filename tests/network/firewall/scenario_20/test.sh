@@ -0,0 +1,39 @@
+#!/bin/bash
+
+BUTTERFLY_BUILD_ROOT=$1
+BUTTERFLY_SRC_ROOT=$(cd "$(dirname $0)/../../../.." && pwd)
+source $BUTTERFLY_SRC_ROOT/tests/functions.sh
+
+network_connect 0 1
+server_start 0
+nic_add 0 1 42 sg-2
+nic_add 0 2 42 sg-1
+nic_add 0 3 42 sg-2
+qemus_start 1 2 3
+
+sg_rule_add_ip_and_port_range tcp 0 42.0.0.0 24 6000 6010 sg-1
+sg_rule_add_ip_and_port_range tcp 0 42.0.0.1 32 6005 6020 sg-1
+sg_rule_add_ip_and_port_range tcp 0 42.0.0.1 32 6021 6030 sg-1
+sg_rule_add_ip_and_port tcp 0 42.0.0.1 32 6000 sg-1
+ssh_connection_test tcp 1 2 6000
+ssh_connection_test tcp 1 2 6015
+ssh_connection_test tcp 1 2 6025
+ssh_no_connection_test tcp 1 2 6031
+ssh_connection_test tcp 3 2 6005
+ssh_no_connection_test tcp 3 2 6015
+
+sg_rule_del_ip_and_port_range tcp 0 42.0.0.0 24 6000 6010 sg-1
+ssh_connection_test tcp 1 2 6000
+ssh_no_connection_test tcp 1 2 6003
+ssh_connection_test tcp 1 2 6015
+ssh_no_connection_test tcp 3 2 6005
+
+sg_rule_del_ip_and_port_range tcp 0 42.0.0.1 32 6005 6020 sg-1
+ssh_connection_test tcp 1 2 6000
+ssh_no_connection_test tcp 1 2 6015
+ssh_connection_test tcp 1 2 6025
+
+qemus_stop 1 2 3
+server_stop 0
+network_disconnect 0 1
+return_result
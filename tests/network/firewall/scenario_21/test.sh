@@ -0,0 +1,46 @@
+#!/bin/bash
+
+BUTTERFLY_BUILD_ROOT=$1
+BUTTERFLY_SRC_ROOT=$(cd "$(dirname $0)/../../../.." && pwd)
+source $BUTTERFLY_SRC_ROOT/tests/functions.sh
+
+# Replace sg-1 with rules allowing 42.0.0.1/32 on the given TCP ports
+function sg_replace {
+    but_id=$1
+    ports=${@:2}
+    f=/tmp/butterfly.req
+    echo "[butterfly-$but_id] replace sg-1 allowing tcp ports $ports"
+
+    rules=""
+    for port in $ports; do
+        rules+="rule { direction: INBOUND protocol: 6 port_start: $port"
+        rules+=" port_end: $port cidr { address: \"42.0.0.1\" mask_size: 32 } }"
+    done
+    echo "messages { revision: 0 message_0 { request { sg_add {" \
+         "id: \"sg-1\" $rules } } } }" > $f
+    request $but_id $f
+}
+
+network_connect 0 1
+server_start 0
+nic_add 0 1 42 sg-1
+nic_add 0 2 42 sg-1
+qemus_start 1 2
+
+sg_rule_add_ip_and_port tcp 0 42.0.0.1 32 6000 sg-1
+ssh_connection_test tcp 1 2 6000
+ssh_no_connection_test tcp 1 2 6001
+
+sg_replace 0 6000 6001
+ssh_connection_test tcp 1 2 6000
+ssh_connection_test tcp 1 2 6001
+ssh_no_connection_test tcp 2 1 6000
+
+sg_replace 0 6001
+ssh_no_connection_test tcp 1 2 6000
+ssh_connection_test tcp 1 2 6001
+
+qemus_stop 1 2
+server_stop 0
+network_disconnect 0 1
+return_result
@@ -0,0 +1,53 @@
+#!/bin/bash
+
+BUTTERFLY_BUILD_ROOT=$1
+BUTTERFLY_SRC_ROOT=$(cd "$(dirname $0)/../../.." && pwd)
+source $BUTTERFLY_SRC_ROOT/tests/functions.sh
+
+network_connect 0 1
+server_start_options 0 -t --vxlan-port-hash l4 --vxlan-port-range 50000-50015
+server_start 1
+nic_add 0 1 42 sg-1
+nic_add 1 2 42 sg-1
+sg_rule_add_all_open 0 sg-1
+sg_rule_add_all_open 1 sg-1
+qemu_start_async 1
+qemu_start_async 2
+qemus_wait 1 2
+
+ssh_ping 1 2
+ssh_connection_test tcp 1 2 4550
+ssh_connection_test tcp 1 2 4551
+ssh_connection_test udp 1 2 7543
+ssh_connection_test udp 1 2 7544
+
+# Physical NIC trace is complete once butterfly is stopped
+pid=$(ps --ppid ${server_pids[0]} -o pid= | tr -d ' ')
+trace=/tmp/butterfly-$pid-main.pcap
+qemu_stop 1
+qemu_stop 2
+server_stop 0
+server_stop 1
+
+if [ ! -f $trace ]; then
+    fail "can not find trace $trace"
+fi
+packets=$(tcpdump -nn -vv -r $trace udp dst port 4789 2> /dev/null)
+ports=$(echo "$packets" | grep -o "\.[0-9]* > [^ ]*\.4789:" | \
+        sed 's/^\.\([0-9]*\) .*/\1/')
+if [ -z "$ports" ]; then
+    fail "no VXLAN packet found in $trace"
+fi
+for port in $ports; do
+    if [ $port -lt 50000 ] || [ $port -gt 50015 ]; then
+        fail "VXLAN source port $port out of 50000-50015"
+    fi
+done
+echo "VXLAN source ports in 50000-50015 OK"
+if echo "$packets" | grep -q "bad udp cksum"; then
+    fail "bad UDP checksum in VXLAN packets"
+fi
+echo "VXLAN UDP checksums OK"
+
+network_disconnect 0 1
+return_result
@@ -0,0 +1,78 @@
+#!/bin/bash
+
+BUTTERFLY_BUILD_ROOT=$1
+BUTTERFLY_SRC_ROOT=$(cd "$(dirname $0)/../../.." && pwd)
+source $BUTTERFLY_SRC_ROOT/tests/functions.sh
+
+counters_file=/dev/shm/butterfly-counters-test
+counters=$BUTTERFLY_BUILD_ROOT/counters_output
+
+function counters_read {
+    $BUTTERFLY_BUILD_ROOT/api/client/butterfly counters $counters_file $@ \
+        &> $counters
+    if [ $? -ne 0 ]; then
+        fail "cannot read counters, check counters_output file"
+    fi
+}
+
+function counter_value {
+    grep "^$1 " $counters | cut -d ' ' -f 2
+}
+
+network_connect 0 1
+server_start_options 0 -t --counters-path $counters_file
+server_start 1
+nic_add 0 1 42 sg-1
+nic_add 1 2 42 sg-1
+sg_rule_add_all_open 0 sg-1
+sg_rule_add_all_open 1 sg-1
+
+# Counters are published every second
+sleep 2
+counters_read
+if ! grep -q "^date: [0-9]*$" $counters; then
+    fail "no date in counters"
+fi
+for c in app.start_date nic.nic-1.in nic.nic-1.egress_packets; do
+    if [ -z "$(counter_value $c)" ]; then
+        fail "counter $c not published"
+    fi
+done
+echo "counters published OK"
+
+counters_read --prefix nic.nic-1.
+if [ -n "$(grep -v "^date: " $counters | grep -v "^nic\.nic-1\.")" ]; then
+    fail "counters not starting with nic.nic-1. printed"
+fi
+if [ -z "$(counter_value nic.nic-1.ingress_packets)" ]; then
+    fail "counter nic.nic-1.ingress_packets missing with prefix"
+fi
+echo "counters prefix OK"
+
+qemu_start_async 1
+qemu_start_async 2
+qemus_wait 1 2
+ssh_ping 1 2
+ssh_connection_test tcp 1 2 4550
+
+sleep 2
+counters_read --prefix nic.nic-1.
+for c in nic.nic-1.egress_packets nic.nic-1.ingress_packets; do
+    if [ "$(counter_value $c)" == "0" ]; then
+        fail "counter $c did not increase"
+    fi
+done
+echo "counters increase OK"
+
+qemu_stop 1
+qemu_stop 2
+server_stop 0
+server_stop 1
+
+if [ -e $counters_file ]; then
+    fail "counters file $counters_file still present"
+fi
+echo "counters file removed OK"
+
+network_disconnect 0 1
+return_result
@@ -0,0 +1,52 @@
+#!/bin/bash
+
+BUTTERFLY_BUILD_ROOT=$1
+BUTTERFLY_SRC_ROOT=$(cd "$(dirname $0)/../../.." && pwd)
+source $BUTTERFLY_SRC_ROOT/tests/functions.sh
+
+# Open 100 TCP connections at once from VM $1 to VM $2
+function conn_burst {
+    id1=$1
+    id2=$2
+    echo "burst of connections VM $id1 ---> VM $id2"
+    ssh_run $id1 "for i in \$(seq 100); do ncat -4 -w 1 --send-only" \
+        "42.0.0.$id2 4551 < /dev/null & done; wait" &> /dev/null
+}
+
+network_connect 0 1
+server_start 0
+nic_add 0 1 42 sg-1
+nic_add 0 2 42 sg-1
+sg_rule_add_all_open 0 sg-1
+qemus_start 1 2
+
+nic_update 0 1 --new-conn-pps 5
+ssh_connection_test tcp 1 2 4550
+
+conn_burst 1 2
+egress=$(nic_stats_value 0 1 "egress connections rejected")
+if [ -z "$egress" ] || [ "$egress" == "0" ]; then
+    fail "no egress connection rejected above the limit"
+fi
+echo "egress connections rejected: $egress OK"
+
+conn_burst 2 1
+ingress=$(nic_stats_value 0 1 "ingress connections rejected")
+if [ -z "$ingress" ] || [ "$ingress" == "0" ]; then
+    fail "no ingress connection rejected above the limit"
+fi
+echo "ingress connections rejected: $ingress OK"
+
+nic_update 0 1 --new-conn-pps 0
+egress=$(nic_stats_value 0 1 "egress connections rejected")
+conn_burst 1 2
+after=$(nic_stats_value 0 1 "egress connections rejected")
+if [ "$after" != "$egress" ]; then
+    fail "connections rejected without limit"
+fi
+echo "no connection rejected without limit OK"
+
+qemus_stop 1 2
+server_stop 0
+network_disconnect 0 1
+return_result
@@ -0,0 +1,45 @@
+#!/bin/bash
+
+BUTTERFLY_BUILD_ROOT=$1
+BUTTERFLY_SRC_ROOT=$(cd "$(dirname $0)/../../.." && pwd)
+source $BUTTERFLY_SRC_ROOT/tests/functions.sh
+
+# Check that "egress throttled" of NIC 1 grew since the given value
+function throttled_check {
+    before=$1
+    what=$2
+    throttled=$(nic_stats_value 0 1 "egress throttled")
+    if [ -z "$throttled" ] || [ "$throttled" -le "$before" ]; then
+        fail "$what above the limit not throttled"
+    fi
+    echo "$what throttled: $throttled OK"
+}
+
+network_connect 0 1
+server_start 0
+nic_add 0 1 42 sg-1
+nic_add 0 2 42 sg-1
+sg_rule_add_all_open 0 sg-1
+qemus_start 1 2
+ssh_ping 1 2
+
+nic_update 0 1 --egress-pps 100
+ssh_run 1 ping -f -c 1000 -w 20 42.0.0.2 &> /dev/null
+throttled_check 0 "flood ping"
+
+nic_update 0 1 --egress-pps 0 --egress-bps 1000000
+before=$(nic_stats_value 0 1 "egress throttled")
+(ssh_run 2 iperf3 -s &> /dev/null &)
+sleep 1
+ssh_run 1 iperf3 -c 42.0.0.2 -u -b 10M -l 1400 -t 3 &> /dev/null
+ssh_run 2 killall iperf3 &> /dev/null
+throttled_check $before "udp traffic"
+
+nic_update 0 1 --egress-bps 0
+ssh_ping 1 2
+ssh_connection_test tcp 1 2 4550
+
+qemus_stop 1 2
+server_stop 0
+network_disconnect 0 1
+return_result
@@ -0,0 +1,52 @@
+#!/bin/bash
+
+BUTTERFLY_BUILD_ROOT=$1
+BUTTERFLY_SRC_ROOT=$(cd "$(dirname $0)/../../.." && pwd)
+source $BUTTERFLY_SRC_ROOT/tests/functions.sh
+
+# Check that a statistic of VNI 42 on butterfly $1 is not null
+function vni_stats_check {
+    but_id=$1
+    field=$2
+    value=$(vni_stats_value $but_id 42 $field)
+    if [ -z "$value" ] || [ "$value" == "0" ]; then
+        fail "[butterfly-$but_id] vni 42 $field is null"
+    fi
+    echo "[butterfly-$but_id] vni 42 $field: $value OK"
+}
+
+network_connect 0 1
+server_start 0
+server_start 1
+nic_add 0 1 42 sg-1
+nic_add 1 2 42 sg-1
+sg_rule_add_all_open 0 sg-1
+sg_rule_add_all_open 1 sg-1
+qemu_start_async 1
+qemu_start_async 2
+qemus_wait 1 2
+ssh_ping 1 2
+
+if [ "$(vni_stats_value 1 42 nic_count)" != "1" ]; then
+    fail "[butterfly-1] vni 42 should have one NIC"
+fi
+
+vni_update 1 42 "ingress_pps_limit: 100"
+ssh_run 1 ping -f -c 1000 -w 20 42.0.0.2 &> /dev/null
+vni_stats_check 1 ingress_policed
+vni_update 1 42 "ingress_pps_limit: 0"
+
+vni_update 0 42 "egress_pps_limit: 100"
+ssh_run 1 ping -f -c 1000 -w 20 42.0.0.2 &> /dev/null
+vni_stats_check 0 egress_throttled
+vni_update 0 42 "egress_pps_limit: 0"
+
+ssh_ping 1 2
+ssh_connection_test tcp 1 2 4550
+
+qemu_stop 1
+qemu_stop 2
+server_stop 0
+server_stop 1
+network_disconnect 0 1
+return_result
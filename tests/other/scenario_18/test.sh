@@ -0,0 +1,45 @@
+#!/bin/bash
+
+BUTTERFLY_BUILD_ROOT=$1
+BUTTERFLY_SRC_ROOT=$(cd "$(dirname $0)/../../.." && pwd)
+source $BUTTERFLY_SRC_ROOT/tests/functions.sh
+
+# Send 300 broadcast pings from VM 1 at 100 packets per second
+function broadcast_storm {
+    echo "broadcast storm from VM 1"
+    ssh_run 1 ping -b -i 0.01 -c 300 -w 10 42.0.0.255 &> /dev/null
+}
+
+network_connect 0 1
+server_start 0
+nic_add 0 1 42 sg-1
+nic_add 0 2 42 sg-1
+sg_rule_add_all_open 0 sg-1
+qemus_start 1 2
+ssh_ping 1 2
+
+nic_update 0 1 --bum-pps 10
+broadcast_storm
+dropped=$(nic_stats_value 0 1 "bum dropped")
+if [ -z "$dropped" ] || [ "$dropped" == "0" ]; then
+    fail "no broadcast packet dropped above the NIC limit"
+fi
+echo "NIC bum dropped: $dropped OK"
+nic_update 0 1 --bum-pps 0
+
+vni_update 0 42 "bum_pps_limit: 10"
+broadcast_storm
+dropped=$(vni_stats_value 0 42 bum_dropped)
+if [ -z "$dropped" ] || [ "$dropped" == "0" ]; then
+    fail "no broadcast packet dropped above the VNI limit"
+fi
+echo "VNI bum dropped: $dropped OK"
+vni_update 0 42 "bum_pps_limit: 0"
+
+ssh_ping 1 2
+ssh_connection_test tcp 1 2 4550
+
+qemus_stop 1 2
+server_stop 0
+network_disconnect 0 1
+return_result
@@ -0,0 +1,51 @@
+#!/bin/bash
+
+BUTTERFLY_BUILD_ROOT=$1
+BUTTERFLY_SRC_ROOT=$(cd "$(dirname $0)/../../.." && pwd)
+source $BUTTERFLY_SRC_ROOT/tests/functions.sh
+
+network_connect 0 1
+server_start 0
+server_start 1
+nic_add 0 1 42 sg-1
+nic_add 1 2 42 sg-1
+sg_rule_add_all_open 0 sg-1
+sg_rule_add_all_open 1 sg-1
+nic_update 0 1 --mss-clamp true
+qemu_start_async 1
+qemu_start_async 2
+qemus_wait 1 2
+
+ssh_connection_test tcp 1 2 4550
+ssh_connection_test tcp 1 2 4551
+
+clamped=$(nic_stats_value 0 1 "mss clamped")
+if [ -z "$clamped" ] || [ "$clamped" == "0" ]; then
+    fail "no TCP SYN clamped"
+fi
+echo "mss clamped: $clamped OK"
+
+# Physical NIC trace is complete once butterfly is stopped
+pid=$(ps --ppid ${server_pids[0]} -o pid= | tr -d ' ')
+trace=/tmp/butterfly-$pid-main.pcap
+qemu_stop 1
+qemu_stop 2
+server_stop 0
+server_stop 1
+
+if [ ! -f $trace ]; then
+    fail "can not find trace $trace"
+fi
+syns=$(tcpdump -nn -vv -r $trace udp dst port 4789 2> /dev/null | \
+       grep "42\.0\.0\.1\.[0-9]* > 42\.0\.0\.2\.455[01]: Flags \[S\],")
+mss=$(echo "$syns" | grep -o "mss [0-9]*" | cut -d ' ' -f 2 | sort -u)
+if [ -z "$mss" ]; then
+    fail "no TCP SYN from VM 1 found in $trace"
+fi
+if [ "$mss" != "1390" ]; then
+    fail "TCP SYN from VM 1 with MSS $mss instead of 1390"
+fi
+echo "MSS of TCP SYN from VM 1 clamped to 1390 OK"
+
+network_disconnect 0 1
+return_result